@@ -0,0 +1,32 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* shared helpers for the bench_* binaries; every result is printed as one
+ * json object per line so runs can be diffed between commits */
+
+#include <stdio.h>      // printf
+#include <stdint.h>     // uint64_t
+#include <time.h>       // clock_gettime
+#include <stdlib.h>     // size_t
+
+/* counters.c: allocation calls made so far, and the process' peak rss */
+size_t bench_alloc_count(void);
+size_t bench_peak_rss_kb(void);
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* `bytes` is the input size of one iteration, 0 if not meaningful */
+static inline void bench_report(const char* bench, const char* name,
+                                size_t iters, uint64_t ns, size_t bytes) {
+    double secs = (double)ns / 1e9;
+    printf("{\"bench\": \"%s\", \"case\": \"%s\", \"iters\": %zu, "
+           "\"ns_per_op\": %.1f, \"mb_per_s\": %.1f}\n",
+           bench, name, iters, (double)ns / (double)iters,
+           bytes ? (double)bytes * (double)iters / 1e6 / secs : 0.0);
+}
+
+#endif // BENCH_H
@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/attention.h"
+#include "../src/tensor.h"
+#include "../src/parallel.h"
+#include "../src/mem.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* fused tiled attention against scores + softmax + matmul, across
+ * sequence lengths, with and without the causal mask.
+ *
+ *   bin/bench_attention [max_seq] [heads] [head_dim]
+ *
+ * heap_peak_bytes is the most either one had allocated at once during a
+ * call, read from the accounting allocator: the naive version holds a
+ * seq x seq score matrix, the fused one only uses stack_bytes of stack
+ * per thread. gflops counts the q k^T and p v multiply-adds of the keys
+ * each query sees */
+
+#define DEFAULT_MAX_SEQ  2048
+#define DEFAULT_HEADS    8
+#define DEFAULT_HEAD_DIM 64
+#define MEASURE_NS       200000000  // repeat for ~0.2s, keep the best run
+
+typedef bool (*AttnFn)(const Mat* q, const Mat* k, const Mat* v,
+                       size_t heads, bool causal, Mat* out);
+
+typedef struct {
+    uint64_t ns;
+    size_t heap_peak;
+} AttnRun;
+
+static AttnRun time_attention(AttnFn fn, const Mat* q, const Mat* k,
+                              const Mat* v, size_t heads, bool causal,
+                              Mat* out) {
+    MemSnapshot before, after;
+    mem_reset_stats();
+    mem_snapshot(&before);
+    AttnRun run = { UINT64_MAX, 0 };
+    uint64_t total = 0;
+    do {
+        uint64_t start = bench_now_ns();
+        if (!fn(q, k, v, heads, causal, out)) {
+            fprintf(stderr, "bench_attention: attention failed\n");
+            exit(1);
+        }
+        uint64_t ns = bench_now_ns() - start;
+        if (ns < run.ns) run.ns = ns;
+        total += ns;
+    } while (total < MEASURE_NS);
+    mem_snapshot(&after);
+    run.heap_peak = after.total.peak_bytes - before.total.live_bytes;
+    return run;
+}
+
+static Vec* random_vec(size_t n, unsigned* state) {
+    Vec* v = vec_init(n);
+    if (v == NULL || v->data == NULL) {
+        fprintf(stderr, "bench_attention: malloc failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        *state = *state * 1664525u + 1013904223u;
+        v->data[i] = (float)(*state >> 8) / (float)(1u << 24) - 0.5f;
+    }
+    return v;
+}
+
+static void report(const char* name, size_t seq, size_t heads, size_t d,
+                   bool causal, AttnRun run, double pairs) {
+    // transposed queries, outputs, scores and per-query max, sum, count
+    size_t stack_bytes = ATTN_TILE_Q * (2 * ATTN_MAX_HEAD_DIM + ATTN_TILE_K
+                                        + 3) * sizeof(float);
+    printf("{\"bench\": \"attention\", \"case\": \"%s\", \"seq\": %zu, "
+           "\"heads\": %zu, \"head_dim\": %zu, \"causal\": %s, "
+           "\"threads\": %zu, \"ms\": %.3f, \"gflops\": %.2f, "
+           "\"heap_peak_bytes\": %zu, \"stack_bytes\": %zu}\n",
+           name, seq, heads, d, causal ? "true" : "false", parallel_threads(),
+           (double)run.ns / 1e6, 4.0 * pairs * (double)d * (double)heads
+                                 / (double)run.ns,
+           run.heap_peak, strcmp(name, "fused") == 0 ? stack_bytes : 0);
+}
+
+int main(int argc, char** argv) {
+    size_t max_seq = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_MAX_SEQ;
+    size_t heads = (argc > 2) ? strtoull(argv[2], NULL, 10) : DEFAULT_HEADS;
+    size_t d = (argc > 3) ? strtoull(argv[3], NULL, 10) : DEFAULT_HEAD_DIM;
+
+    // count every byte from here on; wraps bench's own counting allocator
+    MemAllocator inner = mem_get_allocator();
+    MemAllocator accounting = mem_accounting(&inner);
+    mem_set_allocator(&accounting);
+
+    size_t cols = heads * d;
+    unsigned state = 42;
+    Vec* qv = random_vec(max_seq * cols, &state);
+    Vec* kv = random_vec(max_seq * cols, &state);
+    Vec* vv = random_vec(max_seq * cols, &state);
+    Vec* ov = random_vec(max_seq * cols, &state);
+
+    for (size_t seq = 128; seq <= max_seq; seq *= 2) {
+        Mat q = { qv->data, seq, cols, cols };
+        Mat k = { kv->data, seq, cols, cols };
+        Mat v = { vv->data, seq, cols, cols };
+        Mat out = { ov->data, seq, cols, cols };
+        for (int causal = 0; causal < 2; causal++) {
+            double pairs = causal ? (double)seq * (double)(seq + 1) / 2
+                                  : (double)seq * (double)seq;
+            AttnRun fused = time_attention(attention, &q, &k, &v, heads,
+                                           causal, &out);
+            report("fused", seq, heads, d, causal, fused, pairs);
+            AttnRun naive = time_attention(attention_naive, &q, &k, &v, heads,
+                                           causal, &out);
+            report("naive", seq, heads, d, causal, naive, pairs);
+        }
+    }
+
+    vec_free(qv);
+    vec_free(kv);
+    vec_free(vv);
+    vec_free(ov);
+    parallel_shutdown();
+    mem_set_allocator(&inner);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/checkpoint.h"
+#include "../src/json.h"
+#include <stdlib.h>
+
+/* how long a training loop is held up by saving a checkpoint: json_dump
+ * on the calling thread against checkpoint_save, which only snapshots.
+ *
+ *   bin/bench_checkpoint [floats] [layers] [path]
+ *
+ * the document is `layers` Vecs of `floats` / layers each. the saves are
+ * made back to back, so from the third on checkpoint_save also waits for
+ * the writer: stall_ms is what the caller saw per save, on average, and
+ * first_stall_ms the first save, which is only the snapshot */
+
+#define DEFAULT_FLOATS (4 * 1024 * 1024)
+#define DEFAULT_LAYERS 32
+#define DEFAULT_PATH   "/tmp/bench_checkpoint.json"
+#define SAVES          5
+
+static void report(const char* name, size_t floats, size_t layers,
+                   double first_ns, double stall_ns, double total_ns) {
+    printf("{\"bench\": \"checkpoint\", \"case\": \"%s\", \"floats\": %zu, "
+           "\"layers\": %zu, \"saves\": %d, \"first_stall_ms\": %.3f, "
+           "\"stall_ms\": %.3f, \"total_ms\": %.3f}\n",
+           name, floats, layers, SAVES, first_ns / 1e6, stall_ns / 1e6,
+           total_ns / 1e6);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    size_t floats = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_FLOATS;
+    size_t layers = (argc > 2) ? strtoull(argv[2], NULL, 10) : DEFAULT_LAYERS;
+    const char* path = (argc > 3) ? argv[3] : DEFAULT_PATH;
+    if (layers == 0) layers = 1;
+
+    JsonObject* doc = json_init();
+    unsigned state = 42;
+    for (size_t l = 0; l < layers; l++) {
+        Vec* w = vec_init(floats / layers);
+        if (w == NULL || w->data == NULL) {
+            fprintf(stderr, "bench_checkpoint: malloc failed\n");
+            return 1;
+        }
+        for (size_t i = 0; i < w->dim; i++) {
+            state = state * 1664525u + 1013904223u;
+            w->data[i] = (float)(state >> 8) / (float)(1u << 24) - 0.5f;
+        }
+        char key[32];
+        snprintf(key, sizeof(key), "layer_%zu", l);
+        json_set_vec(doc, key, w);
+    }
+
+    // synchronous: the caller serializes and writes every time
+    uint64_t start = bench_now_ns();
+    double first = 0;
+    for (int s = 0; s < SAVES; s++) {
+        json_set_num(doc, "step", s);
+        if (!json_dump(doc, path)) return 1;
+        if (s == 0) first = (double)(bench_now_ns() - start);
+    }
+    double total = (double)(bench_now_ns() - start);
+    report("json_dump", floats, layers, first, total / SAVES, total);
+
+    // asynchronous: the caller only snapshots, the writer does the rest
+    Checkpointer* c = checkpoint_init();
+    if (c == NULL) return 1;
+    CheckpointJob* jobs[SAVES];
+    CheckpointStats stats;
+    start = bench_now_ns();
+    for (int s = 0; s < SAVES; s++) {
+        json_set_num(doc, "step", s);
+        jobs[s] = checkpoint_save(c, doc, path);
+        if (s == 0) {
+            checkpoint_stats(c, &stats);
+            first = (double)stats.last_stall_ns;
+        }
+    }
+    for (int s = 0; s < SAVES; s++)
+        if (!checkpoint_wait(jobs[s])) return 1;
+    total = (double)(bench_now_ns() - start);
+    checkpoint_stats(c, &stats);
+    report("checkpoint_save", floats, layers, first,
+           (double)stats.stall_ns / SAVES, total);
+    checkpoint_free(c);
+
+    remove(path);
+    json_free(doc);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/expr.h"
+#include "../src/tensor.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* fused expression evaluation against one pass per op, for chains of 3 to
+ * 6 ops over vectors from cache-sized to memory-sized.
+ *
+ *   bin/bench_expr [max_mb]
+ *
+ * chain k is the first k ops of
+ *   t = a * x; t = t + b; t = relu(t); t = t * 1.5; t = min(t, 6); t = t - a
+ * bytes_per_elem counts the loads and stores each evaluation needs: the
+ * inputs and the output once when fused, every op's operands and result
+ * (and the broadcast constants, filled out to full vectors) when not */
+
+#define DEFAULT_MAX_MB  256
+#define MIN_ELEMS       (1u << 14)
+#define MEASURE_NS      100000000   // repeat for ~0.1s, keep the best run
+
+// per op of the chain: loads + stores per element in the unfused pass
+static const double unfused_bytes[] = { 12, 12, 8, 16, 16, 12 };
+#define MAX_CHAIN (sizeof(unfused_bytes) / sizeof(unfused_bytes[0]))
+
+static Expr* build_chain(ExprGraph* g, size_t ops, const Vec* a,
+                         const Vec* x, const Vec* b, size_t* n_inputs) {
+    Expr* ea = expr_input(g, a);
+    Expr* t = expr_mul(g, ea, expr_input(g, x));
+    *n_inputs = 2;
+    if (ops > 1) {
+        t = expr_add(g, t, expr_input(g, b));
+        *n_inputs = 3;
+    }
+    if (ops > 2) t = expr_relu(g, t);
+    if (ops > 3) t = expr_mul(g, t, expr_const(g, 1.5f));
+    if (ops > 4) t = expr_min(g, t, expr_const(g, 6.0f));
+    if (ops > 5) t = expr_sub(g, t, ea);
+    return t;
+}
+
+static uint64_t time_eval(bool fused, const Expr* e, Vec* out) {
+    uint64_t best = UINT64_MAX;
+    uint64_t total = 0;
+    do {
+        uint64_t start = bench_now_ns();
+        bool ok = fused ? expr_eval(e, out) : expr_eval_unfused(e, out);
+        uint64_t ns = bench_now_ns() - start;
+        if (!ok) {
+            fprintf(stderr, "expr eval failed\n");
+            exit(1);
+        }
+        if (ns < best) best = ns;
+        total += ns;
+    } while (total < MEASURE_NS);
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t max_mb = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_MAX_MB;
+    // four vectors: a, x, b and out
+    size_t max_elems = (max_mb << 20) / (4 * sizeof(float));
+    if (max_elems < MIN_ELEMS) max_elems = MIN_ELEMS;
+
+    Vec* a = vec_init(max_elems);
+    Vec* x = vec_init(max_elems);
+    Vec* b = vec_init(max_elems);
+    Vec* out = vec_init(max_elems);
+    for (size_t i = 0; i < max_elems; i++) {
+        a->data[i] = (float)(i % 17) * 0.1f - 0.8f;
+        x->data[i] = (float)(i % 5) - 2.0f;
+        b->data[i] = (float)(i % 3) * 0.5f;
+    }
+
+    for (size_t n = MIN_ELEMS; n <= max_elems; n *= 8) {
+        a->dim = x->dim = b->dim = out->dim = n;
+        for (size_t ops = 3; ops <= MAX_CHAIN; ops++) {
+            ExprGraph* g = expr_graph_new();
+            size_t n_inputs;
+            Expr* e = build_chain(g, ops, a, x, b, &n_inputs);
+            double fused_bytes = (double)(n_inputs + 1) * sizeof(float);
+            double pass_bytes = 0;
+            for (size_t k = 0; k < ops; k++) pass_bytes += unfused_bytes[k];
+
+            uint64_t fused_ns = time_eval(true, e, out);
+            uint64_t unfused_ns = time_eval(false, e, out);
+            printf("{\"bench\": \"expr\", \"ops\": %zu, \"elems\": %zu, "
+                   "\"fused_ns\": %llu, \"unfused_ns\": %llu, "
+                   "\"speedup\": %.2f, \"fused_bytes_per_elem\": %.0f, "
+                   "\"unfused_bytes_per_elem\": %.0f, "
+                   "\"fused_gbps\": %.1f, \"unfused_gbps\": %.1f}\n",
+                   ops, n, (unsigned long long)fused_ns,
+                   (unsigned long long)unfused_ns,
+                   (double)unfused_ns / (double)fused_ns,
+                   fused_bytes, pass_bytes,
+                   fused_bytes * (double)n / (double)fused_ns,
+                   pass_bytes * (double)n / (double)unfused_ns);
+            expr_graph_free(g);
+        }
+    }
+
+    a->dim = x->dim = b->dim = out->dim = max_elems;
+    vec_free(a);
+    vec_free(x);
+    vec_free(b);
+    vec_free(out);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/json.h"
+#include "../src/tensor.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* re-serializing a checkpoint-like document after a small change:
+ * full json_dumps vs json_dumps_cached reusing clean subtrees */
+
+static JsonObject* make_checkpoint(size_t n_layers, size_t dim) {
+    JsonObject* j = json_init();
+    JsonObject* layers = json_init();
+    char name[32];
+    for (size_t l = 0; l < n_layers; l++) {
+        Vec* w = vec_init(dim);
+        for (size_t i = 0; i < dim; i++)
+            w->data[i] = (float)((l * 7919 + i * 104729) % 10007) / 10007.0f;
+        JsonObject* layer = json_init();
+        json_set_vec(layer, "w", w);
+        snprintf(name, sizeof(name), "layer_%zu", l);
+        json_set_obj(layers, name, layer);
+    }
+    json_set_str(j, "step", "0");
+    json_set_obj(j, "layers", layers);
+    return j;
+}
+
+int main(int argc, char** argv) {
+    size_t iters = (argc > 1) ? strtoull(argv[1], NULL, 10) : 20;
+    JsonObject* j = make_checkpoint(64, 4096);
+    char step[32];
+
+    char* out = json_dumps(j);
+    size_t bytes = strlen(out);
+    free(out);
+
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < iters; i++) {
+        snprintf(step, sizeof(step), "%zu", i);
+        json_set_str(j, "step", step);
+        free(json_dumps(j));
+    }
+    bench_report("incremental", "json_dumps", iters,
+                 bench_now_ns() - start, bytes);
+
+    free(json_dumps_cached(j));     // warm the caches
+    start = bench_now_ns();
+    for (size_t i = 0; i < iters; i++) {
+        snprintf(step, sizeof(step), "%zu", i);
+        json_set_str(j, "step", step);
+        free(json_dumps_cached(j));
+    }
+    bench_report("incremental", "json_dumps_cached", iters,
+                 bench_now_ns() - start, bytes);
+
+    json_free(j);
+    return 0;
+}
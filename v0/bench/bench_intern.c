@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/json.h"
+#include "../src/json_intern.h"
+#include "../src/string_ext.h"
+#include <malloc.h>     // mallinfo2
+#include <string.h>
+#include <stdlib.h>
+
+/* heap use of an array-of-records document with owned vs interned keys */
+
+static const char* keys[] = {
+    "user_id", "session_key", "timestamp_ms",
+    "event_type", "score_value", "is_active",
+};
+#define N_KEYS (sizeof(keys) / sizeof(keys[0]))
+
+static char* make_records(size_t n) {
+    String* s = string_from("{\"records\": [");
+    char buf[256];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf),
+                 "%s{\"%s\": %zu, \"%s\": \"s%zx\", \"%s\": %zu, "
+                 "\"%s\": \"click\", \"%s\": 0.%zu, \"%s\": true}",
+                 i ? ", " : "", keys[0], i, keys[1], i * 2654435761u,
+                 keys[2], 1700000000000 + i, keys[3], keys[4], i % 1000,
+                 keys[5]);
+        string_append(s, buf);
+    }
+    string_append(s, "]}");
+    char* out = string_to_chars(s);
+    string_free(s);
+    return out;
+}
+
+static size_t heap_in_use(void) {
+    return mallinfo2().uordblks;
+}
+
+static void run(const char* name, const char* doc, size_t n, bool intern) {
+    size_t heap_before = heap_in_use();
+    uint64_t start = bench_now_ns();
+    JsonObject* j = intern ? json_init_interned(NULL) : json_init();
+    if (json_parse(j, doc) != 0) {
+        fprintf(stderr, "bench_intern: json_parse failed\n");
+        exit(1);
+    }
+    uint64_t parse_ns = bench_now_ns() - start;
+    size_t heap = heap_in_use() - heap_before;
+
+    size_t key_bytes = 0;
+    if (intern) {
+        key_bytes = json_interner_bytes(j->keys);
+    } else {
+        for (size_t k = 0; k < N_KEYS; k++)
+            key_bytes += n * (strlen(keys[k]) + 1);
+    }
+
+    json_free(j);
+    printf("{\"bench\": \"intern\", \"case\": \"%s\", \"records\": %zu, "
+           "\"parse_ns\": %llu, \"heap_bytes\": %zu, \"key_bytes\": %zu, "
+           "\"bytes_per_record\": %.1f}\n",
+           name, n, (unsigned long long)parse_ns, heap, key_bytes,
+           (double)heap / (double)n);
+}
+
+int main(int argc, char** argv) {
+    size_t n = (argc > 1) ? strtoull(argv[1], NULL, 10) : 200000;
+    char* doc = make_records(n);
+    run("owned_keys", doc, n, false);
+    run("interned_keys", doc, n, true);
+    free(doc);
+    return 0;
+}
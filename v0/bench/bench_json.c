@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime, fork
+#include "bench.h"
+#include "corpus.h"
+#include "../src/json.h"
+#include "../src/trace.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>     // fork, _exit
+#include <sys/wait.h>   // waitpid
+
+/* parse / dump / free throughput over the generated corpora.
+ *
+ *   bin/bench_json [scale] [reps] [corpus]
+ *
+ * prints one json line per corpus and phase; times are the best of `reps`
+ * runs, allocation counts are per run. each corpus runs in its own process
+ * so that peak_rss_kb is not inflated by the corpora before it. built with
+ * `make TRACE=1`, it also prints the per-stage counters summed over reps */
+
+enum { PHASE_PARSE, PHASE_DUMP, PHASE_FREE, N_PHASES };
+static const char* phase_names[N_PHASES] = { "parse", "dump", "free" };
+
+typedef struct {
+    uint64_t ns;
+    size_t allocs;
+    size_t bytes;
+} PhaseResult;
+
+static void run_once(const Corpus* corpus, PhaseResult* results) {
+    uint64_t t[N_PHASES + 1];
+    size_t a[N_PHASES + 1];
+
+    t[0] = bench_now_ns();
+    a[0] = bench_alloc_count();
+    JsonObject* j = json_init();
+    if (json_parse(j, corpus->data) != 0) {
+        fprintf(stderr, "bench_json: json_parse failed\n");
+        exit(1);
+    }
+    t[1] = bench_now_ns();
+    a[1] = bench_alloc_count();
+    char* out = json_dumps(j);
+    t[2] = bench_now_ns();
+    a[2] = bench_alloc_count();
+    size_t out_len = strlen(out);
+    free(out);
+    uint64_t free_start = bench_now_ns();
+    json_free(j);
+    t[3] = bench_now_ns() - free_start + t[2];
+    a[3] = bench_alloc_count();
+
+    size_t bytes[N_PHASES] = { corpus->len, out_len, corpus->len };
+    for (int p = 0; p < N_PHASES; p++) {
+        uint64_t ns = t[p + 1] - t[p];
+        if (results[p].ns == 0 || ns < results[p].ns) results[p].ns = ns;
+        results[p].allocs = a[p + 1] - a[p];
+        results[p].bytes = bytes[p];
+    }
+}
+
+static void run_corpus(CorpusKind kind, double scale, int reps) {
+    Corpus corpus = corpus_generate(kind, scale, 42);
+    PhaseResult results[N_PHASES] = {{0}};
+    trace_reset();
+    for (int r = 0; r < reps; r++) run_once(&corpus, results);
+
+    for (int p = 0; p < N_PHASES; p++) {
+        double secs = (double)results[p].ns / 1e9;
+        printf("{\"bench\": \"json\", \"corpus\": \"%s\", \"phase\": \"%s\", "
+               "\"bytes\": %zu, \"nodes\": %zu, \"ns\": %llu, "
+               "\"mb_per_s\": %.1f, \"ns_per_node\": %.2f, "
+               "\"allocs\": %zu, \"peak_rss_kb\": %zu}\n",
+               corpus_name(kind), phase_names[p], results[p].bytes,
+               corpus.nodes, (unsigned long long)results[p].ns,
+               (double)results[p].bytes / 1e6 / secs,
+               (double)results[p].ns / (double)corpus.nodes,
+               results[p].allocs, bench_peak_rss_kb());
+    }
+#ifdef JSON_TRACE
+    TraceStats stats[TRACE_STAGE_COUNT];
+    trace_read(stats);
+    for (TraceStage s = 0; s < TRACE_STAGE_COUNT; s++) {
+        if (stats[s].calls == 0) continue;
+        printf("{\"bench\": \"json_trace\", \"corpus\": \"%s\", "
+               "\"stage\": \"%s\", \"calls\": %llu, \"cycles\": %llu, "
+               "\"cycles_per_call\": %.1f, \"bytes\": %llu, "
+               "\"items\": %llu}\n",
+               corpus_name(kind), trace_stage_name(s),
+               (unsigned long long)stats[s].calls,
+               (unsigned long long)stats[s].cycles,
+               (double)stats[s].cycles / (double)stats[s].calls,
+               (unsigned long long)stats[s].bytes,
+               (unsigned long long)stats[s].items);
+    }
+#endif
+    corpus_free(&corpus);
+}
+
+int main(int argc, char** argv) {
+    double scale = (argc > 1) ? strtod(argv[1], NULL) : 1.0;
+    int reps = (argc > 2) ? atoi(argv[2]) : 3;
+    const char* only = (argc > 3) ? argv[3] : NULL;
+
+    for (CorpusKind kind = 0; kind < CORPUS_COUNT; kind++) {
+        if (only != NULL && strcmp(only, corpus_name(kind)) != 0) continue;
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_corpus(kind, scale, reps);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0
+                || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "bench_json: %s failed\n", corpus_name(kind));
+            return 1;
+        }
+    }
+    return 0;
+}
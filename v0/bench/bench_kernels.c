@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/tensor.h"
+#include "../src/reduce.h"
+#include "../src/parallel.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* vec and row kernels against a measured roofline.
+ *
+ *   bin/bench_kernels [max_mb] [kernel]
+ *
+ * for every thread count (1, 2, 4, .. up to the cpu count) two probes
+ * measure the machine first: streaming loops at each working-set size give
+ * the bandwidth roof of that level of the hierarchy, and a register-only
+ * fma loop gives the compute roof. each kernel is then run over the same
+ * sizes and reported as a fraction of min(peak_gflops, ai * gbps), where
+ * ai is its arithmetic intensity in flops per byte moved.
+ *
+ * bytes moved count every load and store once (no write-allocate), the
+ * same for the probes and the kernels, so the fractions are comparable */
+
+#define MIN_WS_BYTES    (16u << 10)
+#define DEFAULT_MAX_MB  256
+#define BATCH_NS        100000      // time calls in batches of ~0.1ms
+#define MEASURE_NS      20000000    // and keep the best batch of ~20ms
+
+typedef struct {
+    Vec* a;
+    Vec* b;
+    Vec* c;
+    float dot;
+    Vec* gamma;     // ROW_COLS, for the norms
+    Vec* beta;
+    Vec* row_a;     // one value per row, for the reductions
+    Vec* row_b;
+} Operands;
+
+/* the row kernels view `a` (and `c`, for outputs) as rows of ROW_COLS */
+#define ROW_COLS 1024
+
+typedef void (*KernelFn)(Operands* ops);
+
+typedef struct {
+    const char* name;
+    KernelFn fn;
+    size_t arrays;      // vecs touched, sets n for a given working set
+    double bytes;       // per element, loads + stores
+    double flops;       // per element
+} Kernel;
+
+static void run_add(Operands* ops)   { vec_add(ops->a, ops->b, ops->c); }
+static void run_mul(Operands* ops)   { vec_mul(ops->a, ops->b, ops->c); }
+static void run_scale(Operands* ops) { vec_scale(ops->a, 1.0001f, ops->c); }
+static void run_axpy(Operands* ops)  { vec_axpy(1e-6f, ops->a, ops->b); }
+static void run_dot(Operands* ops)   { vec_dot(ops->a, ops->b, &ops->dot); }
+
+static Mat row_view(Vec* v, Vec* rows_out) {
+    size_t rows = v->dim / ROW_COLS;
+    if (rows_out != NULL) rows_out->dim = rows;
+    return (Mat){ v->data, rows, ROW_COLS, ROW_COLS };
+}
+
+static void run_row_sum(Operands* ops) {
+    Mat x = row_view(ops->a, ops->row_a);
+    mat_row_sum(&x, ops->row_a);
+}
+
+static void run_row_max(Operands* ops) {
+    Mat x = row_view(ops->a, ops->row_a);
+    mat_row_max(&x, ops->row_a);
+}
+
+static void run_mean_var(Operands* ops) {
+    Mat x = row_view(ops->a, ops->row_a);
+    ops->row_b->dim = ops->row_a->dim;
+    mat_row_mean_var(&x, ops->row_a, ops->row_b);
+}
+
+static void run_softmax(Operands* ops) {
+    Mat x = row_view(ops->a, NULL);
+    Mat out = row_view(ops->c, NULL);
+    mat_softmax(&x, &out);
+}
+
+static void run_log_softmax(Operands* ops) {
+    Mat x = row_view(ops->a, NULL);
+    Mat out = row_view(ops->c, NULL);
+    mat_log_softmax(&x, &out);
+}
+
+static void run_layernorm(Operands* ops) {
+    Mat x = row_view(ops->a, NULL);
+    Mat out = row_view(ops->c, NULL);
+    mat_layernorm(&x, ops->gamma, ops->beta, 1e-5f, &out);
+}
+
+static void run_rmsnorm(Operands* ops) {
+    Mat x = row_view(ops->a, NULL);
+    Mat out = row_view(ops->c, NULL);
+    mat_rmsnorm(&x, ops->gamma, 1e-6f, &out);
+}
+
+static const Kernel kernels[] = {
+    { "vec_add",   run_add,   3, 12, 1 },
+    { "vec_mul",   run_mul,   3, 12, 1 },
+    { "vec_scale", run_scale, 2,  8, 1 },
+    { "vec_axpy",  run_axpy,  2, 12, 2 },
+    { "vec_dot",   run_dot,   2,  8, 2 },
+    // row kernels: the normalizations read x twice and write once; an exp
+    // is counted as 10 flops (the polynomial and the range reduction)
+    { "row_sum",     run_row_sum,     1,  4,  1 },
+    { "row_max",     run_row_max,     1,  4,  1 },
+    { "mean_var",    run_mean_var,    1,  4,  4 },
+    { "softmax",     run_softmax,     2, 12, 25 },
+    { "log_softmax", run_log_softmax, 2, 12, 14 },
+    { "layernorm",   run_layernorm,   2, 12,  8 },
+    { "rmsnorm",     run_rmsnorm,     2, 12,  5 },
+};
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/* --- probes --- */
+
+/* bandwidth probes: a stream triad (2 loads, 1 store), the same update
+ * done in place, and a read-only sum. the roof at each size is the
+ * fastest of them, since a kernel that doesn't store to a fresh array
+ * can beat a triad that pays for write-allocate */
+typedef struct {
+    float* a;
+    const float* b;
+    const float* c;
+} Stream;
+
+static void triad_range(void* ctx, size_t begin, size_t end) {
+    Stream* t = ctx;
+    for (size_t i = begin; i < end; i++) t->a[i] = t->b[i] + 1.0001f * t->c[i];
+}
+
+static void update_range(void* ctx, size_t begin, size_t end) {
+    Stream* t = ctx;
+    for (size_t i = begin; i < end; i++) t->a[i] = t->a[i] * 0.9999f + t->b[i];
+}
+
+static _Thread_local volatile float read_sink;
+
+static void read_range(void* ctx, size_t begin, size_t end) {
+    Stream* t = ctx;
+    float acc[16] = {0};
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16)
+        for (size_t j = 0; j < 16; j++) acc[j] += t->b[i + j] + t->c[i + j];
+    for (size_t j = 0; j < 16; j++) read_sink += acc[j];
+}
+
+static void run_triad(Operands* ops) {
+    Stream t = { ops->a->data, ops->b->data, ops->c->data };
+    parallel_for(ops->a->dim, 1 << 14, triad_range, &t);
+}
+
+static void run_update(Operands* ops) {
+    Stream t = { ops->a->data, ops->b->data, NULL };
+    parallel_for(ops->a->dim, 1 << 14, update_range, &t);
+}
+
+static void run_read(Operands* ops) {
+    Stream t = { NULL, ops->b->data, ops->c->data };
+    parallel_for(ops->b->dim, 1 << 14, read_range, &t);
+}
+
+static const Kernel probes[] = {
+    { "triad",  run_triad,  3, 12, 2 },
+    { "update", run_update, 2, 12, 2 },
+    { "read",   run_read,   2,  8, 1 },
+};
+#define N_PROBES (sizeof(probes) / sizeof(probes[0]))
+
+#define FMA_ACCS  12    // independent chains, enough to cover fma latency
+#define FMA_ITERS (1 << 16)
+
+/* one avx-512 register of floats. -std=c11 turns off fp contraction, so
+ * the probe asks for it explicitly: the roof is the fused rate */
+#define FMA_LANES 16
+typedef float FmaVec __attribute__((vector_size(FMA_LANES * sizeof(float))));
+
+static volatile float fma_sink;
+
+/* each range is one thread's worth of register-only fmas */
+__attribute__((optimize("fp-contract=fast")))
+static void fma_range(void* ctx, size_t begin, size_t end) {
+    (void)ctx;
+    FmaVec acc[FMA_ACCS];
+    FmaVec mul = {0}, add = {0};
+    mul += 0.999999f;
+    add += 1e-7f;
+    for (size_t k = 0; k < FMA_ACCS; k++) acc[k] = add * (float)k;
+    for (size_t r = begin; r < end; r++)
+        for (size_t it = 0; it < FMA_ITERS; it++)
+            for (size_t k = 0; k < FMA_ACCS; k++)
+                acc[k] = acc[k] * mul + add;
+    float sum = 0;
+    for (size_t k = 0; k < FMA_ACCS; k++)
+        for (size_t j = 0; j < FMA_LANES; j++) sum += acc[k][j];
+    fma_sink = sum;
+}
+
+/* ns per call of fn, best batch over ~MEASURE_NS */
+static double measure(KernelFn fn, Operands* ops) {
+    fn(ops);    // warm caches and the pool
+    size_t reps = 1;
+    for (;;) {
+        uint64_t start = bench_now_ns();
+        for (size_t r = 0; r < reps; r++) fn(ops);
+        if (bench_now_ns() - start >= BATCH_NS || reps >= (1u << 20)) break;
+        reps *= 2;
+    }
+
+    double best = 0;
+    uint64_t spent = 0;
+    while (spent < MEASURE_NS) {
+        uint64_t start = bench_now_ns();
+        for (size_t r = 0; r < reps; r++) fn(ops);
+        uint64_t batch = bench_now_ns() - start;
+        double per_call = (double)batch / (double)reps;
+        if (best == 0 || per_call < best) best = per_call;
+        spent += batch;
+    }
+    return best;
+}
+
+static double probe_peak_gflops(size_t threads) {
+    double best = 0;
+    for (int r = 0; r < 5; r++) {
+        uint64_t start = bench_now_ns();
+        parallel_for(threads, 1, fma_range, NULL);
+        uint64_t ns = bench_now_ns() - start;
+        double flops = 2.0 * FMA_ITERS * FMA_ACCS * FMA_LANES * threads;
+        if (flops / (double)ns > best) best = flops / (double)ns;
+    }
+    printf("{\"bench\": \"kernels\", \"probe\": \"fma\", \"threads\": %zu, "
+           "\"gflops\": %.2f}\n", threads, best);
+    return best;
+}
+
+/* --- sweep --- */
+
+static void set_dims(Operands* ops, size_t n) {
+    ops->a->dim = n;
+    ops->b->dim = n;
+    ops->c->dim = n;
+}
+
+/* ns per call of `k` at working-set size `ws`; sets *n to its length */
+static double time_kernel(const Kernel* k, Operands* ops, size_t ws,
+                          size_t* n) {
+    *n = ws / (k->arrays * sizeof(float));
+    set_dims(ops, *n);
+    return measure(k->fn, ops);
+}
+
+/* returns the achieved gb/s */
+static double run_probe(const Kernel* k, Operands* ops, size_t ws,
+                        size_t threads) {
+    size_t n;
+    double ns = time_kernel(k, ops, ws, &n);
+    double gbps = k->bytes * (double)n / ns;
+    printf("{\"bench\": \"kernels\", \"probe\": \"%s\", \"threads\": %zu, "
+           "\"ws_bytes\": %zu, \"n\": %zu, \"ns_per_op\": %.1f, "
+           "\"gbps\": %.2f}\n", k->name, threads, ws, n, ns, gbps);
+    return gbps;
+}
+
+static void run_kernel(const Kernel* k, Operands* ops, size_t ws,
+                       size_t threads, double peak_gflops, double peak_gbps) {
+    size_t n;
+    double ns = time_kernel(k, ops, ws, &n);
+    double gflops = k->flops * (double)n / ns;
+    double ai = k->flops / k->bytes;
+    double mem_roof = ai * peak_gbps;
+    double roof = (mem_roof < peak_gflops) ? mem_roof : peak_gflops;
+
+    printf("{\"bench\": \"kernels\", \"kernel\": \"%s\", \"threads\": %zu, "
+           "\"ws_bytes\": %zu, \"n\": %zu, \"ns_per_op\": %.1f, "
+           "\"gflops\": %.3f, \"gbps\": %.2f, \"ai\": %.3f, "
+           "\"roof_gflops\": %.3f, \"roof_fraction\": %.3f, "
+           "\"bound\": \"%s\"}\n",
+           k->name, threads, ws, n, ns, gflops, k->bytes * (double)n / ns,
+           ai, roof, gflops / roof,
+           (mem_roof < peak_gflops) ? "memory" : "compute");
+}
+
+static Vec* alloc_operand(size_t max_n) {
+    Vec* v = vec_init(max_n);
+    if (v == NULL || v->data == NULL) {
+        fprintf(stderr, "bench_kernels: malloc failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < max_n; i++) v->data[i] = (float)(i % 1024) / 1024.0f;
+    return v;
+}
+
+int main(int argc, char** argv) {
+    size_t max_mb = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_MAX_MB;
+    const char* only = (argc > 2) ? argv[2] : NULL;
+    size_t max_ws = max_mb << 20;
+    if (max_ws < MIN_WS_BYTES) max_ws = MIN_WS_BYTES;
+
+    // sized for the smallest `arrays`, every kernel fits
+    size_t min_arrays = probes[0].arrays;
+    for (size_t i = 0; i < N_KERNELS; i++)
+        if (kernels[i].arrays < min_arrays) min_arrays = kernels[i].arrays;
+    size_t max_n = max_ws / (min_arrays * sizeof(float));
+    Operands ops = { alloc_operand(max_n), alloc_operand(max_n),
+                     alloc_operand(max_n), 0,
+                     alloc_operand(ROW_COLS), alloc_operand(ROW_COLS),
+                     alloc_operand(max_n / ROW_COLS + 1),
+                     alloc_operand(max_n / ROW_COLS + 1) };
+
+    size_t n_cpus = parallel_threads();
+    for (size_t threads = 1;; threads *= 2) {
+        if (threads > n_cpus) threads = n_cpus;
+        parallel_set_threads(threads);
+        double peak_gflops = probe_peak_gflops(threads);
+
+        for (size_t ws = MIN_WS_BYTES; ws <= max_ws; ws *= 4) {
+            double peak_gbps = 0;
+            for (size_t i = 0; i < N_PROBES; i++) {
+                double gbps = run_probe(probes + i, &ops, ws, threads);
+                if (gbps > peak_gbps) peak_gbps = gbps;
+            }
+            for (size_t i = 0; i < N_KERNELS; i++) {
+                if (only != NULL && strcmp(only, kernels[i].name) != 0)
+                    continue;
+                run_kernel(kernels + i, &ops, ws, threads,
+                           peak_gflops, peak_gbps);
+            }
+        }
+        if (threads == n_cpus) break;
+    }
+
+    set_dims(&ops, max_n);
+    vec_free(ops.a);
+    vec_free(ops.b);
+    vec_free(ops.c);
+    vec_free(ops.gamma);
+    vec_free(ops.beta);
+    vec_free(ops.row_a);
+    vec_free(ops.row_b);
+    parallel_shutdown();
+    return 0;
+}
@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/prng.h"
+#include "../src/parallel.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* philox fills against the scalar rand() loops they replace.
+ *
+ *   bin/bench_prng [n] [fill]
+ *
+ * each fill writes n floats, at every thread count (1, 2, 4, .. up to the
+ * cpu count); the rand() baselines only run on one thread, since rand()
+ * shares one state. gbps counts the stores only */
+
+#define DEFAULT_N  (16 * 1024 * 1024)
+#define MEASURE_NS 200000000    // repeat for ~0.2s, keep the best run
+
+typedef void (*FillFn)(Prng* rng, Vec* out);
+
+static void fill_uniform(Prng* rng, Vec* out) {
+    prng_uniform(rng, out, -1, 1);
+}
+
+static void fill_normal(Prng* rng, Vec* out) {
+    prng_normal(rng, out, 0, 1);
+}
+
+static void fill_truncated(Prng* rng, Vec* out) {
+    prng_truncated_normal(rng, out, 0, 1, -2, 2);
+}
+
+static void rand_uniform(Prng* rng, Vec* out) {
+    (void)rng;
+    for (size_t i = 0; i < out->dim; i++)
+        out->data[i] = 2.0f * (float)rand() / (float)RAND_MAX - 1.0f;
+}
+
+static void rand_normal(Prng* rng, Vec* out) {
+    (void)rng;
+    for (size_t i = 0; i + 1 < out->dim; i += 2) {
+        float u = ((float)rand() + 1.0f) / ((float)RAND_MAX + 1.0f);
+        float v = (float)rand() / ((float)RAND_MAX + 1.0f);
+        float r = sqrtf(-2.0f * logf(u));
+        out->data[i] = r * cosf(6.28318530717958648f * v);
+        out->data[i + 1] = r * sinf(6.28318530717958648f * v);
+    }
+}
+
+typedef struct {
+    const char* name;
+    FillFn fn;
+    bool threaded;
+} Fill;
+
+static const Fill fills[] = {
+    { "uniform",          fill_uniform,   true },
+    { "normal",           fill_normal,    true },
+    { "truncated_normal", fill_truncated, true },
+    { "rand_uniform",     rand_uniform,   false },
+    { "rand_normal",      rand_normal,    false },
+};
+#define N_FILLS (sizeof(fills) / sizeof(fills[0]))
+
+static uint64_t time_fill(const Fill* f, Vec* out) {
+    Prng rng = prng_init(42);
+    uint64_t best = UINT64_MAX, total = 0;
+    do {
+        uint64_t start = bench_now_ns();
+        f->fn(&rng, out);
+        uint64_t ns = bench_now_ns() - start;
+        if (ns < best) best = ns;
+        total += ns;
+    } while (total < MEASURE_NS);
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t n = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_N;
+    const char* only = (argc > 2) ? argv[2] : NULL;
+    Vec* out = vec_init(n);
+    if (out == NULL || out->data == NULL) {
+        fprintf(stderr, "bench_prng: malloc failed\n");
+        return 1;
+    }
+
+    size_t n_cpus = parallel_threads();
+    for (size_t threads = 1;; threads *= 2) {
+        if (threads > n_cpus) threads = n_cpus;
+        parallel_set_threads(threads);
+        for (size_t i = 0; i < N_FILLS; i++) {
+            const Fill* f = fills + i;
+            if (only != NULL && strcmp(only, f->name) != 0) continue;
+            if (!f->threaded && threads > 1) continue;
+            uint64_t ns = time_fill(f, out);
+            printf("{\"bench\": \"prng\", \"fill\": \"%s\", \"threads\": %zu, "
+                   "\"n\": %zu, \"ns_per_float\": %.3f, "
+                   "\"gsamples\": %.3f, \"gbps\": %.2f}\n",
+                   f->name, f->threaded ? threads : 1, n,
+                   (double)ns / (double)n, (double)n / (double)ns,
+                   4.0 * (double)n / (double)ns);
+            fflush(stdout);
+        }
+        if (threads == n_cpus) break;
+    }
+
+    vec_free(out);
+    parallel_shutdown();
+    return 0;
+}
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/json.h"
+#include "../src/json_schema.h"
+#include "../src/string_ext.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* schema-specialized parser vs json_parse + json_get_* on a typical
+ * hot-path message: a dozen keys, mostly scalars, one small embedding */
+
+typedef struct {
+    int64_t id;
+    int64_t ts;
+    char* user;
+    char* session;
+    double lat;
+    double lon;
+    float score;
+    bool active;
+    char* model;
+    int64_t tokens;
+    float temperature;
+    Vec* emb;
+} Msg;
+
+static const JsonField msg_fields[] = {
+    JSON_FIELD(Msg, id, JSON_FIELD_I64),
+    JSON_FIELD(Msg, ts, JSON_FIELD_I64),
+    JSON_FIELD(Msg, user, JSON_FIELD_STR),
+    JSON_FIELD(Msg, session, JSON_FIELD_STR),
+    JSON_FIELD(Msg, lat, JSON_FIELD_F64),
+    JSON_FIELD(Msg, lon, JSON_FIELD_F64),
+    JSON_FIELD(Msg, score, JSON_FIELD_F32),
+    JSON_FIELD(Msg, active, JSON_FIELD_BOOL),
+    JSON_FIELD(Msg, model, JSON_FIELD_STR),
+    JSON_FIELD(Msg, tokens, JSON_FIELD_I64),
+    JSON_FIELD_KEY("temp", Msg, temperature, JSON_FIELD_F32),
+    JSON_FIELD(Msg, emb, JSON_FIELD_VEC),
+};
+
+static const char* msg_json =
+    "{\"id\": 918273645, \"ts\": 1718031234567, \"user\": \"alice\", "
+    "\"session\": \"af9c3e0d-5b1e-4c47-9d0a-2f6b8c1e7a44\", "
+    "\"lat\": 37.7749, \"lon\": 122.4194, \"score\": 0.9321, "
+    "\"active\": true, \"model\": \"ranker-v3\", \"tokens\": 512, "
+    "\"temp\": 0.7, "
+    "\"emb\": [0.12, 0.5, 0.33, 0.01, 0.98, 0.44, 0.27, 0.61]}";
+
+static int generic_parse(Msg* m, const char* str) {
+    JsonObject* j = json_init();
+    int res = json_parse(j, str);
+    char* s;
+    if (json_get_str(j, "id", &s))      m->id = strtoll(s, NULL, 10);
+    if (json_get_str(j, "ts", &s))      m->ts = strtoll(s, NULL, 10);
+    if (json_get_str(j, "user", &s))    m->user = strdup_local(s);
+    if (json_get_str(j, "session", &s)) m->session = strdup_local(s);
+    if (json_get_str(j, "lat", &s))     m->lat = strtod(s, NULL);
+    if (json_get_str(j, "lon", &s))     m->lon = strtod(s, NULL);
+    if (json_get_str(j, "score", &s))   m->score = strtof(s, NULL);
+    if (json_get_str(j, "active", &s))  m->active = !strcmp(s, "true");
+    if (json_get_str(j, "model", &s))   m->model = strdup_local(s);
+    if (json_get_str(j, "tokens", &s))  m->tokens = strtoll(s, NULL, 10);
+    if (json_get_str(j, "temp", &s))    m->temperature = strtof(s, NULL);
+    Vec* v;
+    if (json_get_vec(j, "emb", &v))     m->emb = vec_from_copy(v->data, v->dim);
+    json_free(j);
+    return res;
+}
+
+static void check(const Msg* m) {
+    if (m->id != 918273645 || m->ts != 1718031234567 || !m->active
+            || strcmp(m->session, "af9c3e0d-5b1e-4c47-9d0a-2f6b8c1e7a44")
+            || m->tokens != 512 || m->emb == NULL || m->emb->dim != 8) {
+        fprintf(stderr, "bench_schema: decoded message mismatch\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t iters = (argc > 1) ? strtoull(argv[1], NULL, 10) : 200000;
+    size_t bytes = strlen(msg_json);
+    size_t n_fields = sizeof(msg_fields) / sizeof(msg_fields[0]);
+
+    JsonSchema schema;
+    if (json_schema_init(&schema, msg_fields, n_fields) != 0) {
+        fprintf(stderr, "bench_schema: json_schema_init failed\n");
+        return 1;
+    }
+
+    Msg m = {0};
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < iters; i++) {
+        generic_parse(&m, msg_json);
+        if (i == 0) check(&m);
+        json_schema_release(&schema, &m);
+    }
+    bench_report("schema", "json_parse+json_get", iters,
+                 bench_now_ns() - start, bytes);
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < iters; i++) {
+        json_schema_parse(&schema, &m, msg_json);
+        if (i == 0) check(&m);
+        json_schema_release(&schema, &m);
+    }
+    bench_report("schema", "json_schema_parse", iters,
+                 bench_now_ns() - start, bytes);
+
+    json_schema_free(&schema);
+    return 0;
+}
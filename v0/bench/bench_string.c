@@ -0,0 +1,114 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime, open
+#include "bench.h"
+#include "../src/string_ext.h"
+#include "../src/mem.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>      // open
+#include <unistd.h>     // close
+
+/* building serialized output: a String grown by doubling and copied out by
+ * string_to_chars, the same handed over by string_take, and a chunked
+ * StringBuilder flattened once or written with writev. also front-to-back
+ * building with string_prepend vs the builder.
+ *
+ *   bin/bench_string [pieces]
+ *
+ * allocs counts malloc / realloc calls per build */
+
+/* formatted up front, so the timings are of the string code only */
+#define N_PIECES 1024
+static char pieces_buf[N_PIECES][48];
+static size_t pieces_len[N_PIECES];
+
+static void make_pieces(void) {
+    for (size_t i = 0; i < N_PIECES; i++)
+        pieces_len[i] = (size_t)snprintf(pieces_buf[i], sizeof(pieces_buf[i]),
+                                         "{\"id\": %zu, \"v\": %.6g}, ",
+                                         i, (double)i * 0.001);
+}
+
+#define PIECE(i) pieces_buf[(i) % N_PIECES], pieces_len[(i) % N_PIECES]
+
+static void report(const char* name, size_t pieces, uint64_t ns,
+                   size_t allocs, size_t bytes) {
+    printf("{\"bench\": \"string\", \"case\": \"%s\", \"pieces\": %zu, "
+           "\"ns\": %llu, \"ns_per_piece\": %.2f, \"mb_per_s\": %.1f, "
+           "\"allocs\": %zu}\n", name, pieces, (unsigned long long)ns,
+           (double)ns / (double)pieces,
+           (double)bytes / 1e6 / ((double)ns / 1e9), allocs);
+}
+
+static void bench_append(size_t pieces) {
+    size_t bytes = 0;
+
+    for (int variant = 0; variant < 2; variant++) {
+        size_t a = bench_alloc_count();
+        uint64_t start = bench_now_ns();
+        String* s = string_new(0);
+        for (size_t i = 0; i < pieces; i++)
+            string_append_n(s, PIECE(i));
+        bytes = s->length;
+        char* out = variant ? string_take(s, NULL) : string_to_chars(s);
+        string_free(s);
+        uint64_t ns = bench_now_ns() - start;
+        report(variant ? "string_take" : "string_to_chars", pieces, ns,
+               bench_alloc_count() - a, bytes);
+        mem_free(out);
+    }
+
+    size_t a = bench_alloc_count();
+    uint64_t start = bench_now_ns();
+    StringBuilder b;
+    string_builder_init(&b);
+    for (size_t i = 0; i < pieces; i++)
+        string_builder_append(&b, PIECE(i));
+    char* out = string_builder_flatten(&b, NULL);
+    string_builder_free(&b);
+    report("builder_flatten", pieces, bench_now_ns() - start,
+           bench_alloc_count() - a, bytes);
+    mem_free(out);
+
+    int fd = open("/dev/null", O_WRONLY);
+    a = bench_alloc_count();
+    start = bench_now_ns();
+    string_builder_init(&b);
+    for (size_t i = 0; i < pieces; i++)
+        string_builder_append(&b, PIECE(i));
+    if (!string_builder_writev(&b, fd)) fprintf(stderr, "writev failed\n");
+    string_builder_free(&b);
+    report("builder_writev", pieces, bench_now_ns() - start,
+           bench_alloc_count() - a, bytes);
+    close(fd);
+}
+
+static void bench_prepend(size_t pieces) {
+    size_t a = bench_alloc_count();
+    uint64_t start = bench_now_ns();
+    String* s = string_new(0);
+    for (size_t i = 0; i < pieces; i++)
+        string_prepend_n(s, PIECE(i));
+    size_t bytes = s->length;
+    string_free(s);
+    report("string_prepend", pieces, bench_now_ns() - start,
+           bench_alloc_count() - a, bytes);
+
+    a = bench_alloc_count();
+    start = bench_now_ns();
+    StringBuilder b;
+    string_builder_init(&b);
+    for (size_t i = 0; i < pieces; i++)
+        string_builder_prepend(&b, PIECE(i));
+    string_builder_free(&b);
+    report("builder_prepend", pieces, bench_now_ns() - start,
+           bench_alloc_count() - a, bytes);
+}
+
+int main(int argc, char** argv) {
+    size_t pieces = (argc > 1) ? strtoull(argv[1], NULL, 10) : 1000000;
+    make_pieces();
+    bench_append(pieces);
+    // string_prepend is quadratic, keep it to a size that finishes
+    bench_prepend(pieces / 20);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L    // clock_gettime
+#include "bench.h"
+#include "../src/vec_index.h"
+#include "../src/parallel.h"
+#include "../src/mem.h"
+#include <stdlib.h>
+
+/* exact and approximate nearest-neighbor search over synthetic embeddings:
+ * points scattered around random cluster centers, so that neighbors mean
+ * something, and queries drawn the same way.
+ *
+ *   bin/bench_vec_index [n] [dim] [queries]
+ *
+ * the flat index gives the true K nearest of every query; each hnsw search
+ * in the sweep of ef is scored against them as recall@K. qps is over one
+ * batch of all the queries on parallel_threads() threads. index_bytes is
+ * what the index holds, read from the accounting allocator. the graph is
+ * built on one thread: at the default 1M vectors that takes minutes */
+
+#define DEFAULT_N       1000000
+#define DEFAULT_DIM     64
+#define DEFAULT_QUERIES 1000
+#define CLUSTERS        1024
+#define SPREAD          0.6f
+#define K               10
+
+static float uniform(unsigned* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(*state >> 8) / (float)(1u << 24) * 2.0f - 1.0f;
+}
+
+/* n points, each a random center plus roughly normal noise */
+static Vec* clustered(size_t n, size_t dim, const Vec* centers,
+                      unsigned* state) {
+    Vec* v = vec_init(n * dim);
+    if (v == NULL || v->data == NULL) {
+        fprintf(stderr, "bench_vec_index: malloc failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        *state = *state * 1664525u + 1013904223u;
+        const float* c = centers->data + (*state >> 8) % CLUSTERS * dim;
+        for (size_t j = 0; j < dim; j++) {
+            float noise = uniform(state) + uniform(state) + uniform(state);
+            v->data[i * dim + j] = c[j] + SPREAD * noise;
+        }
+    }
+    return v;
+}
+
+static size_t index_bytes(void) {
+    MemSnapshot snap;
+    mem_snapshot(&snap);
+    return snap.tags[MEM_INDEX].live_bytes;
+}
+
+static double recall(const VecHit* got, const VecHit* truth, size_t nq) {
+    size_t found = 0;
+    for (size_t i = 0; i < nq; i++)
+        for (size_t a = 0; a < K; a++)
+            for (size_t b = 0; b < K; b++)
+                found += got[i * K + a].id == truth[i * K + b].id;
+    return (double)found / (double)(nq * K);
+}
+
+static void report(const char* name, size_t n, size_t dim, size_t ef,
+                   double secs, size_t nq, double rec, size_t bytes) {
+    printf("{\"bench\": \"vec_index\", \"case\": \"%s\", \"n\": %zu, "
+           "\"dim\": %zu, \"k\": %d, \"ef\": %zu, \"threads\": %zu, "
+           "\"seconds\": %.3f, \"qps\": %.1f, \"recall\": %.4f, "
+           "\"index_bytes\": %zu}\n",
+           name, n, dim, K, ef, parallel_threads(), secs,
+           nq ? (double)nq / secs : 0.0, rec, bytes);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    size_t n = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_N;
+    size_t dim = (argc > 2) ? strtoull(argv[2], NULL, 10) : DEFAULT_DIM;
+    size_t nq = (argc > 3) ? strtoull(argv[3], NULL, 10) : DEFAULT_QUERIES;
+
+    MemAllocator inner = mem_get_allocator();
+    MemAllocator accounting = mem_accounting(&inner);
+    mem_set_allocator(&accounting);
+
+    unsigned state = 42;
+    Vec* centers = vec_init(CLUSTERS * dim);
+    for (size_t i = 0; i < centers->dim; i++)
+        centers->data[i] = uniform(&state);
+    Vec* base = clustered(n, dim, centers, &state);
+    Vec* qv = clustered(nq, dim, centers, &state);
+    Mat rows = mat_view(base, n, dim);
+    Mat queries = mat_view(qv, nq, dim);
+    VecHit* truth = malloc(nq * K * sizeof(VecHit));
+    VecHit* hits = malloc(nq * K * sizeof(VecHit));
+
+    // exact, which is also the ground truth
+    FlatIndex* flat = flat_index_init(dim, VEC_L2);
+    uint64_t start = bench_now_ns();
+    if (!flat_index_add(flat, &rows)) return 1;
+    report("flat_add", n, dim, 0, (double)(bench_now_ns() - start) / 1e9, 0,
+           0, index_bytes());
+    start = bench_now_ns();
+    if (!flat_index_search(flat, &queries, K, truth)) return 1;
+    report("flat", n, dim, 0, (double)(bench_now_ns() - start) / 1e9, nq, 1,
+           index_bytes());
+    flat_index_free(flat);
+
+    HnswIndex* hnsw = hnsw_index_init(dim, VEC_L2, NULL);
+    start = bench_now_ns();
+    if (!hnsw_index_add(hnsw, &rows)) return 1;
+    report("hnsw_build", n, dim, HNSW_DEFAULT_EF_CONSTRUCTION,
+           (double)(bench_now_ns() - start) / 1e9, 0, 0, index_bytes());
+    for (size_t ef = K; ef <= 640; ef *= 2) {
+        start = bench_now_ns();
+        if (!hnsw_index_search(hnsw, &queries, K, ef, hits)) return 1;
+        double secs = (double)(bench_now_ns() - start) / 1e9;
+        report("hnsw", n, dim, ef, secs, nq, recall(hits, truth, nq),
+               index_bytes());
+    }
+    hnsw_index_free(hnsw);
+
+    free(truth);
+    free(hits);
+    vec_free(centers);
+    vec_free(base);
+    vec_free(qv);
+    parallel_shutdown();
+    mem_set_allocator(&inner);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "corpus.h"
+#include "../src/string_ext.h"
+#include <stdio.h>      // snprintf
+#include <string.h>     // strlen
+
+typedef struct {
+    uint64_t state;
+} Rng;
+
+/* xorshift64*, good enough for test data and fully reproducible */
+static uint64_t rng_next(Rng* rng) {
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545F4914F6CDD1Dull;
+}
+
+/* uniform in [-1, 1) */
+static float rng_float(Rng* rng) {
+    return (float)(rng_next(rng) >> 40) / (float)(1 << 23) - 1.0f;
+}
+
+static void append_float(String* s, Rng* rng) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.6g", rng_float(rng));
+    string_append_n(s, buf, (size_t)n);
+}
+
+static void append_floats(String* s, Rng* rng, size_t n) {
+    string_append(s, "[");
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0) string_append(s, ", ");
+        append_float(s, rng);
+    }
+    string_append(s, "]");
+}
+
+static size_t gen_flat_vec(String* s, Rng* rng, double scale) {
+    size_t n = (size_t)(1000000 * scale);
+    string_append(s, "{\"v\": ");
+    append_floats(s, rng, n);
+    string_append(s, "}");
+    return 2 + n;
+}
+
+static size_t gen_matrix(String* s, Rng* rng, double scale) {
+    size_t rows = (size_t)(2048 * scale), cols = 256;
+    string_append(s, "{\"m\": [");
+    for (size_t r = 0; r < rows; r++) {
+        if (r > 0) string_append(s, ", ");
+        append_floats(s, rng, cols);
+    }
+    string_append(s, "]}");
+    return 2 + rows * (1 + cols);
+}
+
+static size_t gen_wide_obj(String* s, Rng* rng, double scale) {
+    size_t n = (size_t)(100000 * scale);
+    char buf[64];
+    string_append(s, "{");
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(buf, sizeof(buf), "%s\"key_%zu\": \"v%llx\"",
+                           i ? ", " : "", i,
+                           (unsigned long long)(rng_next(rng) >> 32));
+        string_append_n(s, buf, (size_t)len);
+    }
+    string_append(s, "}");
+    return 1 + n;
+}
+
+static size_t gen_deep(String* s, Rng* rng, double scale) {
+    (void)rng;
+    size_t depth = (size_t)(100000 * scale);
+    for (size_t i = 0; i < depth; i++) string_append(s, "{\"child\": ");
+    string_append(s, "{\"leaf\": \"x\"}");
+    for (size_t i = 0; i < depth; i++) string_append(s, "}");
+    return depth + 2;
+}
+
+static size_t gen_long_strings(String* s, Rng* rng, double scale) {
+    static const char* escapes[] = { "\\\"", "\\\\", "\\n", "\\t", "\\u00e9" };
+    size_t n = 64, len = (size_t)(256 * 1024 * scale);
+    char buf[32];
+    string_append(s, "{");
+    for (size_t i = 0; i < n; i++) {
+        int k = snprintf(buf, sizeof(buf), "%s\"s%zu\": \"", i ? ", " : "", i);
+        string_append_n(s, buf, (size_t)k);
+        for (size_t written = 0; written < len;) {
+            uint64_t r = rng_next(rng);
+            if (r % 16 == 0) {
+                const char* e = escapes[(r >> 8) % 5];
+                string_append(s, e);
+                written += strlen(e);
+            } else {
+                char c = (char)('a' + (r >> 8) % 26);
+                string_append_n(s, &c, 1);
+                written++;
+            }
+        }
+        string_append(s, "\"");
+    }
+    string_append(s, "}");
+    return 1 + n;
+}
+
+static size_t gen_records(String* s, Rng* rng, double scale) {
+    size_t n = (size_t)(100000 * scale), emb = 8;
+    char buf[160];
+    string_append(s, "{\"records\": [");
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = rng_next(rng);
+        int len = snprintf(buf, sizeof(buf),
+                           "%s{\"id\": %zu, \"name\": \"user_%llx\", "
+                           "\"score\": %.4f, \"tags\": [\"t%u\", \"t%u\"], "
+                           "\"emb\": ",
+                           i ? ", " : "", i, (unsigned long long)(r >> 40),
+                           (double)rng_float(rng),
+                           (unsigned)(r % 7), (unsigned)((r >> 3) % 7));
+        string_append_n(s, buf, (size_t)len);
+        append_floats(s, rng, emb);
+        string_append(s, "}");
+    }
+    string_append(s, "]}");
+    return 2 + n * (1 + 3 + 3 + 1 + emb);
+}
+
+const char* corpus_name(CorpusKind kind) {
+    static const char* names[] = {
+        "flat_vec", "matrix", "wide_obj", "deep", "long_strings", "records",
+    };
+    return (kind < CORPUS_COUNT) ? names[kind] : "unknown";
+}
+
+/* generates a document of the given kind; `scale` multiplies its size */
+Corpus corpus_generate(CorpusKind kind, double scale, uint64_t seed) {
+    Rng rng = { seed * 0x9E3779B97F4A7C15ull + 1 };
+    String* s = string_new(1 << 20);
+    size_t nodes = 0;
+    switch (kind) {
+        case CORPUS_FLAT_VEC:     nodes = gen_flat_vec(s, &rng, scale); break;
+        case CORPUS_MATRIX:       nodes = gen_matrix(s, &rng, scale); break;
+        case CORPUS_WIDE_OBJ:     nodes = gen_wide_obj(s, &rng, scale); break;
+        case CORPUS_DEEP:         nodes = gen_deep(s, &rng, scale); break;
+        case CORPUS_LONG_STRINGS: nodes = gen_long_strings(s, &rng, scale); break;
+        case CORPUS_RECORDS:      nodes = gen_records(s, &rng, scale); break;
+        default: break;
+    }
+    size_t len;
+    char* data = string_take(s, &len);
+    string_free(s);
+    Corpus corpus = { data, len, nodes };
+    return corpus;
+}
+
+void corpus_free(Corpus* corpus) {
+    free(corpus->data);
+    corpus->data = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdlib.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+/* deterministic json documents for the parser / serializer benchmarks.
+ * the same kind, scale and seed always produce the same bytes */
+
+typedef enum {
+    CORPUS_FLAT_VEC,        // one huge flat numeric array
+    CORPUS_MATRIX,          // array of numeric rows
+    CORPUS_WIDE_OBJ,        // 100k keys in one object
+    CORPUS_DEEP,            // 100k levels of nested objects
+    CORPUS_LONG_STRINGS,    // long strings full of escapes
+    CORPUS_RECORDS,         // array of small records
+    CORPUS_COUNT,
+} CorpusKind;
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t nodes;           // json values in the document, incl. numbers
+} Corpus;
+
+const char* corpus_name(CorpusKind kind);
+Corpus corpus_generate(CorpusKind kind, double scale, uint64_t seed);
+void corpus_free(Corpus* corpus);
+
+#endif // CORPUS_H
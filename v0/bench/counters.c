@@ -0,0 +1,48 @@
+#define _XOPEN_SOURCE 700           // getrusage
+#include "bench.h"
+#include "../src/mem.h"
+#include <stdlib.h>
+#include <stdatomic.h>      // atomic_size_t
+#include <sys/resource.h>   // getrusage
+
+/* installs a counting allocator before main, so every allocation made by
+ * the library passes through here. it adds no header, so block sizes (and
+ * heap statistics) are the same as with plain libc */
+
+static atomic_size_t alloc_count;
+
+static void* counting_malloc(void* ctx, size_t size, MemTag tag) {
+    (void)ctx;
+    (void)tag;
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return malloc(size);
+}
+
+static void* counting_realloc(void* ctx, void* ptr, size_t size, MemTag tag) {
+    (void)ctx;
+    (void)tag;
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return realloc(ptr, size);
+}
+
+static void counting_free(void* ctx, void* ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+__attribute__((constructor))
+static void install_counting_allocator(void) {
+    MemAllocator counting = { counting_malloc, counting_realloc,
+                              counting_free, NULL };
+    mem_set_allocator(&counting);
+}
+
+size_t bench_alloc_count(void) {
+    return atomic_load_explicit(&alloc_count, memory_order_relaxed);
+}
+
+size_t bench_peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss;
+}
@@ -0,0 +1,337 @@
+#include "attention.h"
+#include "reduce.h"         // mat_softmax
+#include "parallel.h"       // parallel_for
+#include "mem.h"
+#include "vmath.h"          // vmath_expf
+#include <stdio.h>          // fprintf
+#include <string.h>         // memset
+#include <math.h>           // INFINITY, sqrt
+
+/* independent partial sums, so the dot products vectorize */
+#define ATTN_LANES 16
+
+/* keys scored together, and queries whose outputs are accumulated
+ * together, in registers */
+#define ATTN_KEY_BLOCK   8
+#define ATTN_QUERY_BLOCK 4
+
+/* columns of the output a block of queries accumulates at once */
+#define ATTN_VALUE_COLS 64
+
+/* -std=c11 turns off fp contraction; the two matmul loops ask for fused
+ * multiply-adds back, where the target has them */
+#if defined(__GNUC__) && !defined(__clang__)
+#define ATTN_CONTRACT __attribute__((optimize("fp-contract=fast")))
+#else
+#define ATTN_CONTRACT
+#endif
+
+typedef struct {
+    const Mat* q;
+    const Mat* k;
+    const Mat* v;
+    Mat* out;
+    size_t heads;
+    size_t head_dim;
+    size_t n_tiles;         // query tiles per head
+    float scale;
+    bool causal;
+    long offset;            // seq_k - seq_q, the causal diagonal
+} AttnArgs;
+
+static float attn_dot(const float* a, const float* b, size_t n) {
+    float acc[ATTN_LANES] = {0};
+    size_t i = 0;
+    for (; i + ATTN_LANES <= n; i += ATTN_LANES)
+        for (size_t j = 0; j < ATTN_LANES; j++) acc[j] += a[i + j] * b[i + j];
+    float sum = 0;
+    for (; i < n; i++) sum += a[i] * b[i];
+    for (size_t j = 0; j < ATTN_LANES; j++) sum += acc[j];
+    return sum;
+}
+
+/* keys [0, n) that query row i may see, n = seq_k when not causal */
+static size_t attn_keys(const AttnArgs* args, size_t i) {
+    size_t seq_k = args->k->rows;
+    if (!args->causal) return seq_k;
+    long n = (long)i + args->offset + 1;
+    if (n < 0) return 0;
+    return ((size_t)n < seq_k) ? (size_t)n : seq_k;
+}
+
+static bool attn_shapes(const Mat* q, const Mat* k, const Mat* v,
+                        size_t heads, const Mat* out) {
+    if (q == NULL || k == NULL || v == NULL || out == NULL) return false;
+    if (q->data == NULL || k->data == NULL || v->data == NULL
+        || out->data == NULL || heads == 0 || q->cols == 0)
+        return false;
+    if (q->cols % heads != 0 || q->cols / heads > ATTN_MAX_HEAD_DIM)
+        return false;
+    if (k->cols != q->cols || v->cols != q->cols || out->cols != q->cols
+        || k->rows != v->rows || out->rows != q->rows)
+        return false;
+    return q->stride >= q->cols && k->stride >= k->cols
+        && v->stride >= v->cols && out->stride >= out->cols;
+}
+
+static AttnArgs attn_args(const Mat* q, const Mat* k, const Mat* v,
+                          size_t heads, bool causal, Mat* out) {
+    AttnArgs args = { q, k, v, out, heads, q->cols / heads,
+                      (q->rows + ATTN_TILE_Q - 1) / ATTN_TILE_Q, 0, causal,
+                      (long)k->rows - (long)q->rows };
+    args.scale = (float)(1.0 / sqrt((double)args.head_dim));
+    return args;
+}
+
+/* --- fused --- */
+
+/* the working set of one task, on its thread's stack. the query tile is
+ * held transposed and pre-scaled, so the scores of a key against every
+ * query of the tile come out as one contiguous row: s[j][i] */
+typedef struct {
+    float qt[ATTN_MAX_HEAD_DIM][ATTN_TILE_Q];   // q^T * scale
+    float s[ATTN_TILE_K][ATTN_TILE_Q];          // scores, then probabilities
+    float acc[ATTN_TILE_Q][ATTN_MAX_HEAD_DIM];  // unnormalized output
+    float m[ATTN_TILE_Q];       // running max of the scores
+    float l[ATTN_TILE_Q];       // running sum of e^(score - m)
+    int seen[ATTN_TILE_Q];      // keys of the current tile each query sees
+} AttnTile;
+
+/* s[j] = k_j . q^T for ATTN_KEY_BLOCK keys at a time: each row of qt is
+ * loaded once for all of them, and their scores stay in registers. keys
+ * past nk are left as they are, masked later */
+ATTN_CONTRACT
+static void attn_scores(AttnTile* t, const float* k_rows[], size_t nk,
+                        size_t d) {
+    for (size_t j = 0; j < nk; j += ATTN_KEY_BLOCK) {
+        float block[ATTN_KEY_BLOCK][ATTN_TILE_Q] = {{0}};
+        const float* kb[ATTN_KEY_BLOCK];
+        for (size_t r = 0; r < ATTN_KEY_BLOCK; r++)
+            kb[r] = k_rows[(j + r < nk) ? j + r : nk - 1];
+        for (size_t c = 0; c < d; c++) {
+            for (size_t r = 0; r < ATTN_KEY_BLOCK; r++) {
+                float kc = kb[r][c];
+                for (size_t i = 0; i < ATTN_TILE_Q; i++)
+                    block[r][i] += kc * t->qt[c][i];
+            }
+        }
+        for (size_t r = 0; r < ATTN_KEY_BLOCK && j + r < nk; r++)
+            memcpy(t->s[j + r], block[r], sizeof(block[r]));
+    }
+}
+
+/* online softmax over a key tile, every query of the tile at once: the
+ * scores become probabilities relative to the new running max, and what
+ * was accumulated so far is scaled down to match. masked scores become 0 */
+static void attn_softmax(AttnTile* t, size_t nk, size_t nq, size_t d) {
+    float m_new[ATTN_TILE_Q], sum[ATTN_TILE_Q] = {0};
+    for (size_t i = 0; i < ATTN_TILE_Q; i++) m_new[i] = t->m[i];
+    for (size_t j = 0; j < nk; j++) {
+        #pragma GCC unroll 1
+        for (size_t i = 0; i < ATTN_TILE_Q; i++) {
+            float x = ((int)j < t->seen[i]) ? t->s[j][i] : -INFINITY;
+            m_new[i] = (x > m_new[i]) ? x : m_new[i];
+        }
+    }
+    for (size_t j = 0; j < nk; j++) {
+        for (size_t i = 0; i < ATTN_TILE_Q; i++) {
+            float e = vmath_expf(t->s[j][i] - m_new[i]);
+            t->s[j][i] = ((int)j < t->seen[i]) ? e : 0;
+            sum[i] += t->s[j][i];
+        }
+    }
+    for (size_t i = 0; i < nq; i++) {
+        if (t->seen[i] == 0) continue;
+        // 0 on the first tile a query sees, 1 while its max holds
+        float correction = vmath_expf(t->m[i] - m_new[i]);
+        t->l[i] = t->l[i] * correction + sum[i];
+        t->m[i] = m_new[i];
+        if (correction != 1)
+            for (size_t c = 0; c < d; c++) t->acc[i][c] *= correction;
+    }
+}
+
+/* acc[i][c0, c0 + width) += sum_j p[j][i] v_j for four queries: the
+ * block is held in registers while the value rows stream past, with
+ * enough independent sums to keep the multiply-adds busy. inlined with a
+ * constant width */
+ATTN_CONTRACT
+static inline void attn_values_block(AttnTile* t, const float* v_rows[],
+                                     size_t nk, size_t i, size_t c0,
+                                     size_t width) {
+    float block[ATTN_QUERY_BLOCK][ATTN_VALUE_COLS] = {{0}};
+    for (size_t j = 0; j < nk; j++) {
+        const float* vj = v_rows[j] + c0;
+        for (size_t r = 0; r < ATTN_QUERY_BLOCK; r++) {
+            float prj = t->s[j][i + r];
+            for (size_t c = 0; c < width; c++) block[r][c] += prj * vj[c];
+        }
+    }
+    for (size_t r = 0; r < ATTN_QUERY_BLOCK; r++)
+        for (size_t c = 0; c < width; c++) t->acc[i + r][c0 + c] += block[r][c];
+}
+
+/* acc[i] += sum_j p[j][i] v_j, in blocks of ATTN_VALUE_COLS or
+ * ATTN_LANES columns where d allows. rows of a ragged tile past nq have
+ * probabilities 0 and are accumulated all the same */
+ATTN_CONTRACT
+static void attn_values(AttnTile* t, const float* v_rows[], size_t nk,
+                        size_t nq, size_t d) {
+    if (d % ATTN_LANES != 0) {
+        for (size_t i = 0; i < nq; i++) {
+            for (size_t j = 0; j < nk; j++) {
+                float pj = t->s[j][i];
+                for (size_t c = 0; c < d; c++) t->acc[i][c] += pj * v_rows[j][c];
+            }
+        }
+        return;
+    }
+    for (size_t i = 0; i < nq; i += ATTN_QUERY_BLOCK) {
+        size_t c0 = 0;
+        for (; c0 + ATTN_VALUE_COLS <= d; c0 += ATTN_VALUE_COLS)
+            attn_values_block(t, v_rows, nk, i, c0, ATTN_VALUE_COLS);
+        for (; c0 < d; c0 += ATTN_LANES)
+            attn_values_block(t, v_rows, nk, i, c0, ATTN_LANES);
+    }
+}
+
+/* one head, queries [q0, q0 + nq) */
+static void attn_tile(const AttnArgs* args, size_t h, size_t q0, size_t nq) {
+    size_t d = args->head_dim;
+    size_t col = h * d;
+    AttnTile t;
+    const float* k_rows[ATTN_TILE_K];
+    const float* v_rows[ATTN_TILE_K];
+    // rows past nq, in a ragged last tile, are zeros that see no key
+    memset(t.qt, 0, d * sizeof(t.qt[0]));
+    memset(t.acc, 0, sizeof(t.acc));
+    for (size_t i = 0; i < ATTN_TILE_Q; i++) {
+        t.m[i] = -INFINITY;
+        t.l[i] = 0;
+    }
+    for (size_t i = 0; i < nq; i++) {
+        const float* qi = args->q->data + (q0 + i) * args->q->stride + col;
+        for (size_t c = 0; c < d; c++) t.qt[c][i] = qi[c] * args->scale;
+    }
+
+    // keys beyond what the last query sees are skipped whole
+    size_t k_end = attn_keys(args, q0 + nq - 1);
+    for (size_t k0 = 0; k0 < k_end; k0 += ATTN_TILE_K) {
+        size_t nk = (k_end - k0 < ATTN_TILE_K) ? k_end - k0 : ATTN_TILE_K;
+        for (size_t j = 0; j < nk; j++) {
+            k_rows[j] = args->k->data + (k0 + j) * args->k->stride + col;
+            v_rows[j] = args->v->data + (k0 + j) * args->v->stride + col;
+        }
+        for (size_t i = 0; i < ATTN_TILE_Q; i++) {
+            size_t seen = (i < nq) ? attn_keys(args, q0 + i) : 0;
+            t.seen[i] = (seen <= k0) ? 0 : (seen - k0 < nk) ? (int)(seen - k0)
+                                                            : (int)nk;
+        }
+        attn_scores(&t, k_rows, nk, d);
+        attn_softmax(&t, nk, nq, d);
+        attn_values(&t, v_rows, nk, nq, d);
+    }
+
+    for (size_t i = 0; i < nq; i++) {
+        float* o = args->out->data + (q0 + i) * args->out->stride + col;
+        float inv = (t.l[i] > 0) ? 1.0f / t.l[i] : 0;
+        for (size_t c = 0; c < d; c++) o[c] = t.acc[i][c] * inv;
+    }
+}
+
+/* tasks are (query tile, head) pairs. causal tiles get longer down the
+ * sequence, so they are taken from both ends in turn: the contiguous
+ * ranges parallel_for hands out then get a similar amount of work */
+static void attn_range(void* ctx, size_t begin, size_t end) {
+    const AttnArgs* args = ctx;
+    for (size_t t = begin; t < end; t++) {
+        size_t rank = t / args->heads;
+        size_t h = t % args->heads;
+        size_t tile = rank;
+        if (args->causal)
+            tile = (rank % 2 == 0) ? rank / 2 : args->n_tiles - 1 - rank / 2;
+        size_t q0 = tile * ATTN_TILE_Q;
+        size_t nq = (args->q->rows - q0 < ATTN_TILE_Q)
+                  ? args->q->rows - q0 : ATTN_TILE_Q;
+        attn_tile(args, h, q0, nq);
+    }
+}
+
+bool attention(const Mat* q, const Mat* k, const Mat* v, size_t heads,
+               bool causal, Mat* out) {
+    if (!attn_shapes(q, k, v, heads, out)) return false;
+    AttnArgs args = attn_args(q, k, v, heads, causal, out);
+    parallel_for(args.n_tiles * heads, 1, attn_range, &args);
+    return true;
+}
+
+/* --- naive reference --- */
+
+typedef struct {
+    const AttnArgs* args;
+    size_t h;
+    float* scores;          // seq_q x seq_k
+} NaiveArgs;
+
+/* scores = q k^T * scale, masked keys at -inf */
+static void naive_scores_range(void* ctx, size_t begin, size_t end) {
+    const NaiveArgs* na = ctx;
+    const AttnArgs* args = na->args;
+    size_t d = args->head_dim, col = na->h * d, seq_k = args->k->rows;
+    for (size_t i = begin; i < end; i++) {
+        const float* qi = args->q->data + i * args->q->stride + col;
+        float* row = na->scores + i * seq_k;
+        size_t seen = attn_keys(args, i);
+        for (size_t j = 0; j < seq_k; j++) {
+            const float* kj = args->k->data + j * args->k->stride + col;
+            row[j] = (j < seen) ? attn_dot(qi, kj, d) * args->scale
+                                : -INFINITY;
+        }
+    }
+}
+
+/* out = probabilities v */
+static void naive_output_range(void* ctx, size_t begin, size_t end) {
+    const NaiveArgs* na = ctx;
+    const AttnArgs* args = na->args;
+    size_t d = args->head_dim, col = na->h * d, seq_k = args->k->rows;
+    for (size_t i = begin; i < end; i++) {
+        float* o = args->out->data + i * args->out->stride + col;
+        const float* row = na->scores + i * seq_k;
+        memset(o, 0, d * sizeof(float));
+        if (attn_keys(args, i) == 0) continue;  // softmax of all -inf
+        for (size_t j = 0; j < seq_k; j++) {
+            const float* vj = args->v->data + j * args->v->stride + col;
+            for (size_t c = 0; c < d; c++) o[c] += row[j] * vj[c];
+        }
+    }
+}
+
+bool attention_naive(const Mat* q, const Mat* k, const Mat* v, size_t heads,
+                     bool causal, Mat* out) {
+    if (!attn_shapes(q, k, v, heads, out)) return false;
+    AttnArgs args = attn_args(q, k, v, heads, causal, out);
+    size_t seq_q = q->rows, seq_k = k->rows;
+    if (seq_q == 0) return true;
+    if (seq_k == 0) {
+        for (size_t i = 0; i < seq_q; i++)
+            memset(out->data + i * out->stride, 0, out->cols * sizeof(float));
+        return true;
+    }
+
+    float* scores = mem_malloc(seq_q * seq_k * sizeof(float), MEM_VEC);
+    if (scores == NULL) {
+        fprintf(stderr, "malloc attention scores failed!");
+        return false;
+    }
+    Mat s = { scores, seq_q, seq_k, seq_k };
+    size_t grain = (1 << 14) / seq_k;
+    for (size_t h = 0; h < heads; h++) {
+        NaiveArgs na = { &args, h, scores };
+        parallel_for(seq_q, grain ? grain : 1, naive_scores_range, &na);
+        mat_softmax(&s, &s);
+        parallel_for(seq_q, grain ? grain : 1, naive_output_range, &na);
+    }
+    mem_free(scores);
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef ATTENTION_H
+#define ATTENTION_H
+
+#include <stdbool.h> // bool
+#include "tensor.h" // Mat
+
+/* scaled dot-product attention, softmax(q k^T / sqrt(head_dim)) v, for
+ * every head at once. q and out are [seq_q, heads * head_dim], k and v
+ * are [seq_k, heads * head_dim]; head h is columns [h * head_dim,
+ * (h + 1) * head_dim) of each.
+ *
+ * attention never builds the seq_q x seq_k scores: each task takes
+ * ATTN_TILE_Q queries of one head through the keys ATTN_TILE_K at a time,
+ * keeping a running max, sum and output per query (online softmax), all
+ * on the stack. tasks are spread over the threads with parallel_for.
+ *
+ * with `causal`, query i sees keys j <= i + seq_k - seq_q, so the last
+ * query sees every key (as when decoding with cached keys); a query that
+ * sees no key gets zeros. out may be q, not k or v.
+ *
+ * attention_naive computes the same with the scores of one head at a time
+ * materialized and mat_softmax over them, as a reference.
+ *
+ * both return false, and do nothing, if the shapes don't match, heads
+ * doesn't divide the columns or head_dim > ATTN_MAX_HEAD_DIM */
+
+#define ATTN_TILE_Q       32
+#define ATTN_TILE_K       64
+#define ATTN_MAX_HEAD_DIM 256
+
+bool attention(const Mat* q, const Mat* k, const Mat* v, size_t heads,
+               bool causal, Mat* out);
+bool attention_naive(const Mat* q, const Mat* k, const Mat* v, size_t heads,
+                     bool causal, Mat* out);
+
+#endif // ATTENTION_H
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L    // pthread, clock_gettime
+#include "checkpoint.h"
+#include "mem.h"
+#include <stdio.h>          // fprintf
+#include <string.h>         // strerror
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>           // clock_gettime
+
+struct CheckpointJob {
+    Checkpointer* owner;
+    JsonObject* snapshot;       // freed by the writer once it's written
+    char* filename;
+    CheckpointJob* next;        // in the queue
+    atomic_int status;          // a CheckpointStatus
+    atomic_int refs;            // the caller's and the writer's
+};
+
+struct Checkpointer {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a job was queued, or stop was set
+    pthread_cond_t done;        // a job finished, and its snapshot is gone
+    pthread_t writer;
+    CheckpointJob* head;        // the queue, oldest first
+    CheckpointJob* tail;
+    size_t in_flight;           // snapshots taken or being taken
+    bool stop;
+    CheckpointStats stats;
+};
+
+static uint64_t checkpoint_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void checkpoint_release(CheckpointJob* job) {
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+    json_free(job->snapshot);
+    mem_free(job->filename);
+    mem_free(job);
+}
+
+/* expects the lock to be held */
+static void checkpoint_add_stall(Checkpointer* c, uint64_t start) {
+    uint64_t ns = checkpoint_now_ns() - start;
+    c->stats.stall_ns += ns;
+    c->stats.last_stall_ns = ns;
+    if (ns > c->stats.max_stall_ns) c->stats.max_stall_ns = ns;
+}
+
+static void* checkpoint_writer(void* arg) {
+    Checkpointer* c = arg;
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (c->head == NULL && !c->stop)
+            pthread_cond_wait(&c->work, &c->lock);
+        CheckpointJob* job = c->head;
+        if (job == NULL) break;     // stopped, and nothing left to write
+        c->head = job->next;
+        if (c->head == NULL) c->tail = NULL;
+        pthread_mutex_unlock(&c->lock);
+
+        uint64_t start = checkpoint_now_ns();
+        bool ok = json_dump(job->snapshot, job->filename);
+        int err = errno;
+        json_free(job->snapshot);
+        job->snapshot = NULL;
+        uint64_t ns = checkpoint_now_ns() - start;
+
+        pthread_mutex_lock(&c->lock);
+        c->stats.write_ns += ns;
+        if (ok) c->stats.written++;
+        else    c->stats.failed++;
+        c->in_flight--;
+        atomic_store(&job->status, ok ? CHECKPOINT_DONE : CHECKPOINT_FAILED);
+        pthread_cond_broadcast(&c->done);
+        pthread_mutex_unlock(&c->lock);
+        if (!ok)
+            fprintf(stderr, "checkpoint: writing %s failed: %s\n",
+                    job->filename, strerror(err));
+        checkpoint_release(job);
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+/* starts the writer thread. NULL if it can't be started */
+Checkpointer* checkpoint_init(void) {
+    Checkpointer* c = mem_malloc(sizeof(Checkpointer), MEM_OTHER);
+    if (c == NULL) {
+        fprintf(stderr, "malloc Checkpointer failed!");
+        return NULL;
+    }
+    *c = (Checkpointer){0};
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->work, NULL);
+    pthread_cond_init(&c->done, NULL);
+    if (pthread_create(&c->writer, NULL, checkpoint_writer, c) != 0) {
+        fprintf(stderr, "checkpoint: pthread_create failed\n");
+        pthread_mutex_destroy(&c->lock);
+        pthread_cond_destroy(&c->work);
+        pthread_cond_destroy(&c->done);
+        mem_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* writes the saves still queued, then stops the writer */
+void checkpoint_free(Checkpointer* c) {
+    if (c == NULL) return;
+    pthread_mutex_lock(&c->lock);
+    c->stop = true;
+    pthread_cond_signal(&c->work);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->writer, NULL);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->work);
+    pthread_cond_destroy(&c->done);
+    mem_free(c);
+}
+
+/* snapshots `doc` and queues it to be written to `filename`. waits first
+ * if CHECKPOINT_QUEUE snapshots are already waiting or being written */
+CheckpointJob* checkpoint_save(Checkpointer* c, const JsonObject* doc,
+                               const char* filename) {
+    if (c == NULL || doc == NULL || filename == NULL) return NULL;
+    uint64_t start = checkpoint_now_ns();
+    CheckpointJob* job = mem_malloc(sizeof(CheckpointJob), MEM_OTHER);
+    if (job == NULL) {
+        fprintf(stderr, "malloc CheckpointJob failed!");
+        return NULL;
+    }
+    job->owner = c;
+    job->snapshot = NULL;
+    job->filename = mem_strdup(filename, MEM_OTHER);
+    job->next = NULL;
+    atomic_init(&job->status, CHECKPOINT_PENDING);
+    atomic_init(&job->refs, 2);
+
+    // the slot is taken before the snapshot, so there are never more
+    pthread_mutex_lock(&c->lock);
+    while (c->in_flight == CHECKPOINT_QUEUE)
+        pthread_cond_wait(&c->done, &c->lock);
+    c->in_flight++;
+    pthread_mutex_unlock(&c->lock);
+
+    if (job->filename != NULL) job->snapshot = json_clone(doc);
+
+    pthread_mutex_lock(&c->lock);
+    if (job->snapshot == NULL) {
+        c->in_flight--;
+        c->stats.failed++;
+        checkpoint_add_stall(c, start);
+        pthread_cond_broadcast(&c->done);
+        pthread_mutex_unlock(&c->lock);
+        fprintf(stderr, "checkpoint: snapshot of %s failed\n", filename);
+        mem_free(job->filename);
+        mem_free(job);
+        return NULL;
+    }
+    if (c->tail == NULL) c->head = job;
+    else                 c->tail->next = job;
+    c->tail = job;
+    c->stats.saves++;
+    checkpoint_add_stall(c, start);
+    pthread_cond_signal(&c->work);
+    pthread_mutex_unlock(&c->lock);
+    return job;
+}
+
+CheckpointStatus checkpoint_poll(const CheckpointJob* job) {
+    return (CheckpointStatus)atomic_load(&job->status);
+}
+
+/* blocks until `job` is written, and releases it. true if the file was
+ * replaced */
+bool checkpoint_wait(CheckpointJob* job) {
+    if (job == NULL) return false;
+    if (atomic_load(&job->status) == CHECKPOINT_PENDING) {
+        // still queued, so the checkpointer hasn't been freed yet
+        Checkpointer* c = job->owner;
+        pthread_mutex_lock(&c->lock);
+        while (atomic_load(&job->status) == CHECKPOINT_PENDING)
+            pthread_cond_wait(&c->done, &c->lock);
+        pthread_mutex_unlock(&c->lock);
+    }
+    bool ok = atomic_load(&job->status) == CHECKPOINT_DONE;
+    checkpoint_release(job);
+    return ok;
+}
+
+void checkpoint_stats(Checkpointer* c, CheckpointStats* out) {
+    pthread_mutex_lock(&c->lock);
+    *out = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
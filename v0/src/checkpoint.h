@@ -0,0 +1,55 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h> // bool
+#include <stdint.h>  // uint64_t
+#include "json.h"    // JsonObject
+
+/* saves documents in the background, eg. model checkpoints from a training
+ * loop.
+ *
+ * checkpoint_save takes a snapshot of the document with json_clone (the
+ * Vecs are memcpy'd) and queues it; a writer thread serializes it and
+ * writes it with json_dump, so the file is replaced atomically and is
+ * fsynced. the caller is only held up for the snapshot, and the document
+ * may be changed as soon as checkpoint_save returns.
+ *
+ * at most CHECKPOINT_QUEUE snapshots exist at once, the one being written
+ * included, so a save made while the writer is still behind waits for it
+ * first. all of that time is counted as stall in CheckpointStats.
+ *
+ * saves are written in the order they were queued. checkpoint_save
+ * returns NULL if the snapshot can't be taken; every other job returned
+ * must be given to checkpoint_wait once, which releases it. checkpoint_free
+ * writes whatever is still queued before it returns */
+
+#define CHECKPOINT_QUEUE 2
+
+typedef enum {
+    CHECKPOINT_PENDING,
+    CHECKPOINT_DONE,
+    CHECKPOINT_FAILED,
+} CheckpointStatus;
+
+typedef struct {
+    uint64_t saves;         // snapshots queued
+    uint64_t written;       // files renamed into place
+    uint64_t failed;        // snapshots or writes that failed
+    uint64_t stall_ns;      // the callers of checkpoint_save, in total
+    uint64_t max_stall_ns;
+    uint64_t last_stall_ns;
+    uint64_t write_ns;      // the writer, serializing and writing
+} CheckpointStats;
+
+typedef struct Checkpointer Checkpointer;
+typedef struct CheckpointJob CheckpointJob;
+
+Checkpointer* checkpoint_init(void);
+void checkpoint_free(Checkpointer* c);
+CheckpointJob* checkpoint_save(Checkpointer* c, const JsonObject* doc,
+                               const char* filename);
+CheckpointStatus checkpoint_poll(const CheckpointJob* job);
+bool checkpoint_wait(CheckpointJob* job);
+void checkpoint_stats(Checkpointer* c, CheckpointStats* out);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,385 @@
+#include "expr.h"
+#include "parallel.h"       // parallel_for
+#include "mem.h"
+#include <stdio.h>          // fprintf
+#include <string.h>         // memmove
+
+/* elements per parallel_for range, as for the vec kernels */
+#define EXPR_GRAIN (1 << 14)
+
+typedef enum {
+    EXPR_INPUT, EXPR_CONST,                                     // leaves
+    EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_MAX, EXPR_MIN, // binary
+    EXPR_NEG, EXPR_RELU,                                        // unary
+    EXPR_COPY,              // only in programs, for a root that is a leaf
+} ExprOp;
+
+struct Expr {
+    Expr* next;             // every node of the graph, for expr_graph_free
+    ExprOp op;
+    size_t dim;
+    const Expr* a;
+    const Expr* b;
+    const Vec* vec;         // EXPR_INPUT
+    float value;            // EXPR_CONST
+};
+
+struct ExprGraph {
+    Expr* nodes;
+};
+
+/* caller owns the graph; every node built in it is freed with it */
+ExprGraph* expr_graph_new(void) {
+    ExprGraph* g = mem_malloc(sizeof(ExprGraph), MEM_VEC);
+    if (g == NULL) {
+        fprintf(stderr, "malloc expr graph failed!");
+        return NULL;
+    }
+    g->nodes = NULL;
+    return g;
+}
+
+void expr_graph_free(ExprGraph* g) {
+    if (g == NULL) return;
+    Expr* e = g->nodes;
+    while (e != NULL) {
+        Expr* next = e->next;
+        mem_free(e);
+        e = next;
+    }
+    mem_free(g);
+}
+
+static Expr* expr_node(ExprGraph* g, ExprOp op, size_t dim,
+                       const Expr* a, const Expr* b) {
+    if (g == NULL) return NULL;
+    Expr* e = mem_malloc(sizeof(Expr), MEM_VEC);
+    if (e == NULL) {
+        fprintf(stderr, "malloc expr node failed!");
+        return NULL;
+    }
+    *e = (Expr){ g->nodes, op, dim, a, b, NULL, 0 };
+    g->nodes = e;
+    return e;
+}
+
+Expr* expr_input(ExprGraph* g, const Vec* v) {
+    if (v == NULL || v->data == NULL) return NULL;
+    Expr* e = expr_node(g, EXPR_INPUT, v->dim, NULL, NULL);
+    if (e != NULL) e->vec = v;
+    return e;
+}
+
+Expr* expr_const(ExprGraph* g, float value) {
+    Expr* e = expr_node(g, EXPR_CONST, 1, NULL, NULL);
+    if (e != NULL) e->value = value;
+    return e;
+}
+
+static Expr* expr_binary(ExprGraph* g, ExprOp op,
+                         const Expr* a, const Expr* b) {
+    if (a == NULL || b == NULL) return NULL;
+    if (a->dim != b->dim && a->dim != 1 && b->dim != 1) return NULL;
+    return expr_node(g, op, (a->dim > b->dim) ? a->dim : b->dim, a, b);
+}
+
+static Expr* expr_unary(ExprGraph* g, ExprOp op, const Expr* a) {
+    if (a == NULL) return NULL;
+    return expr_node(g, op, a->dim, a, NULL);
+}
+
+Expr* expr_add(ExprGraph* g, const Expr* a, const Expr* b) {
+    return expr_binary(g, EXPR_ADD, a, b);
+}
+
+Expr* expr_sub(ExprGraph* g, const Expr* a, const Expr* b) {
+    return expr_binary(g, EXPR_SUB, a, b);
+}
+
+Expr* expr_mul(ExprGraph* g, const Expr* a, const Expr* b) {
+    return expr_binary(g, EXPR_MUL, a, b);
+}
+
+Expr* expr_div(ExprGraph* g, const Expr* a, const Expr* b) {
+    return expr_binary(g, EXPR_DIV, a, b);
+}
+
+/* max and min return b if either side is nan */
+Expr* expr_max(ExprGraph* g, const Expr* a, const Expr* b) {
+    return expr_binary(g, EXPR_MAX, a, b);
+}
+
+Expr* expr_min(ExprGraph* g, const Expr* a, const Expr* b) {
+    return expr_binary(g, EXPR_MIN, a, b);
+}
+
+Expr* expr_neg(ExprGraph* g, const Expr* a) {
+    return expr_unary(g, EXPR_NEG, a);
+}
+
+/* relu(nan) is 0 */
+Expr* expr_relu(ExprGraph* g, const Expr* a) {
+    return expr_unary(g, EXPR_RELU, a);
+}
+
+size_t expr_dim(const Expr* e) {
+    return (e != NULL) ? e->dim : 0;
+}
+
+/* the one kernel per op, used by both evaluators so they agree bit for
+ * bit. dst may alias a or b */
+static void expr_apply(ExprOp op, const float* a, const float* b,
+                       float* dst, size_t n) {
+    switch (op) {
+        case EXPR_ADD:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] + b[i];
+            break;
+        case EXPR_SUB:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] - b[i];
+            break;
+        case EXPR_MUL:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] * b[i];
+            break;
+        case EXPR_DIV:
+            for (size_t i = 0; i < n; i++) dst[i] = a[i] / b[i];
+            break;
+        case EXPR_MAX:
+            for (size_t i = 0; i < n; i++) dst[i] = (a[i] > b[i]) ? a[i] : b[i];
+            break;
+        case EXPR_MIN:
+            for (size_t i = 0; i < n; i++) dst[i] = (a[i] < b[i]) ? a[i] : b[i];
+            break;
+        case EXPR_NEG:
+            for (size_t i = 0; i < n; i++) dst[i] = -a[i];
+            break;
+        case EXPR_RELU:
+            for (size_t i = 0; i < n; i++) dst[i] = (a[i] > 0) ? a[i] : 0;
+            break;
+        case EXPR_COPY:
+            memmove(dst, a, n * sizeof(float));
+            break;
+        case EXPR_INPUT:
+        case EXPR_CONST:
+            break;
+    }
+}
+
+/* --- programs --- */
+
+/* the dag in topological order, each distinct node once, so a shared
+ * subexpression is computed once per tile */
+typedef struct {
+    const Expr* nodes[EXPR_MAX_NODES];
+    int arg_a[EXPR_MAX_NODES];      // index into nodes, -1 if none
+    int arg_b[EXPR_MAX_NODES];
+    int n_nodes;
+} ExprOrder;
+
+/* the nodes on a path from the root are distinct, so a path deeper than
+ * EXPR_MAX_NODES is refused before the recursion can go further */
+static int expr_visit(ExprOrder* order, const Expr* e, int depth) {
+    if (depth == EXPR_MAX_NODES) return -1;
+    for (int i = 0; i < order->n_nodes; i++)
+        if (order->nodes[i] == e) return i;
+    int a = -1, b = -1;
+    if (e->a != NULL && (a = expr_visit(order, e->a, depth + 1)) < 0)
+        return -1;
+    if (e->b != NULL && (b = expr_visit(order, e->b, depth + 1)) < 0)
+        return -1;
+    if (order->n_nodes == EXPR_MAX_NODES) return -1;
+    int i = order->n_nodes++;
+    order->nodes[i] = e;
+    order->arg_a[i] = a;
+    order->arg_b[i] = b;
+    return i;
+}
+
+/* an operand is a tile slot (< EXPR_MAX_SLOTS) or an input array
+ * (EXPR_MAX_SLOTS + its index); EXPR_OUT is the destination vec */
+#define EXPR_OUT (-1)
+
+typedef struct {
+    ExprOp op;
+    int dst;
+    int a;
+    int b;
+} ExprInstr;
+
+typedef struct {
+    ExprInstr instrs[EXPR_MAX_NODES];
+    int n_instrs;
+    const float* inputs[EXPR_MAX_NODES];
+    int n_inputs;
+    int const_slots[EXPR_MAX_SLOTS];    // broadcast values, filled once
+    float const_values[EXPR_MAX_SLOTS];
+    int n_consts;
+    float* out;
+} ExprProgram;
+
+static int slot_alloc(bool used[EXPR_MAX_SLOTS]) {
+    for (int s = 0; s < EXPR_MAX_SLOTS; s++) {
+        if (!used[s]) {
+            used[s] = true;
+            return s;
+        }
+    }
+    return -1;
+}
+
+/* lowers the dag to instructions over tile slots. a slot is reused once
+ * the last instruction reading it has run. returns false if the dag has
+ * more than EXPR_MAX_NODES nodes or needs more than EXPR_MAX_SLOTS slots */
+static bool expr_compile(const Expr* root, size_t dim, ExprProgram* p) {
+    ExprOrder order = { .n_nodes = 0 };
+    if (expr_visit(&order, root, 0) < 0) return false;
+
+    int last_use[EXPR_MAX_NODES];
+    for (int i = 0; i < order.n_nodes; i++) {
+        last_use[i] = -1;
+        if (order.arg_a[i] >= 0) last_use[order.arg_a[i]] = i;
+        if (order.arg_b[i] >= 0) last_use[order.arg_b[i]] = i;
+    }
+
+    bool used[EXPR_MAX_SLOTS] = { false };
+    int ref[EXPR_MAX_NODES];
+    p->n_instrs = p->n_inputs = p->n_consts = 0;
+    for (int i = 0; i < order.n_nodes; i++) {
+        const Expr* e = order.nodes[i];
+        bool is_root = (i == order.n_nodes - 1);
+        if (e->op == EXPR_INPUT && e->dim == dim) {
+            ref[i] = EXPR_MAX_SLOTS + p->n_inputs;
+            p->inputs[p->n_inputs++] = e->vec->data;
+        } else if (e->op == EXPR_INPUT || e->op == EXPR_CONST) {
+            // broadcast: a slot of the value for the whole evaluation
+            if ((ref[i] = slot_alloc(used)) < 0) return false;
+            p->const_slots[p->n_consts] = ref[i];
+            p->const_values[p->n_consts++] = (e->op == EXPR_CONST)
+                                           ? e->value : e->vec->data[0];
+        } else {
+            int a = ref[order.arg_a[i]];
+            int b = (order.arg_b[i] >= 0) ? ref[order.arg_b[i]] : a;
+            // the operands die here: their slots can take the result,
+            // reading and writing the same element is fine
+            for (int k = 0; k < 2; k++) {
+                int arg = k ? order.arg_b[i] : order.arg_a[i];
+                ExprOp arg_op = (arg >= 0) ? order.nodes[arg]->op : EXPR_INPUT;
+                if (arg >= 0 && last_use[arg] == i && arg_op != EXPR_INPUT
+                    && arg_op != EXPR_CONST)
+                    used[ref[arg]] = false;
+            }
+            int dst = is_root ? EXPR_OUT : slot_alloc(used);
+            if (!is_root && dst < 0) return false;
+            p->instrs[p->n_instrs++] = (ExprInstr){ e->op, dst, a, b };
+            ref[i] = dst;
+            continue;
+        }
+        if (is_root)
+            p->instrs[p->n_instrs++] = (ExprInstr){ EXPR_COPY, EXPR_OUT,
+                                                    ref[i], ref[i] };
+    }
+    return true;
+}
+
+static void expr_range(void* ctx, size_t begin, size_t end) {
+    const ExprProgram* p = ctx;
+    float slots[EXPR_MAX_SLOTS][EXPR_TILE];
+    for (int c = 0; c < p->n_consts; c++)
+        for (size_t i = 0; i < EXPR_TILE; i++)
+            slots[p->const_slots[c]][i] = p->const_values[c];
+
+    for (size_t lo = begin; lo < end; lo += EXPR_TILE) {
+        size_t n = (end - lo < EXPR_TILE) ? end - lo : EXPR_TILE;
+        for (int k = 0; k < p->n_instrs; k++) {
+            const ExprInstr* in = p->instrs + k;
+            const float* a = (in->a < EXPR_MAX_SLOTS)
+                           ? slots[in->a] : p->inputs[in->a - EXPR_MAX_SLOTS] + lo;
+            const float* b = (in->b < EXPR_MAX_SLOTS)
+                           ? slots[in->b] : p->inputs[in->b - EXPR_MAX_SLOTS] + lo;
+            float* dst = (in->dst == EXPR_OUT) ? p->out + lo : slots[in->dst];
+            expr_apply(in->op, a, b, dst, n);
+        }
+    }
+}
+
+/* evaluates `e` into `out` in one fused pass. out->dim must match the
+ * expression's, or the expression must have dim 1 and is broadcast. false
+ * if it doesn't, or the dag is too big for one program (see expr.h) */
+bool expr_eval(const Expr* e, Vec* out) {
+    if (e == NULL || out == NULL || out->data == NULL) return false;
+    if (e->dim != out->dim && e->dim != 1) return false;
+
+    ExprProgram p;
+    if (!expr_compile(e, out->dim, &p)) return false;
+    p.out = out->data;
+    parallel_for(out->dim, EXPR_GRAIN, expr_range, &p);
+    return true;
+}
+
+/* --- unfused reference --- */
+
+typedef struct {
+    ExprOp op;
+    const float* a;
+    const float* b;
+    float* dst;
+} ExprPass;
+
+static void expr_pass_range(void* ctx, size_t begin, size_t end) {
+    const ExprPass* pass = ctx;
+    expr_apply(pass->op, pass->a + begin, pass->b + begin, pass->dst + begin,
+               end - begin);
+}
+
+/* evaluates `e` the way separate vec kernels would: one full pass and one
+ * full-size temporary per node, broadcast values included. for checking
+ * expr_eval and measuring what fusing saves; same arguments and results */
+bool expr_eval_unfused(const Expr* e, Vec* out) {
+    if (e == NULL || out == NULL || out->data == NULL) return false;
+    if (e->dim != out->dim && e->dim != 1) return false;
+    ExprOrder order = { .n_nodes = 0 };
+    if (expr_visit(&order, e, 0) < 0) return false;
+
+    size_t dim = out->dim;
+    Vec* temps[EXPR_MAX_NODES] = { NULL };
+    const Vec* values[EXPR_MAX_NODES];
+    bool ok = true;
+    for (int i = 0; i < order.n_nodes && ok; i++) {
+        const Expr* node = order.nodes[i];
+        bool is_root = (i == order.n_nodes - 1);
+        if (node->op == EXPR_INPUT && node->dim == dim && !is_root) {
+            values[i] = node->vec;
+            continue;
+        }
+        Vec* dst = out;
+        if (!is_root) {
+            if ((dst = temps[i] = vec_init(dim)) == NULL
+                || dst->data == NULL) {
+                ok = false;
+                break;
+            }
+        }
+        values[i] = dst;
+        if (node->op == EXPR_INPUT && node->dim == dim) {
+            memmove(dst->data, node->vec->data, dim * sizeof(float));
+        } else if (node->op == EXPR_INPUT || node->op == EXPR_CONST) {
+            float v = (node->op == EXPR_CONST) ? node->value
+                                               : node->vec->data[0];
+            for (size_t k = 0; k < dim; k++) dst->data[k] = v;
+        } else {
+            const Vec* a = values[order.arg_a[i]];
+            const Vec* b = (order.arg_b[i] >= 0) ? values[order.arg_b[i]] : a;
+            if (node->op == EXPR_ADD) {
+                vec_add(a, b, dst);
+            } else if (node->op == EXPR_MUL) {
+                vec_mul(a, b, dst);
+            } else {
+                ExprPass pass = { node->op, a->data, b->data, dst->data };
+                parallel_for(dim, EXPR_GRAIN, expr_pass_range, &pass);
+            }
+        }
+    }
+    for (int i = 0; i < order.n_nodes; i++) {
+        if (temps[i] != NULL) vec_free(temps[i]);
+    }
+    return ok;
+}
@@ -0,0 +1,51 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdlib.h> // size_t
+#include <stdbool.h> // bool
+#include "tensor.h" // Vec
+
+/* lazy elementwise expressions over Vecs. the builders only record a node
+ * in the graph; expr_eval runs the whole dag in one parallel pass over
+ * tiles of EXPR_TILE elements, keeping intermediates in small per-thread
+ * buffers, so every input is read once and `out` is written once:
+ *
+ *   // out = relu(a * x + b) * scale
+ *   ExprGraph* g = expr_graph_new();
+ *   Expr* ax = expr_mul(g, expr_input(g, a), expr_input(g, x));
+ *   Expr* y = expr_relu(g, expr_add(g, ax, expr_input(g, b)));
+ *   expr_eval(expr_mul(g, y, expr_const(g, scale)), out);
+ *   expr_graph_free(g);
+ *
+ * an operand of dim 1 (a constant, or a 1-element Vec) broadcasts against
+ * the other one. builders return NULL on a dim mismatch or a failed
+ * allocation, and return NULL when given a NULL operand, so a chain only
+ * needs checking at the end. Vecs are read when evaluated, not when their
+ * node is built, and `out` may be one of the inputs */
+
+#define EXPR_TILE       256     // elements per tile, all buffers fit in L1
+#define EXPR_MAX_NODES  64      // distinct nodes reachable from one root
+#define EXPR_MAX_SLOTS  32      // tile buffers live at once, incl. constants
+
+typedef struct Expr Expr;
+typedef struct ExprGraph ExprGraph;
+
+ExprGraph* expr_graph_new(void);
+void expr_graph_free(ExprGraph* g);
+
+Expr* expr_input(ExprGraph* g, const Vec* v);
+Expr* expr_const(ExprGraph* g, float value);
+Expr* expr_add(ExprGraph* g, const Expr* a, const Expr* b);
+Expr* expr_sub(ExprGraph* g, const Expr* a, const Expr* b);
+Expr* expr_mul(ExprGraph* g, const Expr* a, const Expr* b);
+Expr* expr_div(ExprGraph* g, const Expr* a, const Expr* b);
+Expr* expr_max(ExprGraph* g, const Expr* a, const Expr* b);
+Expr* expr_min(ExprGraph* g, const Expr* a, const Expr* b);
+Expr* expr_neg(ExprGraph* g, const Expr* a);
+Expr* expr_relu(ExprGraph* g, const Expr* a);
+size_t expr_dim(const Expr* e);
+
+bool expr_eval(const Expr* e, Vec* out);
+bool expr_eval_unfused(const Expr* e, Vec* out);
+
+#endif // EXPR_H
@@ -1,21 +1,69 @@
+#define _POSIX_C_SOURCE 200809L    // open, fsync
 #include "json.h"
 #include "string_ext.h"
 #include "tensor.h"
+#include "json_parser.h"
+#include "mem.h"
 #include <stdio.h>      // fprintf
 #include <string.h>     // strcmp
 #include <ctype.h>      // isalnum, isdigit, etc...
+#include <math.h>       // isnan, isinf
+#include <errno.h>      // EINTR, ENOMEM
+#include <fcntl.h>      // open
+#include <unistd.h>     // write, fsync, close
 
-static void json_value_free(JsonValue* value);
 static void json_value_free_inner(JsonValue* value);
-static char* json_value_str(JsonValue* value);
+
+/* heap-allocated stack of fixed-size frames, so that traversals of deep
+ * documents use bounded native stack space */
+typedef struct {
+    char* data;
+    size_t size;        // frames pushed
+    size_t capacity;    // frames allocated
+    size_t frame_size;
+} JsonStack;
+
+static void json_stack_init(JsonStack* stack, size_t frame_size) {
+    stack->data = NULL;
+    stack->size = 0;
+    stack->capacity = 0;
+    stack->frame_size = frame_size;
+}
+
+static void json_stack_free(JsonStack* stack) {
+    mem_free(stack->data);
+}
+
+/* returns the new top frame, or NULL on allocation failure.
+ * invalidates pointers to frames returned earlier */
+static void* json_stack_push(JsonStack* stack) {
+    if (stack->size == stack->capacity) {
+        size_t new_capacity = stack->capacity ? stack->capacity * 2 : 16;
+        char* data = mem_realloc(stack->data,
+                                 new_capacity * stack->frame_size, MEM_JSON);
+        if (data == NULL) return NULL;
+        stack->data = data;
+        stack->capacity = new_capacity;
+    }
+    return stack->data + stack->size++ * stack->frame_size;
+}
+
+static void* json_stack_top(JsonStack* stack) {
+    if (stack->size == 0) return NULL;
+    return stack->data + (stack->size - 1) * stack->frame_size;
+}
+
+static void json_stack_pop(JsonStack* stack) {
+    if (stack->size > 0) stack->size--;
+}
 
 /* initializes an empty JsonArray with given `initial_capacity` */
 static JsonArray* json_array_init(size_t initial_capacity) {
-    JsonArray* arr = malloc(sizeof(JsonArray));
+    JsonArray* arr = mem_malloc(sizeof(JsonArray), MEM_JSON);
     if (arr == NULL) return NULL;
-    arr->values = malloc(initial_capacity * sizeof(JsonValue));
+    arr->values = mem_malloc(initial_capacity * sizeof(JsonValue), MEM_JSON);
     if (arr->values == NULL) {
-        free(arr);
+        mem_free(arr);
         return NULL;
     }
     arr->capacity = initial_capacity;
@@ -23,18 +71,17 @@ static JsonArray* json_array_init(size_t initial_capacity) {
     return arr;
 }
 
+static void json_tree_free(JsonType type, void* root);
+
 static void json_array_free(JsonArray* arr) {
     if (arr == NULL) return;
-
-    for (size_t i = 0; i < arr->size; i++)
-        json_value_free_inner(arr->values + i);
-
-    free(arr->values);
-    free(arr);
+    json_tree_free(J_ARR, arr);
 }
 
 static bool json_array_resize(JsonArray* arr, size_t new_capacity) {
-    JsonValue* new_values = realloc(arr->values, new_capacity * sizeof(JsonValue));
+    JsonValue* new_values = mem_realloc(arr->values,
+                                        new_capacity * sizeof(JsonValue),
+                                        MEM_JSON);
     if (new_values == NULL) return false;
     arr->values = new_values;
     arr->capacity = new_capacity;
@@ -43,35 +90,87 @@ static bool json_array_resize(JsonArray* arr, size_t new_capacity) {
 
 static bool json_array_resize_if_needed(JsonArray* arr, size_t new_size) {
     if (arr->capacity > new_size) return true;  // ok, nothing to do
-    size_t new_capacity = arr->capacity;
+    size_t new_capacity = arr->capacity ? arr->capacity : 1;
     while (new_capacity <= new_size) new_capacity *= 2;
     return json_array_resize(arr, new_capacity);
 }
 
 static bool json_array_append(JsonArray* arr, JsonValue* value) {
-    json_array_resize_if_needed(arr, arr->size + 1);
+    if (!json_array_resize_if_needed(arr, arr->size + 1)) return false;
     arr->values[arr->size++] = *value;
     return true;
 }
 
-static char* json_array_str(JsonArray* arr) {
-    String* s = string_from("[");
-    for (size_t i = 0; i < arr->size; i++) {
-        if (i > 0) string_append(s, ", ");
-        if (arr->values[i].type == J_STR) {
-            string_append(s, "\"");
-            string_append(s, arr->values[i].value.string);
-            string_append(s, "\"");
-        } else {
-            char* value_str = json_value_str(&arr->values[i]);
-            string_append(s, value_str);
-            free(value_str);
+/* a container whose children have not been visited yet */
+typedef struct {
+    JsonType type;      // J_OBJ or J_ARR
+    void* ptr;
+} JsonNode;
+
+/* frees the leaf data in `value`; containers are deferred onto `pending` */
+static void json_value_defer(JsonValue* value, JsonStack* pending) {
+    switch (value->type) {
+        case J_STR:
+            mem_free(value->value.string);
+            break;
+        case J_VEC:
+            vec_free(value->value.vec);
+            break;
+        case J_NUM:
+            break;
+        default: {  // J_OBJ, J_ARR
+            JsonNode* node = json_stack_push(pending);
+            if (node == NULL) {
+                fprintf(stderr, "json free: out of memory, leaking subtree\n");
+                break;
+            }
+            node->type = value->type;
+            node->ptr = (value->type == J_OBJ) ? (void*)value->value.obj
+                                               : (void*)value->value.arr;
+            break;
         }
     }
-    string_append(s, "]");
-    char* result = string_to_chars(s);
-    string_free(s);
-    return result;
+}
+
+static void json_node_free(JsonNode node, JsonStack* pending) {
+    if (node.type == J_OBJ) {
+        JsonObject* obj = node.ptr;
+        JsonPair* pair = obj->head;
+        while (pair != NULL) {
+            JsonPair* next = pair->next;
+            if (obj->keys == NULL) mem_free((char*)pair->key);
+            if (pair->value != NULL) {
+                json_value_defer(pair->value, pending);
+                mem_free(pair->value);
+            }
+            mem_free(pair);
+            pair = next;
+        }
+        json_interner_release(obj->keys);
+        mem_free(obj->cache);
+        mem_free(obj);
+    } else {
+        JsonArray* arr = node.ptr;
+        for (size_t i = 0; i < arr->size; i++)
+            json_value_defer(arr->values + i, pending);
+        mem_free(arr->values);
+        mem_free(arr);
+    }
+}
+
+/* frees `root` and everything below it, without recursion */
+static void json_tree_free(JsonType type, void* root) {
+    JsonStack pending;
+    json_stack_init(&pending, sizeof(JsonNode));
+    JsonNode node = { type, root };
+    for (;;) {
+        json_node_free(node, &pending);
+        JsonNode* top = json_stack_top(&pending);
+        if (top == NULL) break;
+        node = *top;
+        json_stack_pop(&pending);
+    }
+    json_stack_free(&pending);
 }
 
 /* frees the data in `value` but not `value` itself */
@@ -80,7 +179,7 @@ static void json_value_free_inner(JsonValue* value) {
 
     switch (value->type) {
         case J_STR:
-            free(value->value.string);
+            mem_free(value->value.string);
             break;
         case J_ARR:
             json_array_free(value->value.arr);
@@ -91,6 +190,8 @@ static void json_value_free_inner(JsonValue* value) {
         case J_VEC:
             vec_free(value->value.vec);
             break;
+        case J_NUM:
+            break;
     }
 }
 
@@ -98,39 +199,32 @@ static void json_value_free_inner(JsonValue* value) {
 static void json_value_free(JsonValue* value) {
     if (value == NULL) return;
     json_value_free_inner(value);
-    free(value);
-}
-
-static void json_pair_free(JsonPair* head) {
-    if (head == NULL) return;
-    if (head->key != NULL)   free(head->key);
-    if (head->value != NULL) json_value_free(head->value);
-    json_pair_free(head->next);
-    free(head);
-}
-
-static char* json_value_str(JsonValue* value) {
-    if (value == NULL) return strdup_local("NULL");
-    switch (value->type) {
-        case J_STR:
-            return strdup_local(value->value.string);
-            break;
-        case J_ARR:
-            return json_array_str(value->value.arr);
-            break;
-        case J_OBJ:
-            return json_dumps(value->value.obj);
-            break;
-        default:    // J_VEC
-            return vec_to_str(value->value.vec);
-            break;
-    }
+    mem_free(value);
 }
 
 JsonObject* json_init() {
-    JsonObject* obj = malloc(sizeof(JsonObject));
+    JsonObject* obj = mem_malloc(sizeof(JsonObject), MEM_JSON);
     if (obj) {
         obj->head = NULL;
+        obj->keys = NULL;
+        obj->parent = NULL;
+        obj->cache = NULL;
+        obj->cache_len = 0;
+        obj->dirty = true;
+    }
+    return obj;
+}
+
+/* like json_init, but keys are interned in `keys`, which may be shared with
+ * other documents. a NULL `keys` gives the object a table of its own */
+JsonObject* json_init_interned(JsonInterner* keys) {
+    JsonObject* obj = json_init();
+    if (obj == NULL) return NULL;
+    obj->keys = keys ? json_interner_retain(keys)
+                     : json_interner_init(false);
+    if (obj->keys == NULL) {
+        mem_free(obj);
+        return NULL;
     }
     return obj;
 }
@@ -138,8 +232,11 @@ JsonObject* json_init() {
 /* frees the given object, including all nested objects */
 void json_free(JsonObject* obj) {
     if (obj == NULL) return;
-    if (obj->head != NULL) json_pair_free(obj->head);
-    free(obj);
+    json_tree_free(J_OBJ, obj);
+}
+
+static void json_key_free(JsonObject* obj, const char* key) {
+    if (obj->keys == NULL) mem_free((char*)key);
 }
 
 static JsonPair* json_pair_get_tail(JsonPair* pair) {
@@ -148,38 +245,147 @@ static JsonPair* json_pair_get_tail(JsonPair* pair) {
     return tail;
 }
 
-void json_object_add_pair(JsonObject* obj, JsonPair* pair) {
-    if (obj->head == NULL) {
-        obj->head = pair;
-    } else {
-        JsonPair* tail = json_pair_get_tail(obj->head);
-        tail->next = pair;
+/* marks `obj` and its enclosing objects as changed, dropping their cached
+ * serializations. call it after changing a Vec owned by `obj` in place */
+void json_mark_dirty(JsonObject* obj) {
+    for (bool first = true; obj != NULL; obj = obj->parent, first = false) {
+        // enclosing objects of a dirty object are always dirty already
+        if (obj->dirty && !first) break;
+        obj->dirty = true;
+        mem_free(obj->cache);
+        obj->cache = NULL;
+        obj->cache_len = 0;
+    }
+}
+
+static bool json_key_eq(const JsonObject* obj, const char* key,
+                        const char* k) {
+    return (obj->keys != NULL) ? key == k : strcmp(key, k) == 0;
+}
+
+/* whether `a` and `b` hold the very same string / vec / array / object */
+static bool json_value_same(const JsonValue* a, const JsonValue* b) {
+    if (a->type != b->type) return false;
+    switch (a->type) {
+        case J_STR: return a->value.string == b->value.string;
+        case J_ARR: return a->value.arr == b->value.arr;
+        case J_OBJ: return a->value.obj == b->value.obj;
+        case J_NUM: return false;   // nothing shared, just replace it
+        default:    return a->value.vec == b->value.vec;
+    }
+}
+
+/* whether `value`, or one of its elements if it is an array, is `old` */
+static bool json_value_uses(const JsonValue* value, const JsonValue* old) {
+    if (json_value_same(value, old)) return true;
+    if (value->type != J_ARR) return false;
+    const JsonArray* arr = value->value.arr;
+    for (size_t i = 0; i < arr->size; i++)
+        if (json_value_same(arr->values + i, old)) return true;
+    return false;
+}
+
+/* frees `old`, which `value` replaces, except for the parts `value` reuses */
+static void json_value_replace(JsonValue* old, const JsonValue* value) {
+    if (old == NULL) return;
+    if (json_value_uses(value, old)) {
+        mem_free(old);
+        return;
+    }
+    if (old->type == J_ARR) {
+        JsonArray* arr = old->value.arr;
+        for (size_t i = 0; i < arr->size; i++)
+            if (!json_value_uses(value, arr->values + i))
+                json_value_free_inner(arr->values + i);
+        mem_free(arr->values);
+        mem_free(arr);
+        mem_free(old);
+        return;
+    }
+    json_value_free(old);
+}
+
+/* sets `k` to `value`, replacing (and freeing) the previous value if `k` is
+ * already present, and appending a new pair otherwise. takes `value` */
+static void json_object_put(JsonObject* obj, const char* k, JsonValue* value) {
+    if (value->type == J_OBJ) value->value.obj->parent = obj;
+    if (value->type == J_ARR) {
+        JsonArray* arr = value->value.arr;
+        for (size_t i = 0; i < arr->size; i++)
+            if (arr->values[i].type == J_OBJ)
+                arr->values[i].value.obj->parent = obj;
+    }
+    json_mark_dirty(obj);
+
+    // copied only if the key turns out to be new, interned up front
+    const char* key = (obj->keys != NULL)
+                    ? json_intern(obj->keys, k, strlen(k)) : k;
+    if (key == NULL) {
+        fprintf(stderr, "intern key failed!");
+        json_value_free(value);
+        return;
+    }
+    JsonPair* last = NULL;
+    for (JsonPair* pair = obj->head; pair != NULL; pair = pair->next) {
+        if (json_key_eq(obj, pair->key, key)) {
+            json_value_replace(pair->value, value);
+            pair->value = value;
+            return;
+        }
+        last = pair;
     }
+
+    JsonPair* pair = mem_malloc(sizeof(JsonPair), MEM_JSON);
+    if (pair == NULL) {
+        fprintf(stderr, "malloc JsonPair failed!");
+        json_value_free(value);
+        return;
+    }
+    pair->key = (obj->keys != NULL) ? key : mem_strdup(k, MEM_JSON);
+    if (pair->key == NULL) {
+        fprintf(stderr, "malloc key failed!");
+        mem_free(pair);
+        json_value_free(value);
+        return;
+    }
+    pair->value = value;
     pair->next = NULL;
+    if (last == NULL) obj->head = pair;
+    else              last->next = pair;
+}
+
+static JsonValue* json_value_new(JsonType type) {
+    JsonValue* value = mem_malloc(sizeof(JsonValue), MEM_JSON);
+    if (value == NULL) {
+        fprintf(stderr, "malloc JsonValue failed!");
+        return NULL;
+    }
+    value->type = type;
+    return value;
 }
 
 JsonValue** json_values_from(JsonType type, void** list, size_t count) {
-    JsonValue** values = malloc(count * sizeof(JsonValue*));
+    JsonValue** values = mem_malloc(count * sizeof(JsonValue*), MEM_JSON);
     if (!values) {
         fprintf(stderr, "malloc JsonValue** in json_values_from failed\n");
         return NULL;
     }
 
     for (size_t i = 0; i < count; i++) {
-        values[i] = malloc(sizeof(JsonValue));
+        values[i] = mem_malloc(sizeof(JsonValue), MEM_JSON);
         if (!values[i]) {
             fprintf(stderr, "malloc JsonValue in json_values_from failed\n");
             for (size_t j = 0; j < i; j++) {
-                free(values[j]);
+                mem_free(values[j]);
             }
-            free(values);
+            mem_free(values);
             return NULL;
         }
 
         values[i]->type = type;
         switch (type) {
             case J_STR:
-                values[i]->value.string = strdup_local((char*)list[i]);
+                values[i]->value.string = mem_strdup((char*)list[i], MEM_JSON);
                 break;
             case J_OBJ:
                 values[i]->value.obj = (JsonObject*)list[i];
@@ -205,74 +411,65 @@ void json_set_arr(JsonObject* obj, const char* k, JsonType type,
     for (size_t i = 0; i < n; i++) {
         // arr->values[i] = *values[i];
         json_array_append(arr, values[i]);
-        free(values[i]);    // take ownership
+        mem_free(values[i]);    // take ownership
     }
     
-    JsonValue* arr_value = malloc(sizeof(JsonValue));
+    JsonValue* arr_value = json_value_new(J_ARR);
     if (arr_value == NULL) {
-        fprintf(stderr, "malloc JsonValue failed!");
         json_array_free(arr);
         return;
     }
-    arr_value->type = J_ARR;
     arr_value->value.arr = arr;
+    json_object_put(obj, k, arr_value);
 
-    JsonPair* pair = malloc(sizeof(JsonPair));
-    if (pair == NULL) {
-        fprintf(stderr, "malloc JsonPair failed!");
-        json_value_free(arr_value);
-        return;
-    }
-    pair->key = strdup_local(k);
-    pair->value = arr_value;
-    pair->next = NULL;
-    json_object_add_pair(obj, pair);
-
-    free(values);
+    mem_free(values);
 }
 
-// copies the key and the value into the json object as a pair
+// copies the key and the value into the json object, replacing any
+// previous value of the key
 void json_set_str(JsonObject* obj, const char* k, const char* v) {
-    JsonValue* value = malloc(sizeof(JsonValue));
-    value->type = J_STR;
-    value->value.string = strdup_local(v);
-
-    JsonPair* pair = malloc(sizeof(JsonPair));
-    pair->key = strdup_local(k);
-    pair->value = value;
-    pair->next = NULL;
-
-    json_object_add_pair(obj, pair);
+    JsonValue* value = json_value_new(J_STR);
+    if (value == NULL) return;
+    value->value.string = mem_strdup(v, MEM_JSON);
+    json_object_put(obj, k, value);
 }
 
+// the json object takes ownership of `v`
 void json_set_obj(JsonObject* obj, const char* k, JsonObject* v) {
-    JsonValue* value = malloc(sizeof(JsonValue));
-    value->type = J_OBJ;
+    JsonValue* value = json_value_new(J_OBJ);
+    if (value == NULL) return;
     value->value.obj = v;
-
-    JsonPair* pair = malloc(sizeof(JsonPair));
-    pair->key = strdup_local(k);
-    pair->value = value;
-    pair->next = NULL;
-
-    json_object_add_pair(obj, pair);
+    json_object_put(obj, k, value);
 }
 
+// the json object takes ownership of `v`
 void json_set_vec(JsonObject* obj, const char* k, Vec* v) {
-    JsonValue* value = malloc(sizeof(JsonValue));
-    value->type = J_VEC;
+    JsonValue* value = json_value_new(J_VEC);
+    if (value == NULL) return;
     value->value.vec = v;
-    JsonPair* pair = malloc(sizeof(JsonPair));
-    pair->key = strdup_local(k);
-    pair->value = value;
-    pair->next = NULL;
+    json_object_put(obj, k, value);
+}
 
-    json_object_add_pair(obj, pair);
+// replaces any previous value of the key
+void json_set_num(JsonObject* obj, const char* k, double v) {
+    JsonValue* value = json_value_new(J_NUM);
+    if (value == NULL) return;
+    value->value.number = v;
+    json_object_put(obj, k, value);
 }
 
 JsonValue* json_get(const JsonObject* obj, const char* k) {
     if (obj == NULL || obj->head == NULL) return NULL;
     JsonPair* current = obj->head;
+    if (obj->keys != NULL) {
+        // interned keys are equal iff their pointers are
+        const char* key = json_interner_find(obj->keys, k, strlen(k));
+        while (key != NULL && current != NULL) {
+            if (current->key == key) return current->value;
+            current = current->next;
+        }
+        return NULL;
+    }
     while(current != NULL) {
         if (strcmp(current->key, k) == 0) return current->value;
         current = current->next;
@@ -303,88 +500,377 @@ bool json_get_vec(const JsonObject* obj, const char* k, Vec** out) {
     return true;
 }
 
-char* json_dumps(JsonObject* obj) {
-    String* s = string_from("{");
-    JsonPair* pair = obj->head;
-    int count = 0;
-    while (pair != NULL) {
-        if (count != 0) string_append(s, ", ");
-        string_append(s, "\"");
-        string_append(s, pair->key);
-        string_append(s, "\": ");
-
-        char* value_str = json_value_str(pair->value);
-        if (pair->value != NULL && pair->value->type == J_STR) {
-            string_append(s, "\"");
-            string_append(s, value_str);
-            string_append(s, "\"");
-        } else {
-            string_append(s, value_str);
+/* copies the number into `out` if the key holds a J_NUM */
+bool json_get_num(const JsonObject* obj, const char* k, double* out) {
+    JsonValue* val = json_get_typecheck(obj, k, J_NUM);
+    if (val == NULL) return false;
+    *out = val->value.number;
+    return true;
+}
+
+/* shortest of %.15g / %.17g that reads back exactly; json has no inf or
+ * nan, so those are written as null */
+static void json_write_number(String* out, double x) {
+    char buffer[32];
+    if (isnan(x) || isinf(x)) {
+        string_append(out, "null");
+        return;
+    }
+    int len = snprintf(buffer, sizeof(buffer), "%.15g", x);
+    if (strtod(buffer, NULL) != x)
+        len = snprintf(buffer, sizeof(buffer), "%.17g", x);
+    string_append_n(out, buffer, (size_t)len);
+}
+
+/* objects serializing to fewer bytes are cheaper to rewrite than cache */
+#define JSON_CACHE_MIN_BYTES 64
+
+/* a container being written, and how far along it is */
+typedef struct {
+    JsonType type;      // J_OBJ or J_ARR
+    void* ptr;
+    JsonPair* pair;     // J_OBJ: next pair to write
+    size_t index;       // J_ARR: next value to write
+    size_t start;       // J_OBJ: offset of its '{' in the output
+} JsonDumpFrame;
+
+/* writes a leaf or a clean cached object, or opens a container and pushes
+ * it onto `stack` */
+static bool json_write_value(String* out, JsonValue* value,
+                             JsonStack* stack, bool cached) {
+    if (value == NULL) {
+        string_append(out, "NULL");
+        return true;
+    }
+    switch (value->type) {
+        case J_STR:
+            string_append(out, "\"");
+            string_append(out, value->value.string);
+            string_append(out, "\"");
+            return true;
+        case J_VEC:
+            vec_write(value->value.vec, out);
+            return true;
+        case J_NUM:
+            json_write_number(out, value->value.number);
+            return true;
+        default: {  // J_OBJ, J_ARR
+            JsonObject* obj = value->value.obj;
+            if (cached && value->type == J_OBJ && !obj->dirty
+                       && obj->cache != NULL) {
+                string_append_n(out, obj->cache, obj->cache_len);
+                return true;
+            }
+            JsonDumpFrame* frame = json_stack_push(stack);
+            if (frame == NULL) return false;
+            frame->type = value->type;
+            if (value->type == J_OBJ) {
+                frame->start = out->length;
+                string_append(out, "{");
+                frame->ptr = obj;
+                frame->pair = obj->head;
+            } else {
+                string_append(out, "[");
+                frame->ptr = value->value.arr;
+                frame->index = 0;
+            }
+            return true;
         }
-        free(value_str);
+    }
+}
+
+/* remembers the bytes `obj` just serialized to, and marks it clean */
+static void json_cache_store(JsonObject* obj, const String* out,
+                             size_t start) {
+    size_t len = out->length - start;
+    mem_free(obj->cache);
+    obj->cache = NULL;
+    obj->cache_len = 0;
+    if (len >= JSON_CACHE_MIN_BYTES) {
+        obj->cache = mem_malloc(len, MEM_JSON);
+        if (obj->cache == NULL) return;     // stays dirty
+        memcpy(obj->cache, out->data + start, len);
+        obj->cache_len = len;
+    }
+    obj->dirty = false;
+}
 
-        pair = pair->next;
-        count++;
+/* serializes `obj` onto the end of `out`, without recursion. when
+ * `cached`, clean objects are copied from their cache and every object
+ * written below the top-level root is cached */
+static bool json_write(String* out, JsonObject* obj, bool cached) {
+    JsonStack stack;
+    json_stack_init(&stack, sizeof(JsonDumpFrame));
+    JsonValue root = { .type = J_OBJ, .value.obj = obj };
+    bool ok = json_write_value(out, &root, &stack, cached);
+
+    JsonDumpFrame* frame;
+    while (ok && (frame = json_stack_top(&stack)) != NULL) {
+        JsonValue* value;
+        if (frame->type == J_OBJ) {
+            JsonPair* pair = frame->pair;
+            if (pair == NULL) {
+                string_append(out, "}");
+                // a top-level root's bytes are the result itself: caching
+                // them would copy the whole document on every call
+                bool top = frame->ptr == obj && obj->parent == NULL;
+                if (cached && !top)
+                    json_cache_store(frame->ptr, out, frame->start);
+                json_stack_pop(&stack);
+                continue;
+            }
+            if (pair != ((JsonObject*)frame->ptr)->head)
+                string_append(out, ", ");
+            string_append(out, "\"");
+            string_append(out, pair->key);
+            string_append(out, "\": ");
+            frame->pair = pair->next;
+            value = pair->value;
+        } else {
+            JsonArray* arr = frame->ptr;
+            if (frame->index == arr->size) {
+                string_append(out, "]");
+                json_stack_pop(&stack);
+                continue;
+            }
+            if (frame->index > 0) string_append(out, ", ");
+            value = arr->values + frame->index++;
+        }
+        ok = json_write_value(out, value, &stack, cached);
     }
-    string_append(s, "}");
-    char* out = string_to_chars(s);
-    string_free(s);
+    json_stack_free(&stack);
+    return ok;
+}
+
+static char* json_dumps_with(JsonObject* obj, bool cached, size_t* len) {
+    TRACE_BEGIN(TRACE_DUMP);
+    String s;
+    string_init(&s);
+    *len = 0;
+    char* out = json_write(&s, obj, cached) ? string_take(&s, len) : NULL;
+    string_deinit(&s);
+    TRACE_END(TRACE_DUMP, *len, 0);
     return out;
 }
 
-/* context for the json parser */
-typedef struct {
-    const char* data;
-    size_t loc;
+char* json_dumps(JsonObject* obj) {
     size_t len;
-} JsonSrc;
+    return json_dumps_with(obj, false, &len);
+}
 
-typedef enum {
-    SUCCESS = 0,
-    OOM = -1,
-    INVALID_JSON = -2,
-} ParserResultCode;
+/* like json_dumps, but objects unchanged since the last call are copied
+ * from a cache instead of being serialized again. costs memory for the
+ * cached bytes; mutating a Vec in place needs json_mark_dirty */
+char* json_dumps_cached(JsonObject* obj) {
+    size_t len;
+    return json_dumps_with(obj, true, &len);
+}
 
-static bool has_ch(JsonSrc* src) {
-    return src->loc <= src->len;
+/* file writes are made this many bytes at a time, from offsets that are
+ * multiples of it */
+#define JSON_DUMP_WRITE_BYTES (1 << 20)
+
+static bool json_write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        size_t chunk = (len < JSON_DUMP_WRITE_BYTES) ? len
+                                                      : JSON_DUMP_WRITE_BYTES;
+        ssize_t written = write(fd, data, chunk);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        len -= (size_t)written;
+    }
+    return true;
 }
 
-static char peek_ch(JsonSrc* src) {
-    return has_ch(src) ? src->data[src->loc] : '\0';
+/* flushes the directory entry of `filename`, so that a rename survives a
+ * crash. filesystems that can't fsync a directory are not an error */
+static void json_sync_dir(const char* filename) {
+    const char* slash = strrchr(filename, '/');
+    size_t len = (slash == NULL)     ? 0
+               : (slash == filename) ? 1
+               : (size_t)(slash - filename);
+    char* dir = mem_malloc(len + 2, MEM_JSON);
+    if (dir == NULL) return;
+    if (len == 0) strcpy(dir, ".");
+    else {
+        memcpy(dir, filename, len);
+        dir[len] = '\0';
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    mem_free(dir);
 }
 
-static char consume_ch(JsonSrc* src) {
-    return has_ch(src) ? src->data[src->loc++] : '\0';
+/* writes `obj` to `filename` so that the file is always either the old
+ * contents or all of the new ones: the text goes to `filename`.tmp, which
+ * is fsynced and then renamed over `filename`. false, with errno set and
+ * `filename` untouched, if anything fails. two dumps to the same file
+ * must not run at once */
+bool json_dump(JsonObject* obj, const char* filename) {
+    size_t len;
+    char* out = json_dumps_with(obj, false, &len);
+    size_t name_len = strlen(filename);
+    char* tmp = mem_malloc(name_len + sizeof(".tmp"), MEM_JSON);
+    if (out == NULL || tmp == NULL) {
+        mem_free(out);
+        mem_free(tmp);
+        errno = ENOMEM;
+        return false;
+    }
+    memcpy(tmp, filename, name_len);
+    memcpy(tmp + name_len, ".tmp", sizeof(".tmp"));
+
+    bool ok = false;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0) {
+        ok = json_write_all(fd, out, len) && fsync(fd) == 0;
+        ok = (close(fd) == 0) && ok;
+        ok = ok && rename(tmp, filename) == 0;
+        if (!ok) {
+            int err = errno;
+            remove(tmp);
+            errno = err;
+        }
+    }
+    if (ok) json_sync_dir(filename);
+    mem_free(tmp);
+    mem_free(out);
+    return ok;
 }
 
-static void consume_if_eq(JsonSrc* src, char ch) {
-    if (peek_ch(src) == ch) consume_ch(src);
+/* a container of the original, and its copy still to be filled in */
+typedef struct {
+    JsonType type;          // J_OBJ or J_ARR
+    const void* src;
+    void* dst;
+    JsonObject* owner;      // J_ARR: the copy's nearest enclosing object
+} JsonCloneFrame;
+
+/* copies a leaf of `src` into `dst`, or gives it an empty container and
+ * pushes that to be filled in. on failure `dst` is left holding nothing */
+static bool json_clone_value(JsonValue* dst, const JsonValue* src,
+                             JsonObject* owner, JsonStack* stack) {
+    dst->type = J_NUM;
+    switch (src->type) {
+        case J_STR:
+            dst->value.string = mem_strdup(src->value.string, MEM_JSON);
+            if (dst->value.string == NULL) return false;
+            break;
+        case J_VEC: {
+            const Vec* v = src->value.vec;
+            Vec* copy = vec_init(v->dim);
+            if (copy == NULL) return false;
+            if (copy->data == NULL && v->dim > 0) {
+                vec_free(copy);
+                return false;
+            }
+            if (v->dim > 0) memcpy(copy->data, v->data, v->dim * sizeof(float));
+            dst->value.vec = copy;
+            break;
+        }
+        case J_NUM:
+            dst->value.number = src->value.number;
+            break;
+        default: {  // J_OBJ, J_ARR
+            JsonCloneFrame* frame = json_stack_push(stack);
+            if (frame == NULL) return false;
+            frame->type = src->type;
+            frame->owner = owner;
+            if (src->type == J_OBJ) {
+                JsonObject* obj = json_init();
+                if (obj != NULL) obj->parent = owner;
+                frame->src = src->value.obj;
+                frame->dst = dst->value.obj = obj;
+            } else {
+                const JsonArray* arr = src->value.arr;
+                frame->src = arr;
+                frame->dst = dst->value.arr =
+                    json_array_init(arr->size ? arr->size : 1);
+            }
+            if (frame->dst == NULL) {
+                json_stack_pop(stack);
+                return false;
+            }
+            break;
+        }
+    }
+    dst->type = src->type;
+    return true;
 }
 
-static bool next_isnt(char ch, JsonSrc* src) {
-    return peek_ch(src) != ch;
+/* copies the pairs of `src` into the empty object `dst` */
+static bool json_clone_pairs(JsonObject* dst, const JsonObject* src,
+                             JsonStack* stack) {
+    JsonPair** tail = &dst->head;
+    for (const JsonPair* pair = src->head; pair != NULL; pair = pair->next) {
+        JsonPair* copy = mem_malloc(sizeof(JsonPair), MEM_JSON);
+        if (copy == NULL) return false;
+        copy->key = mem_strdup(pair->key, MEM_JSON);
+        copy->value = NULL;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+        if (copy->key == NULL) return false;
+        if (pair->value == NULL) continue;
+        copy->value = json_value_new(J_NUM);
+        if (copy->value == NULL
+            || !json_clone_value(copy->value, pair->value, dst, stack))
+            return false;
+    }
+    return true;
 }
 
-static void skip_whitespace(JsonSrc* src) {
-    while (isspace(peek_ch(src))) consume_ch(src);
+/* copies the values of `src` into the empty array `dst` */
+static bool json_clone_values(JsonArray* dst, const JsonArray* src,
+                              JsonObject* owner, JsonStack* stack) {
+    for (size_t i = 0; i < src->size; i++) {
+        if (!json_clone_value(dst->values + i, src->values + i, owner,
+                              stack))
+            return false;
+        dst->size++;
+    }
+    return true;
 }
 
-static size_t count_ch_until(JsonSrc* src, char to_count, char stop) {
-    size_t count = 0, loc = src->loc;
-    char cur_ch;
-    while (loc <= src->len && (cur_ch = *(src->data + loc++)) != stop)
-        count += (cur_ch == to_count) ? 1 : 0;
-    return count;
+/* a deep copy of `obj`: its strings, Vecs and nested containers are all
+ * copied, and its keys too, so the copy shares nothing with `obj` (it
+ * doesn't intern its keys). NULL if an allocation fails */
+JsonObject* json_clone(const JsonObject* obj) {
+    if (obj == NULL) return NULL;
+    JsonObject* root = json_init();
+    if (root == NULL) return NULL;
+    JsonStack stack;
+    json_stack_init(&stack, sizeof(JsonCloneFrame));
+    JsonCloneFrame frame = { J_OBJ, obj, root, NULL };
+    bool ok = true;
+    for (;;) {
+        ok = (frame.type == J_OBJ)
+           ? json_clone_pairs(frame.dst, frame.src, &stack)
+           : json_clone_values(frame.dst, frame.src, frame.owner, &stack);
+        JsonCloneFrame* top = json_stack_top(&stack);
+        if (!ok || top == NULL) break;
+        frame = *top;
+        json_stack_pop(&stack);
+    }
+    json_stack_free(&stack);
+    if (!ok) {
+        json_free(root);
+        return NULL;
+    }
+    return root;
 }
 
-int parse_string_into(JsonSrc* src, char** dst) {
+int scan_string(JsonSrc* src, size_t* start, size_t* len) {
     // TAKE '"'
     skip_whitespace(src);
     if (next_isnt('"', src)) return INVALID_JSON;
     consume_ch(src);
 
     size_t start_loc = src->loc;
-    size_t len = 0;
     bool escaped = false;
 
     while (has_ch(src)) {
@@ -394,58 +880,102 @@ int parse_string_into(JsonSrc* src, char** dst) {
         } else if (c == '\\') {
             escaped = true;
         } else if (c == '"') {
-            char* result = malloc(len + 1);
-            if (result == NULL) return OOM;
-            memcpy(result, src->data + start_loc, len);
-            result[len] = '\0';
-            *dst = result;
+            *start = start_loc;
+            *len = src->loc - 1 - start_loc;
             return SUCCESS;
         }
-        len++;
     }
     return INVALID_JSON;
 }
 
-static int json_value_parse(JsonValue* dst, JsonSrc* src);
+int parse_string_into(JsonSrc* src, char** dst) {
+    TRACE_BEGIN(TRACE_PARSE_STRING);
+    size_t start, len = 0;
+    int res = scan_string(src, &start, &len);
+    if (res == SUCCESS) {
+        char* result = mem_malloc(len + 1, MEM_JSON);
+        if (result != NULL) {
+            memcpy(result, src->data + start, len);
+            result[len] = '\0';
+            *dst = result;
+        } else {
+            res = OOM;
+        }
+    }
+    // failures are timed too, so malformed input shows up in the profile
+    TRACE_END(TRACE_PARSE_STRING, len, res == SUCCESS);
+    return res;
+}
 
-static int json_parse_object(JsonObject* dst, JsonSrc* src) {
-    // TAKE '{'
-    skip_whitespace(src);
-    if (next_isnt('{', src)) return INVALID_JSON;
-    consume_ch(src);
+int parse_floats_into(JsonSrc* src, float* dst, size_t cap, size_t* n) {
+    size_t index = 0;
+    while (next_isnt(']', src)) {
+        consume_if_eq(src, ',');
+        skip_whitespace(src);
+        if (index == cap) return INVALID_JSON;
+
+        const char* start = src->data + src->loc;
+        char* end;
+        TRACE_BEGIN(TRACE_STRTOF);
+        float value = strtof(start, &end);
+        TRACE_END(TRACE_STRTOF, end - start, 1);
+        if (start == end) return INVALID_JSON;
+        dst[index++] = value;
+        src->loc += (end - start);
 
-    skip_whitespace(src);
-    while (next_isnt('}', src)) {
-        // parse key
-        char* key;
-        int res = parse_string_into(src, &key);
-        if (res != SUCCESS) return res;
-        
-        // TAKE ':'
         skip_whitespace(src);
-        if (next_isnt(':', src)) return INVALID_JSON;
-        consume_ch(src);
+    }
 
-        // parse value
-        JsonValue* value = malloc(sizeof(JsonValue));
-        res = json_value_parse(value, src);
-        if (res != SUCCESS) return res;
+    consume_if_eq(src, ']');
+    *n = index;
+    return SUCCESS;
+}
 
-        // add kv pair
-        JsonPair* pair = malloc(sizeof(JsonPair));
-        pair->value = value;
-        pair->key = key;
-        pair->next = NULL;
-        json_object_add_pair(dst, pair);
+static bool is_literal_ch(char c) {
+    return isalnum(c) || c == '.' || c == '-' || c == '+';
+}
 
-        // consume till next key
+int skip_value(JsonSrc* src) {
+    size_t depth = 0;
+    do {
         skip_whitespace(src);
-        consume_if_eq(src, ',');
-        skip_whitespace(src);
-    }
+        if (peek_ch(src) == '\0') return INVALID_JSON;
+
+        char c = peek_ch(src);
+        if (c == '"') {
+            size_t start, len;
+            int res = scan_string(src, &start, &len);
+            if (res != SUCCESS) return res;
+        } else if (c == '[' || c == '{') {
+            consume_ch(src);
+            depth++;
+        } else if (c == ']' || c == '}') {
+            if (depth == 0) return INVALID_JSON;
+            consume_ch(src);
+            depth--;
+        } else if (c == ',' || c == ':') {
+            if (depth == 0) return INVALID_JSON;
+            consume_ch(src);
+        } else {
+            consume_ch(src);
+            while (is_literal_ch(peek_ch(src))) consume_ch(src);
+        }
+    } while (depth > 0);
     return SUCCESS;
 }
 
+
+/* copies the next key, or interns it if `obj` interns its keys */
+static int json_parse_key(JsonObject* obj, JsonSrc* src, const char** dst) {
+    if (obj->keys == NULL) return parse_string_into(src, (char**)dst);
+
+    size_t start, len;
+    int res = scan_string(src, &start, &len);
+    if (res != SUCCESS) return res;
+    *dst = json_intern(obj->keys, src->data + start, len);
+    return (*dst == NULL) ? OOM : SUCCESS;
+}
+
 static int parse_jv_str(JsonValue* dst, JsonSrc* src) {
     char* s;
     int result = parse_string_into(src, &s);
@@ -460,113 +990,209 @@ static int parse_jv_literal(JsonValue* dst, JsonSrc* src) {
     // this is not great but whatever
     skip_whitespace(src);
     size_t start_loc = src->loc;
-    size_t len = 0;
-    while (has_ch(src)) {
-        char c = consume_ch(src);
-        if (!isalnum(c) && c != '.') {
-            char* result = malloc(len + 1);
-            if (result == NULL) return OOM;
-            memcpy(result, src->data + start_loc, len);
-            result[len] = '\0';
-            dst->type = J_STR;
-            dst->value.string = result;
-            return SUCCESS;
-        }
-        len++;
-    }
-    return INVALID_JSON;
+    while (is_literal_ch(peek_ch(src))) consume_ch(src);
+
+    // the terminator belongs to the enclosing object / array
+    size_t len = src->loc - start_loc;
+    if (len == 0) return INVALID_JSON;
+    char* result = mem_malloc(len + 1, MEM_JSON);
+    if (result == NULL) return OOM;
+    memcpy(result, src->data + start_loc, len);
+    result[len] = '\0';
+    dst->type = J_STR;
+    dst->value.string = result;
+    return SUCCESS;
 }
 
 static int parse_jv_vec(JsonValue* dst, JsonSrc* src) {
     // NOTE: assumes src->loc points at a numeric digit
     // ... ie whitespace has already been cleared by caller
-    
+    TRACE_BEGIN(TRACE_PARSE_VEC);
+    size_t start_loc = src->loc;
     size_t vec_len = count_ch_until(src, ',', ']') + 1;
     Vec* vec = vec_init(vec_len);
-    if (vec == NULL) return OOM;
+    size_t n = 0;
+    int res = (vec != NULL) ? parse_floats_into(src, vec->data, vec_len, &n)
+                            : OOM;
+    if (res == SUCCESS) {
+        dst->type = J_VEC;
+        dst->value.vec = vec;
+    } else {
+        vec_free(vec);
+        n = 0;
+    }
+    TRACE_END(TRACE_PARSE_VEC, src->loc - start_loc, n);
+    return res;
+}
 
-    size_t index = 0;
-    while (next_isnt(']', src) && index < vec_len) {
-        consume_if_eq(src, ',');
-        skip_whitespace(src);
-        
-        const char* start = src->data + src->loc;
-        char* end;
-        float value = strtof(start, &end);
-        if (start == end) {
-            vec_free(vec);
-            return INVALID_JSON;
+/* a container being filled in by the parser */
+typedef struct {
+    JsonType type;          // J_OBJ or J_ARR
+    void* ptr;
+    JsonPair* tail;         // J_OBJ: last pair, for O(1) appends
+    JsonObject* owner;      // the object itself, or the one enclosing an array
+} JsonParseFrame;
+
+/* parses a leaf into `dst`, or opens an empty container in it */
+static int json_value_open(JsonValue* dst, JsonSrc* src, JsonInterner* keys) {
+    skip_whitespace(src);
+    switch (peek_ch(src)) {
+        case '"':
+            return parse_jv_str(dst, src);
+        case '{': {
+            consume_ch(src);
+            JsonObject* obj = keys ? json_init_interned(keys) : json_init();
+            if (obj == NULL) return OOM;
+            dst->type = J_OBJ;
+            dst->value.obj = obj;
+            return SUCCESS;
         }
-        vec->data[index++] = value;
-        src->loc += (end - start);
-
-        skip_whitespace(src);
+        case '[': {
+            consume_ch(src);
+            // if it's a flat array and first digit is numeric:
+            // ... try parse as vec
+            skip_whitespace(src);
+            char c = peek_ch(src);
+            if (isdigit(c) || c == '-') return parse_jv_vec(dst, src);
+
+            // otherwise, parse into an array
+            JsonArray* arr = json_array_init(16);
+            if (arr == NULL) return OOM;
+            dst->type = J_ARR;
+            dst->value.arr = arr;
+            return SUCCESS;
+        }
+        case '\0':
+            return INVALID_JSON;
+        default:
+            return parse_jv_literal(dst, src);
     }
+}
 
-    consume_if_eq(src, ']');
-    dst->type = J_VEC;
-    dst->value.vec = vec;
-    return SUCCESS;
+/* appends `value` (and `key`, for objects) to the container in `frame` */
+static bool json_frame_add(JsonParseFrame* frame, const char* key,
+                           JsonValue* value) {
+    if (frame->type == J_ARR) return json_array_append(frame->ptr, value);
+
+    JsonObject* obj = frame->ptr;
+    JsonPair* pair = mem_malloc(sizeof(JsonPair), MEM_JSON);
+    if (pair == NULL) return false;
+    pair->value = mem_malloc(sizeof(JsonValue), MEM_JSON);
+    if (pair->value == NULL) {
+        mem_free(pair);
+        return false;
+    }
+    *pair->value = *value;
+    pair->key = key;
+    pair->next = NULL;
+    if (frame->tail == NULL) obj->head = pair;
+    else                     frame->tail->next = pair;
+    frame->tail = pair;
+    return true;
 }
 
-static int parse_jv_arr(JsonValue* dst, JsonSrc* src) {
-    // TAKE '['
+/* parses the next member of the container on top of `stack`: either its
+ * closing bracket, or one value, which is pushed if it is a container */
+static int json_parse_step(JsonStack* stack, JsonSrc* src, size_t max_depth) {
+    JsonParseFrame* frame = json_stack_top(stack);
+
+    // kill off preceeding comma and whitespace
     skip_whitespace(src);
-    if (next_isnt('[', src)) return INVALID_JSON;
-    consume_ch(src);
-   
-    // if it's a flat array and first digit is numeric:
-    // ... try parse as vec
+    consume_if_eq(src, ',');
     skip_whitespace(src);
-    if (isdigit(peek_ch(src))) return parse_jv_vec(dst, src);
-
-    // otherwise, parse into an array
-    JsonArray* arr = json_array_init(16);
-    while (next_isnt(']', src)) {
-        // kill off preceeding comma and whitespace
-        consume_if_eq(src, ',');
-        skip_whitespace(src);
+    if (peek_ch(src) == ((frame->type == J_OBJ) ? '}' : ']')) {
+        consume_ch(src);
+        json_stack_pop(stack);
+        return SUCCESS;
+    }
 
-        // parse the immediate value and append
-        JsonValue* value = malloc(sizeof(JsonValue));
-        int res = json_value_parse(value, src);
-        if (res != SUCCESS) return INVALID_JSON;
-        json_array_append(arr, value);
-        free(value); // array takes ownership
+    // parse key
+    const char* key = NULL;
+    JsonObject* obj = frame->owner;
+    if (frame->type == J_OBJ) {
+        int res = json_parse_key(obj, src, &key);
+        if (res != SUCCESS) return res;
 
+        // TAKE ':'
         skip_whitespace(src);
+        if (next_isnt(':', src)) {
+            json_key_free(obj, key);
+            return INVALID_JSON;
+        }
+        consume_ch(src);
+    }
+
+    // parse value and add it; containers are filled in by later steps
+    JsonValue value;
+    int res = json_value_open(&value, src, frame->owner->keys);
+    if (res != SUCCESS) {
+        if (key != NULL) json_key_free(obj, key);
+        return res;
+    }
+    if (!json_frame_add(frame, key, &value)) {
+        if (key != NULL) json_key_free(obj, key);
+        json_value_free_inner(&value);
+        return OOM;
+    }
+    if (value.type != J_OBJ && value.type != J_ARR) return SUCCESS;
+
+    if (stack->size >= max_depth) return DEPTH_EXCEEDED;
+    JsonObject* owner = frame->owner;
+    JsonParseFrame* child = json_stack_push(stack);
+    if (child == NULL) return OOM;
+    child->type = value.type;
+    child->tail = NULL;
+    if (value.type == J_OBJ) {
+        value.value.obj->parent = owner;
+        child->ptr = value.value.obj;
+        child->owner = value.value.obj;
+    } else {
+        child->ptr = value.value.arr;
+        child->owner = owner;
     }
-    consume_if_eq(src, ']');
-    dst->type = J_ARR;
-    dst->value.arr = arr;
-    
     return SUCCESS;
 }
 
-/* dst should be allocated*/
-static int json_value_parse(JsonValue* dst, JsonSrc* src) {
+/* the body of json_parse_depth, reading from `src` */
+static int json_parse_root(JsonObject* obj, JsonSrc* src, size_t max_depth) {
+    // TAKE '{'
     skip_whitespace(src);
-    if (!has_ch(src)) return INVALID_JSON;
+    if (next_isnt('{', src)) return INVALID_JSON;
+    consume_ch(src);
+    if (max_depth == 0) return DEPTH_EXCEEDED;
+
+    JsonStack stack;
+    json_stack_init(&stack, sizeof(JsonParseFrame));
+    JsonParseFrame* root = json_stack_push(&stack);
+    if (root == NULL) return OOM;
+    root->type = J_OBJ;
+    root->ptr = obj;
+    root->tail = obj->head ? json_pair_get_tail(obj->head) : NULL;
+    root->owner = obj;
+    json_mark_dirty(obj);
+
+    int res = SUCCESS;
+    while (res == SUCCESS && stack.size > 0)
+        res = json_parse_step(&stack, src, max_depth);
+    json_stack_free(&stack);
+    return res;
+}
 
-    int result;
-    switch(peek_ch(src)) {
-        case '"':   
-            result = parse_jv_str(dst, src);
-            break;
-        case '[':   // parses as Vec on non-nested numeric data
-            result = parse_jv_arr(dst, src);
-            break;
-        default:
-            result = parse_jv_literal(dst, src);
-            break;
-    }
-    return result;
+/* parses `str` into `obj`, allowing at most `max_depth` nested objects and
+ * arrays (counting `obj` itself). returns 0 on success; on failure `obj`
+ * keeps whatever was parsed before the error */
+int json_parse_depth(JsonObject* obj, const char* str, size_t max_depth) {
+    TRACE_BEGIN(TRACE_PARSE);
+    JsonSrc src = { str, 0, strlen(str) };
+    int res = json_parse_root(obj, &src, max_depth);
+    // rejected input is timed too, as far as it was read
+    TRACE_END(TRACE_PARSE, src.loc, 0);
+    return res;
 }
 
 // parse a char* `src` into a JsonObject* `obj` if possible
 int json_parse(JsonObject* obj, const char* str) {
-    JsonSrc src = { str, 0, strlen(str) };
-    return json_parse_object(obj, &src);
+    return json_parse_depth(obj, str, JSON_DEFAULT_MAX_DEPTH);
 }
 
 
@@ -581,7 +1207,7 @@ char* read_file_to_str(const char* filename) {
     size_t file_size = ftell(file);
     fseek(file, 0, SEEK_SET);
 
-    char *content = malloc(file_size + 1);
+    char *content = mem_malloc(file_size + 1, MEM_JSON);
     if (content == NULL) {
         perror("Memory allocation failed!");
         fclose(file);
@@ -591,7 +1217,7 @@ char* read_file_to_str(const char* filename) {
     size_t read_size = fread(content, 1, file_size, file);
     if (read_size != file_size) {
         perror("Error reading file");
-        free(content);
+        mem_free(content);
         fclose(file);
         return NULL;
     }
@@ -4,12 +4,15 @@
 #include <stdlib.h>  // size_t
 #include <stdbool.h> // bool
 #include "tensor.h"  // Vec related
+#include "json_intern.h" // JsonInterner
 
 typedef enum {
     J_OBJ,      // a (linked) list of key value pairs
     J_ARR,      // a (possibly nested) list of string values or objects
     J_STR,      // every non-obj/arr/vec json value is a string
     J_VEC,      // a 1-d vector of real numbers
+    J_NUM,      // a real number; only set by json_set_num, the parser
+                // still reads literals as J_STR
 } JsonType;
 
 typedef struct JsonArray JsonArray;
@@ -24,6 +27,7 @@ typedef struct {
         JsonArray* arr;
         JsonObject* obj;
         Vec* vec;
+        double number;
     } value;
 } JsonValue;
 
@@ -36,31 +40,45 @@ struct JsonArray {
 
 // 24 bytes
 struct JsonPair {
-    char* key;
+    const char* key;    // owned, or interned if the object has `keys`
     JsonValue* value;
     JsonPair* next;
 };
 
-// 8 bytes
+// 48 bytes
 struct JsonObject {
     JsonPair* head;
+    JsonInterner* keys; // NULL unless keys are interned
+    JsonObject* parent; // nearest enclosing object, NULL for the root
+    char* cache;        // serialized bytes from the last json_dumps_cached
+    size_t cache_len;
+    bool dirty;         // changed since it was last serialized
 };
 
 
 JsonObject* json_init();
+JsonObject* json_init_interned(JsonInterner* keys);
 void json_free(JsonObject* obj);
+JsonObject* json_clone(const JsonObject* obj);
+
+#define JSON_DEFAULT_MAX_DEPTH (1 << 20)
 
 int json_parse(JsonObject* obj, const char* str);
-void json_dump(JsonObject* obj, char* filename);
+int json_parse_depth(JsonObject* obj, const char* str, size_t max_depth);
+bool json_dump(JsonObject* obj, const char* filename);
 char* json_dumps(JsonObject* obj);
+char* json_dumps_cached(JsonObject* obj);
+void json_mark_dirty(JsonObject* obj);
 
 void json_set_vec(JsonObject* obj, const char* k, Vec* v);
 void json_set_str(JsonObject* obj, const char* k, const char* v);
 void json_set_obj(JsonObject* obj, const char* k, JsonObject* v);
+void json_set_num(JsonObject* obj, const char* k, double v);
 void json_set_arr(JsonObject* obj, const char* k, 
                   JsonType type, void** list, size_t n);
 
 bool json_get_str(const JsonObject* obj, const char* k, char** out);
 bool json_get_vec(const JsonObject* obj, const char* k, Vec** out);
+bool json_get_num(const JsonObject* obj, const char* k, double* out);
 
 #endif // JSON_H
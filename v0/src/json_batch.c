@@ -0,0 +1,305 @@
+#include "json_batch.h"
+#include "json_parser.h"
+#include "mem.h"
+#include "tensor.h"
+#include <string.h>         // memcpy, memcmp, memset
+
+#define DEFAULT_BATCH_CAPACITY 16
+
+/* grows the storage of `col` to hold `capacity` rows */
+static bool json_column_reserve(JsonColumn* col, size_t capacity) {
+    switch (col->type) {
+        case JSON_COL_F32:
+        case JSON_COL_VEC: {
+            if (col->vec == NULL) return true;  // width not known yet
+            float* data = mem_realloc(col->vec->data,
+                                      capacity * col->width * sizeof(float),
+                                      MEM_BATCH);
+            if (data == NULL) return false;
+            col->vec->data = data;
+            return true;
+        }
+        case JSON_COL_I64: {
+            int64_t* ints = mem_realloc(col->ints,
+                                        capacity * sizeof(int64_t), MEM_BATCH);
+            if (ints == NULL) return false;
+            col->ints = ints;
+            return true;
+        }
+        default: {  // JSON_COL_STR
+            size_t* offsets = mem_realloc(col->offsets,
+                                          (capacity + 1) * sizeof(size_t),
+                                          MEM_BATCH);
+            if (offsets == NULL) return false;
+            col->offsets = offsets;
+            return true;
+        }
+    }
+}
+
+static bool json_batch_reserve(JsonBatch* batch, size_t rows) {
+    if (batch->capacity >= rows) return true;  // ok, nothing to do
+    size_t new_capacity = batch->capacity;
+    while (new_capacity < rows) new_capacity *= 2;
+    for (size_t i = 0; i < batch->n_cols; i++)
+        if (!json_column_reserve(batch->cols + i, new_capacity)) return false;
+    batch->capacity = new_capacity;
+    return true;
+}
+
+static bool json_column_reserve_bytes(JsonColumn* col, size_t n) {
+    if (col->bytes_cap >= col->bytes_len + n) return true;
+    size_t new_cap = col->bytes_cap ? col->bytes_cap : 64;
+    while (new_cap < col->bytes_len + n) new_cap *= 2;
+    char* bytes = mem_realloc(col->bytes, new_cap, MEM_BATCH);
+    if (bytes == NULL) return false;
+    col->bytes = bytes;
+    col->bytes_cap = new_cap;
+    return true;
+}
+
+/* allocates a new batch with room for `capacity` rows, caller owns */
+JsonBatch* json_batch_init(const JsonColSpec* specs, size_t n_cols,
+                           size_t capacity) {
+    JsonBatch* batch = mem_calloc(1, sizeof(JsonBatch), MEM_BATCH);
+    if (batch == NULL) return NULL;
+    batch->cols = mem_calloc(n_cols, sizeof(JsonColumn), MEM_BATCH);
+    batch->seen = mem_calloc(n_cols ? n_cols : 1, sizeof(bool), MEM_BATCH);
+    if (batch->cols == NULL || batch->seen == NULL) {
+        json_batch_free(batch);
+        return NULL;
+    }
+    batch->n_cols = n_cols;
+    batch->capacity = capacity ? capacity : DEFAULT_BATCH_CAPACITY;
+
+    for (size_t i = 0; i < n_cols; i++) {
+        JsonColumn* col = batch->cols + i;
+        col->name = mem_strdup(specs[i].name, MEM_BATCH);
+        col->name_len = strlen(specs[i].name);
+        col->type = specs[i].type;
+        col->width = (col->type == JSON_COL_VEC) ? specs[i].width : 1;
+        if ((col->type == JSON_COL_F32 || col->type == JSON_COL_VEC)
+                && col->width > 0) {
+            col->vec = vec_init(0);
+            if (col->vec == NULL) {
+                json_batch_free(batch);
+                return NULL;
+            }
+        }
+        if (col->name == NULL
+                || !json_column_reserve(col, batch->capacity)) {
+            json_batch_free(batch);
+            return NULL;
+        }
+        if (col->type == JSON_COL_STR) col->offsets[0] = 0;
+    }
+    return batch;
+}
+
+/* frees the batch and all of its columns */
+void json_batch_free(JsonBatch* batch) {
+    if (batch == NULL) return;
+    for (size_t i = 0; batch->cols && i < batch->n_cols; i++) {
+        JsonColumn* col = batch->cols + i;
+        mem_free(col->name);
+        vec_free(col->vec);
+        mem_free(col->ints);
+        mem_free(col->offsets);
+        mem_free(col->bytes);
+    }
+    mem_free(batch->cols);
+    mem_free(batch->seen);
+    mem_free(batch);
+}
+
+/* returns the column called `name`, or NULL */
+JsonColumn* json_batch_col(const JsonBatch* batch, const char* name) {
+    for (size_t i = 0; i < batch->n_cols; i++)
+        if (strcmp(batch->cols[i].name, name) == 0) return batch->cols + i;
+    return NULL;
+}
+
+/* returns a pointer to the (not null-terminated) bytes of row `row` */
+const char* json_batch_str(const JsonColumn* col, size_t row, size_t* len) {
+    if (col->type != JSON_COL_STR) return NULL;
+    *len = col->offsets[row + 1] - col->offsets[row];
+    return col->bytes + col->offsets[row];
+}
+
+static size_t json_batch_find(const JsonBatch* batch,
+                              const char* key, size_t len) {
+    for (size_t i = 0; i < batch->n_cols; i++) {
+        const JsonColumn* col = batch->cols + i;
+        if (col->name_len == len && memcmp(col->name, key, len) == 0)
+            return i;
+    }
+    return batch->n_cols;
+}
+
+/* first row of a VEC column declared with width 0: size it from the data */
+static int json_column_infer_width(JsonColumn* col, JsonSrc* src,
+                                   size_t row, size_t capacity) {
+    skip_whitespace(src);
+    if (peek_ch(src) == ']') return INVALID_JSON;
+    col->width = count_ch_until(src, ',', ']') + 1;
+    col->vec = vec_init(capacity * col->width);
+    if (col->vec == NULL) return OOM;
+    // rows that were missing this field before are zero-filled
+    memset(col->vec->data, 0, row * col->width * sizeof(float));
+    col->vec->dim = row * col->width;
+    return SUCCESS;
+}
+
+static int json_column_parse(JsonColumn* col, JsonSrc* src,
+                             size_t row, size_t capacity) {
+    skip_whitespace(src);
+    const char* start = src->data + src->loc;
+    char* end;
+
+    switch (col->type) {
+        case JSON_COL_F32: {
+            float value = strtof(start, &end);
+            if (start == end) return INVALID_JSON;
+            col->vec->data[row] = value;
+            src->loc += (end - start);
+            return SUCCESS;
+        }
+        case JSON_COL_I64: {
+            long long value = strtoll(start, &end, 10);
+            if (start == end) return INVALID_JSON;
+            col->ints[row] = value;
+            src->loc += (end - start);
+            return SUCCESS;
+        }
+        case JSON_COL_STR: {
+            size_t str_start, len;
+            int res = scan_string(src, &str_start, &len);
+            if (res != SUCCESS) return res;
+            if (!json_column_reserve_bytes(col, len)) return OOM;
+            memcpy(col->bytes + col->bytes_len, src->data + str_start, len);
+            col->bytes_len += len;
+            return SUCCESS;
+        }
+        default: {  // JSON_COL_VEC
+            // TAKE '['
+            if (next_isnt('[', src)) return INVALID_JSON;
+            consume_ch(src);
+            if (col->vec == NULL) {
+                int res = json_column_infer_width(col, src, row, capacity);
+                if (res != SUCCESS) return res;
+            }
+            size_t n;
+            float* dst = col->vec->data + row * col->width;
+            int res = parse_floats_into(src, dst, col->width, &n);
+            if (res != SUCCESS) return res;
+            return (n == col->width) ? SUCCESS : INVALID_JSON;
+        }
+    }
+}
+
+/* fields missing from a record are zero / empty */
+static void json_column_fill_default(JsonColumn* col, size_t row) {
+    switch (col->type) {
+        case JSON_COL_F32:
+        case JSON_COL_VEC:
+            if (col->vec != NULL)
+                memset(col->vec->data + row * col->width, 0,
+                       col->width * sizeof(float));
+            break;
+        case JSON_COL_I64:
+            col->ints[row] = 0;
+            break;
+        case JSON_COL_STR:
+            break;
+    }
+}
+
+/* commits row `row` of every column, or rolls it back on failure */
+static void json_batch_finish_row(JsonBatch* batch, size_t row, bool ok) {
+    for (size_t i = 0; i < batch->n_cols; i++) {
+        JsonColumn* col = batch->cols + i;
+        if (col->type == JSON_COL_STR) {
+            if (ok) col->offsets[row + 1] = col->bytes_len;
+            else    col->bytes_len = col->offsets[row];
+        } else if (ok && col->vec != NULL) {
+            col->vec->dim = (row + 1) * col->width;
+        }
+    }
+    if (ok) batch->n_rows = row + 1;
+}
+
+static int json_batch_parse_fields(JsonBatch* batch, JsonSrc* src,
+                                   size_t row) {
+    // TAKE '{'
+    skip_whitespace(src);
+    if (next_isnt('{', src)) return INVALID_JSON;
+    consume_ch(src);
+
+    skip_whitespace(src);
+    while (next_isnt('}', src)) {
+        // parse key, without copying it
+        size_t start, len;
+        int res = scan_string(src, &start, &len);
+        if (res != SUCCESS) return res;
+
+        // TAKE ':'
+        skip_whitespace(src);
+        if (next_isnt(':', src)) return INVALID_JSON;
+        consume_ch(src);
+
+        // parse value straight into its column, or skip unknown keys
+        size_t i = json_batch_find(batch, src->data + start, len);
+        if (i == batch->n_cols || batch->seen[i]) {
+            res = skip_value(src);
+        } else {
+            res = json_column_parse(batch->cols + i, src,
+                                    row, batch->capacity);
+            batch->seen[i] = true;
+        }
+        if (res != SUCCESS) return res;
+
+        // consume till next key
+        skip_whitespace(src);
+        consume_if_eq(src, ',');
+        skip_whitespace(src);
+        if (peek_ch(src) == '\0') return INVALID_JSON;
+    }
+    consume_ch(src);
+
+    for (size_t i = 0; i < batch->n_cols; i++)
+        if (!batch->seen[i]) json_column_fill_default(batch->cols + i, row);
+    return SUCCESS;
+}
+
+static int json_batch_parse_record(JsonBatch* batch, JsonSrc* src) {
+    if (!json_batch_reserve(batch, batch->n_rows + 1)) return OOM;
+    size_t row = batch->n_rows;
+    memset(batch->seen, 0, batch->n_cols * sizeof(bool));
+
+    int res = json_batch_parse_fields(batch, src, row);
+    json_batch_finish_row(batch, row, res == SUCCESS);
+    return res;
+}
+
+/* appends every record of the json array `str` to the batch. records that
+ * parsed before an error are kept; returns 0 on success */
+int json_batch_parse(JsonBatch* batch, const char* str) {
+    JsonSrc src = { str, 0, strlen(str) };
+
+    // TAKE '['
+    skip_whitespace(&src);
+    if (next_isnt('[', &src)) return INVALID_JSON;
+    consume_ch(&src);
+
+    skip_whitespace(&src);
+    while (next_isnt(']', &src)) {
+        if (peek_ch(&src) == '\0') return INVALID_JSON;
+        int res = json_batch_parse_record(batch, &src);
+        if (res != SUCCESS) return res;
+
+        skip_whitespace(&src);
+        consume_if_eq(&src, ',');
+        skip_whitespace(&src);
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,57 @@
+#ifndef JSON_BATCH_H
+#define JSON_BATCH_H
+
+#include <stdlib.h>  // size_t
+#include <stdint.h>  // int64_t
+#include <stdbool.h> // bool
+#include "tensor.h"  // Vec related
+
+/* columnar decoding of arrays of same-shaped records, eg:
+ *   [{"id": 1, "label": "cat", "emb": [0.1, 0.2]}, ...]
+ * each field is written straight into a preallocated column,
+ * no JsonObject is built per record */
+
+typedef enum {
+    JSON_COL_F32,   // numeric literal -> one float per row
+    JSON_COL_I64,   // integer literal -> one int64_t per row
+    JSON_COL_STR,   // string -> offsets + one shared byte buffer
+    JSON_COL_VEC,   // flat numeric array -> one row of a float matrix
+} JsonColType;
+
+typedef struct {
+    const char* name;
+    JsonColType type;
+    size_t width;       // JSON_COL_VEC only, 0 infers it from the first row
+} JsonColSpec;
+
+typedef struct {
+    char* name;
+    size_t name_len;
+    JsonColType type;
+    size_t width;       // floats per row, 1 for JSON_COL_F32
+    Vec* vec;           // F32/VEC: row-major, dim == n_rows * width
+    int64_t* ints;      // I64
+    size_t* offsets;    // STR: n_rows + 1 offsets into `bytes`
+    char* bytes;        // STR: raw string bytes, escapes left as-is
+    size_t bytes_len;
+    size_t bytes_cap;
+} JsonColumn;
+
+typedef struct {
+    JsonColumn* cols;
+    size_t n_cols;
+    size_t n_rows;
+    size_t capacity;    // rows allocated in every column
+    bool* seen;         // scratch, per column for the current row
+} JsonBatch;
+
+JsonBatch* json_batch_init(const JsonColSpec* specs, size_t n_cols,
+                           size_t capacity);
+void json_batch_free(JsonBatch* batch);
+
+int json_batch_parse(JsonBatch* batch, const char* str);
+
+JsonColumn* json_batch_col(const JsonBatch* batch, const char* name);
+const char* json_batch_str(const JsonColumn* col, size_t row, size_t* len);
+
+#endif // JSON_BATCH_H
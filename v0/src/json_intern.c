@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L    // pthread
+#include "json_intern.h"
+#include "mem.h"
+#include <stdint.h>         // uint32_t
+#include <string.h>         // memcpy, memcmp
+#include <stdatomic.h>      // atomic_size_t
+#include <pthread.h>        // pthread_mutex_t
+
+#define INTERN_INITIAL_SLOTS 64
+#define INTERN_CHUNK_SIZE    (64 * 1024)
+
+typedef struct {
+    const char* str;        // NULL if the slot is empty
+    uint32_t hash;
+    uint32_t len;
+} InternSlot;
+
+/* key bytes live in a list of chunks that never move */
+typedef struct InternChunk InternChunk;
+struct InternChunk {
+    InternChunk* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+struct JsonInterner {
+    InternSlot* slots;
+    size_t n_slots;         // power of 2
+    size_t count;
+    size_t bytes;           // key bytes stored, incl. null terminators
+    InternChunk* chunks;
+    atomic_size_t refs;
+    bool thread_safe;
+    pthread_mutex_t lock;
+};
+
+static uint32_t intern_hash(const char* s, size_t len) {
+    uint32_t h = 0x811C9DC5u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 0x01000193u;
+    return h;
+}
+
+/* allocates a new table with one reference, caller owns */
+JsonInterner* json_interner_init(bool thread_safe) {
+    JsonInterner* in = mem_calloc(1, sizeof(JsonInterner), MEM_INTERN);
+    if (in == NULL) return NULL;
+    in->slots = mem_calloc(INTERN_INITIAL_SLOTS, sizeof(InternSlot),
+                           MEM_INTERN);
+    if (in->slots == NULL) {
+        mem_free(in);
+        return NULL;
+    }
+    in->n_slots = INTERN_INITIAL_SLOTS;
+    atomic_init(&in->refs, 1);
+    in->thread_safe = thread_safe;
+    if (thread_safe) pthread_mutex_init(&in->lock, NULL);
+    return in;
+}
+
+JsonInterner* json_interner_retain(JsonInterner* in) {
+    if (in != NULL) atomic_fetch_add(&in->refs, 1);
+    return in;
+}
+
+/* drops one reference, freeing the table and every key on the last one */
+void json_interner_release(JsonInterner* in) {
+    if (in == NULL || atomic_fetch_sub(&in->refs, 1) != 1) return;
+    InternChunk* chunk = in->chunks;
+    while (chunk != NULL) {
+        InternChunk* next = chunk->next;
+        mem_free(chunk);
+        chunk = next;
+    }
+    if (in->thread_safe) pthread_mutex_destroy(&in->lock);
+    mem_free(in->slots);
+    mem_free(in);
+}
+
+static InternSlot* intern_probe(InternSlot* slots, size_t n_slots,
+                                const char* s, size_t len, uint32_t hash) {
+    size_t i = hash & (n_slots - 1);
+    while (slots[i].str != NULL) {
+        if (slots[i].hash == hash && slots[i].len == len
+                && memcmp(slots[i].str, s, len) == 0)
+            break;
+        i = (i + 1) & (n_slots - 1);
+    }
+    return slots + i;
+}
+
+static bool intern_grow(JsonInterner* in) {
+    size_t n_slots = in->n_slots * 2;
+    InternSlot* slots = mem_calloc(n_slots, sizeof(InternSlot), MEM_INTERN);
+    if (slots == NULL) return false;
+    for (size_t i = 0; i < in->n_slots; i++) {
+        InternSlot* old = in->slots + i;
+        if (old->str == NULL) continue;
+        *intern_probe(slots, n_slots, old->str, old->len, old->hash) = *old;
+    }
+    mem_free(in->slots);
+    in->slots = slots;
+    in->n_slots = n_slots;
+    return true;
+}
+
+static const char* intern_copy(JsonInterner* in, const char* s, size_t len) {
+    InternChunk* chunk = in->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < len + 1) {
+        size_t capacity = (len + 1 > INTERN_CHUNK_SIZE)
+                        ? len + 1 : INTERN_CHUNK_SIZE;
+        chunk = mem_malloc(sizeof(InternChunk) + capacity, MEM_INTERN);
+        if (chunk == NULL) return NULL;
+        chunk->next = in->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        in->chunks = chunk;
+    }
+    char* dst = chunk->data + chunk->used;
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    chunk->used += len + 1;
+    return dst;
+}
+
+static const char* intern_locked(JsonInterner* in, const char* s,
+                                 size_t len, bool insert) {
+    uint32_t hash = intern_hash(s, len);
+    InternSlot* slot = intern_probe(in->slots, in->n_slots, s, len, hash);
+    if (slot->str != NULL || !insert) return slot->str;
+
+    // keep the load factor under 1/2
+    if (2 * (in->count + 1) > in->n_slots) {
+        if (!intern_grow(in)) return NULL;
+        slot = intern_probe(in->slots, in->n_slots, s, len, hash);
+    }
+    const char* str = intern_copy(in, s, len);
+    if (str == NULL) return NULL;
+    slot->str = str;
+    slot->hash = hash;
+    slot->len = (uint32_t)len;
+    in->count++;
+    in->bytes += len + 1;
+    return str;
+}
+
+/* returns the unique, null-terminated copy of s[0..len), adding it if new.
+ * the pointer stays valid for the lifetime of the table */
+const char* json_intern(JsonInterner* in, const char* s, size_t len) {
+    if (!in->thread_safe) return intern_locked(in, s, len, true);
+    pthread_mutex_lock(&in->lock);
+    const char* str = intern_locked(in, s, len, true);
+    pthread_mutex_unlock(&in->lock);
+    return str;
+}
+
+/* returns the interned copy of s[0..len), or NULL if it was never added */
+const char* json_interner_find(JsonInterner* in, const char* s, size_t len) {
+    if (!in->thread_safe) return intern_locked(in, s, len, false);
+    pthread_mutex_lock(&in->lock);
+    const char* str = intern_locked(in, s, len, false);
+    pthread_mutex_unlock(&in->lock);
+    return str;
+}
+
+/* number of distinct keys */
+size_t json_interner_count(JsonInterner* in) {
+    if (!in->thread_safe) return in->count;
+    pthread_mutex_lock(&in->lock);
+    size_t count = in->count;
+    pthread_mutex_unlock(&in->lock);
+    return count;
+}
+
+/* bytes of key data stored, excluding table overhead */
+size_t json_interner_bytes(JsonInterner* in) {
+    if (!in->thread_safe) return in->bytes;
+    pthread_mutex_lock(&in->lock);
+    size_t bytes = in->bytes;
+    pthread_mutex_unlock(&in->lock);
+    return bytes;
+}
@@ -0,0 +1,25 @@
+#ifndef JSON_INTERN_H
+#define JSON_INTERN_H
+
+#include <stdlib.h>  // size_t
+#include <stdbool.h> // bool
+
+/* a table of interned object keys: every distinct key is stored once and
+ * objects built on the table point at it instead of owning a copy, so two
+ * interned keys are equal iff their pointers are. a table can be private to
+ * one document or shared between documents (and threads, if created
+ * thread-safe); it is freed when its last user releases it */
+
+typedef struct JsonInterner JsonInterner;
+
+JsonInterner* json_interner_init(bool thread_safe);
+JsonInterner* json_interner_retain(JsonInterner* in);
+void json_interner_release(JsonInterner* in);
+
+const char* json_intern(JsonInterner* in, const char* s, size_t len);
+const char* json_interner_find(JsonInterner* in, const char* s, size_t len);
+
+size_t json_interner_count(JsonInterner* in);
+size_t json_interner_bytes(JsonInterner* in);
+
+#endif // JSON_INTERN_H
@@ -0,0 +1,76 @@
+#ifndef JSON_PARSER_H
+#define JSON_PARSER_H
+
+/* parser internals shared by the json_* decoders; not part of the public api */
+
+#include <stdlib.h>     // size_t
+#include <stdbool.h>    // bool
+#include <ctype.h>      // isspace
+#include "trace.h"      // TRACE_BEGIN, TRACE_END
+
+/* context for the json parser */
+typedef struct {
+    const char* data;
+    size_t loc;
+    size_t len;
+} JsonSrc;
+
+typedef enum {
+    SUCCESS = 0,
+    OOM = -1,
+    INVALID_JSON = -2,
+    DEPTH_EXCEEDED = -3,
+} ParserResultCode;
+
+static inline bool has_ch(JsonSrc* src) {
+    return src->loc <= src->len;
+}
+
+static inline char peek_ch(JsonSrc* src) {
+    return has_ch(src) ? src->data[src->loc] : '\0';
+}
+
+static inline char consume_ch(JsonSrc* src) {
+    return has_ch(src) ? src->data[src->loc++] : '\0';
+}
+
+static inline void consume_if_eq(JsonSrc* src, char ch) {
+    if (peek_ch(src) == ch) consume_ch(src);
+}
+
+static inline bool next_isnt(char ch, JsonSrc* src) {
+    return peek_ch(src) != ch;
+}
+
+static inline void skip_whitespace(JsonSrc* src) {
+    if (!isspace(peek_ch(src))) return;     // the common case, not traced
+    TRACE_BEGIN(TRACE_WHITESPACE);
+    size_t start = src->loc;
+    while (isspace(peek_ch(src))) consume_ch(src);
+    TRACE_END(TRACE_WHITESPACE, src->loc - start, 0);
+}
+
+static inline size_t count_ch_until(JsonSrc* src, char to_count, char stop) {
+    size_t count = 0, loc = src->loc;
+    char cur_ch;
+    while (loc <= src->len && (cur_ch = *(src->data + loc++)) != stop)
+        count += (cur_ch == to_count) ? 1 : 0;
+    return count;
+}
+
+/* locates the next quoted string without copying it; the raw bytes
+ * (escapes left as-is) are src->data[*start .. *start + *len) */
+int scan_string(JsonSrc* src, size_t* start, size_t* len);
+
+/* like scan_string, but copies the bytes into a new c-string, caller owns */
+int parse_string_into(JsonSrc* src, char** dst);
+
+/* parses comma separated floats up to and including the closing ']' into
+ * `dst`; fails if there are more than `cap` of them. expects the opening
+ * '[' to have been consumed already */
+int parse_floats_into(JsonSrc* src, float* dst, size_t cap, size_t* n);
+
+/* skips over one value of any type without building it */
+int skip_value(JsonSrc* src);
+
+#endif // JSON_PARSER_H
@@ -0,0 +1,235 @@
+#include "json_schema.h"
+#include "json_parser.h"
+#include "tensor.h"
+#include "mem.h"
+#include <string.h>         // memcmp, memcpy, strlen, strncmp
+
+#define SCHEMA_MAX_FIELDS 4096
+#define SCHEMA_MAX_SEEDS  256
+
+static uint32_t json_schema_hash(const JsonSchema* schema,
+                                 const char* key, size_t len) {
+    uint32_t h = schema->seed ^ ((uint32_t)len * 0x9E3779B1u);
+    if (schema->full_hash) {
+        for (size_t i = 0; i < len; i++)
+            h = (h ^ (unsigned char)key[i]) * 0x01000193u;
+    } else if (len > 0) {
+        h ^= (uint32_t)(unsigned char)key[0]
+           | (uint32_t)(unsigned char)key[len / 2] << 8
+           | (uint32_t)(unsigned char)key[len - 1] << 16;
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h & schema->mask;
+}
+
+/* fills the slot table with the current seed; false on any collision */
+static bool json_schema_try_seed(JsonSchema* schema) {
+    memset(schema->slots, 0xff, (schema->mask + 1) * sizeof(int16_t));
+    for (size_t i = 0; i < schema->n_fields; i++) {
+        uint32_t h = json_schema_hash(schema, schema->fields[i].name,
+                                      schema->name_lens[i]);
+        if (schema->slots[h] >= 0) return false;
+        schema->slots[h] = (int16_t)i;
+    }
+    return true;
+}
+
+/* searches for a collision free hash: cheap len/first/middle/last byte
+ * hashing first, and the full key if those bytes can't tell keys apart */
+static bool json_schema_build(JsonSchema* schema) {
+    for (int full = 0; full <= 1; full++) {
+        schema->full_hash = full;
+        uint32_t size = 4;
+        while (size < 2 * schema->n_fields) size *= 2;
+        for (int grow = 0; grow < 4; grow++, size *= 2) {
+            int16_t* slots = mem_realloc(schema->slots,
+                                         size * sizeof(int16_t), MEM_SCHEMA);
+            if (slots == NULL) return false;
+            schema->slots = slots;
+            schema->mask = size - 1;
+            for (uint32_t seed = 0; seed < SCHEMA_MAX_SEEDS; seed++) {
+                schema->seed = seed * 0x27D4EB2Fu;
+                if (json_schema_try_seed(schema)) return true;
+            }
+        }
+    }
+    return false;   // only possible with duplicate keys
+}
+
+/* builds the key dispatch table for `fields`, which must outlive `schema` */
+int json_schema_init(JsonSchema* schema, const JsonField* fields, size_t n) {
+    memset(schema, 0, sizeof(JsonSchema));
+    if (n > SCHEMA_MAX_FIELDS) return INVALID_JSON;
+    schema->fields = fields;
+    schema->n_fields = n;
+    schema->name_lens = mem_malloc((n ? n : 1) * sizeof(size_t), MEM_SCHEMA);
+    if (schema->name_lens == NULL) return OOM;
+    for (size_t i = 0; i < n; i++)
+        schema->name_lens[i] = strlen(fields[i].name);
+
+    if (!json_schema_build(schema)) {
+        json_schema_free(schema);
+        return INVALID_JSON;
+    }
+    return SUCCESS;
+}
+
+/* frees the dispatch table, not the fields */
+void json_schema_free(JsonSchema* schema) {
+    if (schema == NULL) return;
+    mem_free(schema->name_lens);
+    mem_free(schema->slots);
+    schema->name_lens = NULL;
+    schema->slots = NULL;
+}
+
+static const JsonField* json_schema_lookup(const JsonSchema* schema,
+                                           const char* key, size_t len) {
+    int16_t i = schema->slots[json_schema_hash(schema, key, len)];
+    if (i < 0 || schema->name_lens[i] != len
+              || memcmp(schema->fields[i].name, key, len) != 0)
+        return NULL;
+    return schema->fields + i;
+}
+
+static bool consume_literal(JsonSrc* src, const char* lit, size_t len) {
+    if (src->loc > src->len || src->len - src->loc < len
+            || strncmp(src->data + src->loc, lit, len) != 0)
+        return false;
+    src->loc += len;
+    return true;
+}
+
+static int json_field_parse(const JsonField* field, char* member,
+                            JsonSrc* src) {
+    skip_whitespace(src);
+    const char* start = src->data + src->loc;
+    char* end;
+
+    switch (field->type) {
+        case JSON_FIELD_F32: {
+            float value = strtof(start, &end);
+            if (start == end) return INVALID_JSON;
+            memcpy(member, &value, sizeof(value));
+            src->loc += (end - start);
+            return SUCCESS;
+        }
+        case JSON_FIELD_F64: {
+            double value = strtod(start, &end);
+            if (start == end) return INVALID_JSON;
+            memcpy(member, &value, sizeof(value));
+            src->loc += (end - start);
+            return SUCCESS;
+        }
+        case JSON_FIELD_I64: {
+            int64_t value = strtoll(start, &end, 10);
+            if (start == end) return INVALID_JSON;
+            memcpy(member, &value, sizeof(value));
+            src->loc += (end - start);
+            return SUCCESS;
+        }
+        case JSON_FIELD_BOOL: {
+            bool value = consume_literal(src, "true", 4);
+            if (!value && !consume_literal(src, "false", 5))
+                return INVALID_JSON;
+            memcpy(member, &value, sizeof(value));
+            return SUCCESS;
+        }
+        case JSON_FIELD_STR: {
+            char* value;
+            int res = parse_string_into(src, &value);
+            if (res != SUCCESS) return res;
+            memcpy(member, &value, sizeof(value));
+            return SUCCESS;
+        }
+        default: {  // JSON_FIELD_VEC
+            // TAKE '['
+            if (next_isnt('[', src)) return INVALID_JSON;
+            consume_ch(src);
+            skip_whitespace(src);
+
+            size_t n, cap = count_ch_until(src, ',', ']') + 1;
+            Vec* value = vec_init(cap);
+            if (value == NULL) return OOM;
+            int res = parse_floats_into(src, value->data, cap, &n);
+            if (res != SUCCESS) {
+                vec_free(value);
+                return res;
+            }
+            value->dim = n;
+            memcpy(member, &value, sizeof(value));
+            return SUCCESS;
+        }
+    }
+}
+
+/* frees a STR or VEC member and resets it to NULL */
+static void json_field_release(const JsonField* field, char* member) {
+    void** ptr = (void**)member;
+    if (field->type == JSON_FIELD_STR) {
+        mem_free(*ptr);
+        *ptr = NULL;
+    } else if (field->type == JSON_FIELD_VEC) {
+        vec_free(*ptr);
+        *ptr = NULL;
+    }
+}
+
+/* parses the json object `str` into the struct at `dst`. members whose key
+ * is absent are left untouched, unknown keys are skipped, and of a
+ * repeated key the last value is kept. STR and VEC members are
+ * overwritten, see json_schema_release */
+int json_schema_parse(const JsonSchema* schema, void* dst, const char* str) {
+    JsonSrc src = { str, 0, strlen(str) };
+    uint64_t seen[SCHEMA_MAX_FIELDS / 64] = {0};    // fields set by this call
+
+    // TAKE '{'
+    skip_whitespace(&src);
+    if (next_isnt('{', &src)) return INVALID_JSON;
+    consume_ch(&src);
+
+    skip_whitespace(&src);
+    while (next_isnt('}', &src)) {
+        // parse key, without copying it
+        size_t start, len;
+        int res = scan_string(&src, &start, &len);
+        if (res != SUCCESS) return res;
+
+        // TAKE ':'
+        skip_whitespace(&src);
+        if (next_isnt(':', &src)) return INVALID_JSON;
+        consume_ch(&src);
+
+        const JsonField* field =
+            json_schema_lookup(schema, src.data + start, len);
+        if (field == NULL) {
+            res = skip_value(&src);
+        } else {
+            size_t i = (size_t)(field - schema->fields);
+            char* member = (char*)dst + field->offset;
+            // the value an earlier occurrence allocated is replaced
+            if (seen[i / 64] & (1ull << (i % 64)))
+                json_field_release(field, member);
+            seen[i / 64] |= 1ull << (i % 64);
+            res = json_field_parse(field, member, &src);
+        }
+        if (res != SUCCESS) return res;
+
+        // consume till next key
+        skip_whitespace(&src);
+        consume_if_eq(&src, ',');
+        skip_whitespace(&src);
+        if (peek_ch(&src) == '\0') return INVALID_JSON;
+    }
+    return SUCCESS;
+}
+
+/* frees the STR and VEC members of `dst` and resets them to NULL */
+void json_schema_release(const JsonSchema* schema, void* dst) {
+    for (size_t i = 0; i < schema->n_fields; i++) {
+        const JsonField* field = schema->fields + i;
+        json_field_release(field, (char*)dst + field->offset);
+    }
+}
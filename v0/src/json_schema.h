@@ -0,0 +1,61 @@
+#ifndef JSON_SCHEMA_H
+#define JSON_SCHEMA_H
+
+#include <stdlib.h>  // size_t
+#include <stddef.h>  // offsetof
+#include <stdint.h>  // uint32_t, int16_t
+#include <stdbool.h> // bool
+#include "tensor.h"  // Vec related
+
+/* schema-specialized decoding of fixed-layout messages straight into a C
+ * struct. keys are dispatched through a perfect hash built once per schema,
+ * so no key is ever allocated or compared more than once:
+ *
+ *   typedef struct { int64_t id; char* user; Vec* emb; } Msg;
+ *   static const JsonField msg_fields[] = {
+ *       JSON_FIELD(Msg, id, JSON_FIELD_I64),
+ *       JSON_FIELD(Msg, user, JSON_FIELD_STR),
+ *       JSON_FIELD(Msg, emb, JSON_FIELD_VEC),
+ *   };
+ */
+
+typedef enum {
+    JSON_FIELD_F32,     // float
+    JSON_FIELD_F64,     // double
+    JSON_FIELD_I64,     // int64_t
+    JSON_FIELD_BOOL,    // bool
+    JSON_FIELD_STR,     // char*, new c-string, struct owns
+    JSON_FIELD_VEC,     // Vec*, new vec, struct owns
+} JsonFieldType;
+
+typedef struct {
+    const char* name;
+    JsonFieldType type;
+    size_t offset;
+} JsonField;
+
+/* declares a field whose key is the member name */
+#define JSON_FIELD(type_, member, field_type) \
+    { #member, field_type, offsetof(type_, member) }
+
+/* declares a field whose key differs from the member name */
+#define JSON_FIELD_KEY(key, type_, member, field_type) \
+    { key, field_type, offsetof(type_, member) }
+
+typedef struct {
+    const JsonField* fields;
+    size_t n_fields;
+    size_t* name_lens;
+    int16_t* slots;     // hash -> field index, -1 if empty
+    uint32_t mask;      // table size - 1
+    uint32_t seed;
+    bool full_hash;     // hashes every key byte, not just len/ends/middle
+} JsonSchema;
+
+int json_schema_init(JsonSchema* schema, const JsonField* fields, size_t n);
+void json_schema_free(JsonSchema* schema);
+
+int json_schema_parse(const JsonSchema* schema, void* dst, const char* str);
+void json_schema_release(const JsonSchema* schema, void* dst);
+
+#endif // JSON_SCHEMA_H
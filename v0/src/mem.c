@@ -0,0 +1,207 @@
+#include "mem.h"
+#include "trace.h"
+#include <string.h>         // memcpy, memset, strlen
+#include <stddef.h>         // max_align_t
+#include <stdatomic.h>      // atomic_size_t
+
+static void* libc_malloc(void* ctx, size_t size, MemTag tag) {
+    (void)ctx;
+    (void)tag;
+    return malloc(size);
+}
+
+static void* libc_realloc(void* ctx, void* ptr, size_t size, MemTag tag) {
+    (void)ctx;
+    (void)tag;
+    return realloc(ptr, size);
+}
+
+static void libc_free(void* ctx, void* ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+static const MemAllocator libc_allocator = {
+    libc_malloc, libc_realloc, libc_free, NULL
+};
+
+static MemAllocator current = { libc_malloc, libc_realloc, libc_free, NULL };
+
+/* installs `allocator`, or libc if NULL. not thread-safe, see mem.h */
+void mem_set_allocator(const MemAllocator* allocator) {
+    current = (allocator != NULL) ? *allocator : libc_allocator;
+}
+
+MemAllocator mem_get_allocator(void) {
+    return current;
+}
+
+void* mem_malloc(size_t size, MemTag tag) {
+    TRACE_BEGIN(TRACE_ALLOC);
+    void* ptr = current.malloc(current.ctx, size, tag);
+    TRACE_END(TRACE_ALLOC, size, 1);
+    return ptr;
+}
+
+/* zeroed, overflow-checked n * size */
+void* mem_calloc(size_t n, size_t size, MemTag tag) {
+    if (size != 0 && n > (size_t)-1 / size) return NULL;
+    TRACE_BEGIN(TRACE_ALLOC);
+    void* ptr = current.malloc(current.ctx, n * size, tag);
+    if (ptr != NULL) memset(ptr, 0, n * size);
+    TRACE_END(TRACE_ALLOC, n * size, 1);
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size, MemTag tag) {
+    TRACE_BEGIN(TRACE_ALLOC);
+    void* new_ptr = current.realloc(current.ctx, ptr, size, tag);
+    TRACE_END(TRACE_ALLOC, size, 1);
+    return new_ptr;
+}
+
+void mem_free(void* ptr) {
+    if (ptr != NULL) current.free(current.ctx, ptr);
+}
+
+char* mem_strdup(const char* s, MemTag tag) {
+    size_t len = strlen(s) + 1;
+    char* copy = mem_malloc(len, tag);
+    if (copy != NULL) memcpy(copy, s, len);
+    return copy;
+}
+
+/* --- accounting --- */
+
+/* prepended to every block, keeps the payload max-aligned */
+typedef union {
+    struct {
+        size_t size;
+        MemTag tag;
+    } info;
+    max_align_t align;
+} MemHeader;
+
+typedef struct {
+    atomic_size_t live_bytes;
+    atomic_size_t peak_bytes;
+    atomic_size_t allocs;
+    atomic_size_t reallocs;
+    atomic_size_t frees;
+} MemCounters;
+
+static MemCounters counters[MEM_TAG_COUNT];
+static MemCounters total;
+static MemAllocator accounting_inner;
+
+static void counters_raise_peak(MemCounters* c, size_t live) {
+    size_t peak = atomic_load_explicit(&c->peak_bytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(
+               &c->peak_bytes, &peak, live,
+               memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+static void counters_add(MemTag tag, size_t size) {
+    size_t live = atomic_fetch_add_explicit(&counters[tag].live_bytes, size,
+                                            memory_order_relaxed) + size;
+    counters_raise_peak(&counters[tag], live);
+    live = atomic_fetch_add_explicit(&total.live_bytes, size,
+                                     memory_order_relaxed) + size;
+    counters_raise_peak(&total, live);
+}
+
+static void counters_sub(MemTag tag, size_t size) {
+    atomic_fetch_sub_explicit(&counters[tag].live_bytes, size,
+                              memory_order_relaxed);
+    atomic_fetch_sub_explicit(&total.live_bytes, size, memory_order_relaxed);
+}
+
+static void counters_bump(atomic_size_t* tag_count, atomic_size_t* total_count) {
+    atomic_fetch_add_explicit(tag_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(total_count, 1, memory_order_relaxed);
+}
+
+static void* accounting_malloc(void* ctx, size_t size, MemTag tag) {
+    (void)ctx;
+    if (tag >= MEM_TAG_COUNT) tag = MEM_OTHER;
+    if (size > (size_t)-1 - sizeof(MemHeader)) return NULL;
+    MemHeader* header = accounting_inner.malloc(accounting_inner.ctx,
+                                                sizeof(MemHeader) + size, tag);
+    if (header == NULL) return NULL;
+    header->info.size = size;
+    header->info.tag = tag;
+    counters_bump(&counters[tag].allocs, &total.allocs);
+    counters_add(tag, size);
+    return header + 1;
+}
+
+/* a block keeps the tag it was allocated with */
+static void* accounting_realloc(void* ctx, void* ptr, size_t size, MemTag tag) {
+    if (ptr == NULL) return accounting_malloc(ctx, size, tag);
+    if (size > (size_t)-1 - sizeof(MemHeader)) return NULL;
+    MemHeader* header = (MemHeader*)ptr - 1;
+    size_t old_size = header->info.size;
+    MemTag old_tag = header->info.tag;
+    header = accounting_inner.realloc(accounting_inner.ctx, header,
+                                      sizeof(MemHeader) + size, old_tag);
+    if (header == NULL) return NULL;
+    header->info.size = size;
+    counters_bump(&counters[old_tag].reallocs, &total.reallocs);
+    if (size > old_size) counters_add(old_tag, size - old_size);
+    else counters_sub(old_tag, old_size - size);
+    return header + 1;
+}
+
+static void accounting_free(void* ctx, void* ptr) {
+    (void)ctx;
+    MemHeader* header = (MemHeader*)ptr - 1;
+    counters_bump(&counters[header->info.tag].frees, &total.frees);
+    counters_sub(header->info.tag, header->info.size);
+    accounting_inner.free(accounting_inner.ctx, header);
+}
+
+/* returns the accounting allocator, pass it to mem_set_allocator */
+MemAllocator mem_accounting(const MemAllocator* inner) {
+    accounting_inner = (inner != NULL) ? *inner : libc_allocator;
+    MemAllocator a = { accounting_malloc, accounting_realloc,
+                       accounting_free, NULL };
+    return a;
+}
+
+static void counters_load(MemCounters* c, MemStats* out) {
+    out->live_bytes = atomic_load_explicit(&c->live_bytes, memory_order_relaxed);
+    out->peak_bytes = atomic_load_explicit(&c->peak_bytes, memory_order_relaxed);
+    out->allocs = atomic_load_explicit(&c->allocs, memory_order_relaxed);
+    out->reallocs = atomic_load_explicit(&c->reallocs, memory_order_relaxed);
+    out->frees = atomic_load_explicit(&c->frees, memory_order_relaxed);
+}
+
+/* copies the counters; fields are read one by one, so a snapshot taken
+ * while other threads allocate is only approximately consistent */
+void mem_snapshot(MemSnapshot* out) {
+    for (size_t t = 0; t < MEM_TAG_COUNT; t++)
+        counters_load(&counters[t], out->tags + t);
+    counters_load(&total, &out->total);
+}
+
+static void counters_reset(MemCounters* c) {
+    size_t live = atomic_load_explicit(&c->live_bytes, memory_order_relaxed);
+    atomic_store_explicit(&c->peak_bytes, live, memory_order_relaxed);
+    atomic_store_explicit(&c->allocs, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->reallocs, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->frees, 0, memory_order_relaxed);
+}
+
+/* zeroes the call counts and drops the peaks to the current live bytes;
+ * live bytes are kept, they still have to be freed */
+void mem_reset_stats(void) {
+    for (size_t t = 0; t < MEM_TAG_COUNT; t++) counters_reset(&counters[t]);
+    counters_reset(&total);
+}
+
+const char* mem_tag_name(MemTag tag) {
+    static const char* names[MEM_TAG_COUNT] = {
+        "other", "string", "vec", "json", "intern", "batch", "schema", "index",
+    };
+    return (tag < MEM_TAG_COUNT) ? names[tag] : "unknown";
+}
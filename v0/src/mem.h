@@ -0,0 +1,65 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdlib.h> // size_t
+
+/* every allocation the library makes goes through mem_malloc / mem_realloc /
+ * mem_free, which forward to the installed allocator (libc by default).
+ *
+ * install an allocator before the library allocates anything, and keep it
+ * until everything allocated with it is freed: blocks must be freed by the
+ * allocator that made them. buffers handed to the caller (json_dumps,
+ * string_to_chars, vec_to_str, ..) come from it too, so release them with
+ * mem_free; plain free() is only equivalent while libc is installed. the
+ * same goes for data passed to vec_from_takes */
+
+typedef enum {
+    MEM_OTHER,
+    MEM_STRING,
+    MEM_VEC,
+    MEM_JSON,
+    MEM_INTERN,
+    MEM_BATCH,
+    MEM_SCHEMA,
+    MEM_INDEX,
+    MEM_TAG_COUNT,
+} MemTag;
+
+typedef struct {
+    void* (*malloc)(void* ctx, size_t size, MemTag tag);
+    void* (*realloc)(void* ctx, void* ptr, size_t size, MemTag tag);
+    void (*free)(void* ctx, void* ptr);
+    void* ctx;
+} MemAllocator;
+
+void mem_set_allocator(const MemAllocator* allocator);
+MemAllocator mem_get_allocator(void);
+
+void* mem_malloc(size_t size, MemTag tag);
+void* mem_calloc(size_t n, size_t size, MemTag tag);
+void* mem_realloc(void* ptr, size_t size, MemTag tag);
+void mem_free(void* ptr);
+char* mem_strdup(const char* s, MemTag tag);
+
+/* the built-in accounting allocator: forwards to `inner` (libc if NULL)
+ * and keeps per-tag counters. there is one set of counters per process */
+
+typedef struct {
+    size_t live_bytes;
+    size_t peak_bytes;      // since the last reset
+    size_t allocs;          // mem_malloc and mem_calloc calls
+    size_t reallocs;
+    size_t frees;
+} MemStats;
+
+typedef struct {
+    MemStats tags[MEM_TAG_COUNT];
+    MemStats total;         // peak of the sum, not the sum of the peaks
+} MemSnapshot;
+
+MemAllocator mem_accounting(const MemAllocator* inner);
+void mem_snapshot(MemSnapshot* out);
+void mem_reset_stats(void);
+const char* mem_tag_name(MemTag tag);
+
+#endif // MEM_H
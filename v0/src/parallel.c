@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L    // pthread, sysconf
+#include "parallel.h"
+#include "mem.h"
+#include <stdio.h>          // fprintf
+#include <stdbool.h>        // bool
+#include <stdatomic.h>      // atomic_size_t
+#include <pthread.h>
+#include <unistd.h>         // sysconf
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_mutex_t call_lock;  // one parallel_for at a time
+    pthread_t* workers;
+    size_t n_workers;           // threads - 1, the caller is the other one
+    atomic_size_t threads;      // configured, 0 until first use; written
+                                // under call_lock, read from any thread
+    size_t generation;          // bumped once per job
+    size_t pending;             // workers yet to finish the current job
+    bool stop;
+    // the current job
+    ParallelFn fn;
+    void* ctx;
+    size_t n;
+    size_t parts;
+} Pool;
+
+static Pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .call_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// set on pool threads, and on the caller while it runs its own part
+static _Thread_local bool in_parallel = false;
+
+static void run_part(ParallelFn fn, void* ctx, size_t n,
+                     size_t parts, size_t i) {
+    if (i >= parts) return;
+    size_t begin = n * i / parts;
+    size_t end = n * (i + 1) / parts;
+    if (begin < end) fn(ctx, begin, end);
+}
+
+static void* worker_main(void* arg) {
+    size_t id = (size_t)arg;
+    size_t seen = 0;
+    in_parallel = true;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen && !pool.stop)
+            pthread_cond_wait(&pool.start, &pool.lock);
+        if (pool.stop) break;
+        seen = pool.generation;
+        ParallelFn fn = pool.fn;
+        void* ctx = pool.ctx;
+        size_t n = pool.n, parts = pool.parts;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_part(fn, ctx, n, parts, id);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0) pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+static size_t default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (size_t)n : 1;
+}
+
+/* starts the workers; expects call_lock to be held */
+static void pool_start(void) {
+    size_t threads = atomic_load(&pool.threads);
+    if (threads == 0) {
+        threads = default_threads();
+        atomic_store(&pool.threads, threads);
+    }
+    if (pool.workers != NULL || threads <= 1) return;
+
+    pool.workers = mem_malloc((threads - 1) * sizeof(pthread_t), MEM_OTHER);
+    if (pool.workers == NULL) {
+        atomic_store(&pool.threads, 1);
+        return;
+    }
+    pool.stop = false;
+    for (size_t i = 0; i < threads - 1; i++) {
+        if (pthread_create(pool.workers + i, NULL, worker_main,
+                           (void*)(i + 1)) != 0) {
+            fprintf(stderr, "parallel: pthread_create failed\n");
+            break;
+        }
+        pool.n_workers++;
+    }
+    atomic_store(&pool.threads, pool.n_workers + 1);
+}
+
+/* joins the workers; expects call_lock to be held */
+static void pool_stop(void) {
+    if (pool.workers == NULL) return;
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t i = 0; i < pool.n_workers; i++)
+        pthread_join(pool.workers[i], NULL);
+    mem_free(pool.workers);
+    pool.workers = NULL;
+    pool.n_workers = 0;
+    // restarted workers begin with seen = 0, which must not look like a job
+    pool.generation = 0;
+}
+
+/* sets the number of threads used by parallel_for, the caller included.
+ * 0 means one per online cpu, the default */
+void parallel_set_threads(size_t n) {
+    pthread_mutex_lock(&pool.call_lock);
+    pool_stop();
+    atomic_store(&pool.threads, (n == 0) ? default_threads() : n);
+    pthread_mutex_unlock(&pool.call_lock);
+}
+
+size_t parallel_threads(void) {
+    size_t threads = atomic_load(&pool.threads);
+    return threads ? threads : default_threads();
+}
+
+/* calls fn(ctx, begin, end) over disjoint ranges covering [0, n) and
+ * returns once all of them are done. runs inline when nested */
+void parallel_for(size_t n, size_t grain, ParallelFn fn, void* ctx) {
+    if (n == 0) return;
+    if (grain == 0) grain = 1;
+    size_t parts = (n + grain - 1) / grain;
+    if (in_parallel || parts <= 1 || parallel_threads() <= 1) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.call_lock);
+    pool_start();
+    if (parts > pool.n_workers + 1) parts = pool.n_workers + 1;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.n = n;
+    pool.parts = parts;
+    pool.pending = pool.n_workers;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_parallel = true;
+    run_part(fn, ctx, n, parts, 0);
+    in_parallel = false;
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0) pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.call_lock);
+}
+
+/* joins the worker threads; they are restarted on the next parallel_for */
+void parallel_shutdown(void) {
+    pthread_mutex_lock(&pool.call_lock);
+    pool_stop();
+    pthread_mutex_unlock(&pool.call_lock);
+}
@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdlib.h> // size_t
+
+/* a small persistent thread pool for data-parallel loops.
+ * [0, n) is split into contiguous ranges of near equal size, at most
+ * ceil(n / grain) of them and at most one per thread; the split only
+ * depends on n, grain and the thread count, so results that depend on it
+ * are reproducible */
+
+typedef void (*ParallelFn)(void* ctx, size_t begin, size_t end);
+
+void parallel_set_threads(size_t n);
+size_t parallel_threads(void);
+void parallel_for(size_t n, size_t grain, ParallelFn fn, void* ctx);
+void parallel_shutdown(void);
+
+#endif // PARALLEL_H
@@ -0,0 +1,201 @@
+#include "prng.h"
+#include "parallel.h"       // parallel_for
+#include "vmath.h"          // vmath_logf, vmath_sincos_turn, vmath_erfinvf
+#include <string.h>         // memcpy
+#include <math.h>           // erf, fmin, fmax, isfinite
+
+/* philox blocks computed side by side, 4 floats from each */
+#define PRNG_LANES (PRNG_GROUP / 4)
+
+/* groups per parallel_for range: 16k floats, as for the vec kernels */
+#define PRNG_GRAIN ((1 << 14) / PRNG_GROUP)
+
+#define PHILOX_ROUNDS 10
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u   // key schedule: golden ratio
+#define PHILOX_W1 0xBB67AE85u   // and sqrt(3) - 1
+
+static inline void philox_round(uint32_t* c0, uint32_t* c1, uint32_t* c2,
+                                uint32_t* c3, uint32_t k0, uint32_t k1) {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * *c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1 * *c2;
+    *c0 = (uint32_t)(p1 >> 32) ^ *c1 ^ k0;
+    *c2 = (uint32_t)(p0 >> 32) ^ *c3 ^ k1;
+    *c1 = (uint32_t)p1;
+    *c3 = (uint32_t)p0;
+}
+
+/* one block of any counter and key, for checking against the published
+ * test vectors; fills use philox_lanes */
+void prng_philox(const uint32_t counter[4], const uint32_t key[2],
+                 uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1];
+    uint32_t c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        philox_round(&c0, &c1, &c2, &c3, k0, k1);
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/* the blocks of counters first .. first + PRNG_LANES - 1 (the high 64
+ * bits of the counter are 0): word w of block j goes to x[w][j] */
+static void philox_lanes(uint64_t key, uint64_t first,
+                         uint32_t x[4][PRNG_LANES]) {
+    uint32_t c0[PRNG_LANES], c1[PRNG_LANES], c2[PRNG_LANES], c3[PRNG_LANES];
+    for (size_t j = 0; j < PRNG_LANES; j++) {
+        uint64_t counter = first + j;
+        c0[j] = (uint32_t)counter;
+        c1[j] = (uint32_t)(counter >> 32);
+        c2[j] = 0;
+        c3[j] = 0;
+    }
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        for (size_t j = 0; j < PRNG_LANES; j++)
+            philox_round(c0 + j, c1 + j, c2 + j, c3 + j, k0, k1);
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    memcpy(x[0], c0, sizeof(c0));
+    memcpy(x[1], c1, sizeof(c1));
+    memcpy(x[2], c2, sizeof(c2));
+    memcpy(x[3], c3, sizeof(c3));
+}
+
+/* the top 24 bits as a float in [0, 1), exactly */
+static inline float prng_unit(uint32_t x) {
+    return (float)(x >> 8) * 0x1p-24f;
+}
+
+typedef enum {
+    PRNG_UNIFORM,
+    PRNG_NORMAL,
+    PRNG_TRUNCATED,
+} PrngKind;
+
+typedef struct {
+    PrngKind kind;
+    float* out;
+    size_t n;
+    uint64_t key;
+    uint64_t counter;   // of group 0
+    float scale;        // out = shift + scale * (u, or the normal value)
+    float shift;
+    float erf_lo;       // PRNG_TRUNCATED: erf of the bounds / sqrt 2, kept
+    float erf_hi;       // inside (-1, 1)
+    float lo;           // and the bounds, to clamp to
+    float hi;
+} PrngArgs;
+
+/* the PRNG_GROUP floats of group g */
+static void prng_group(const PrngArgs* args, size_t g, float* dst) {
+    uint32_t x[4][PRNG_LANES];
+    philox_lanes(args->key, args->counter + g * PRNG_LANES, x);
+    float scale = args->scale, shift = args->shift;
+
+    switch (args->kind) {
+        case PRNG_UNIFORM:
+            for (size_t w = 0; w < 4; w++)
+                for (size_t j = 0; j < PRNG_LANES; j++)
+                    dst[w * PRNG_LANES + j] = shift + scale
+                                                    * prng_unit(x[w][j]);
+            break;
+        case PRNG_NORMAL:
+            // words 0, 1 and 2, 3 are each one box-muller pair
+            for (size_t w = 0; w < 4; w += 2) {
+                for (size_t j = 0; j < PRNG_LANES; j++) {
+                    float u = 1.0f - prng_unit(x[w][j]);    // (0, 1]
+                    float r = vmath_sqrtf(-2.0f * vmath_logf(u));
+                    float s, c;
+                    vmath_sincos_turn(prng_unit(x[w + 1][j]), &s, &c);
+                    dst[w * PRNG_LANES + j] = shift + scale * r * c;
+                    dst[(w + 1) * PRNG_LANES + j] = shift + scale * r * s;
+                }
+            }
+            break;
+        case PRNG_TRUNCATED: {
+            float e_lo = args->erf_lo, e_span = args->erf_hi - args->erf_lo;
+            float lo = args->lo, hi = args->hi;
+            for (size_t w = 0; w < 4; w++) {
+                for (size_t j = 0; j < PRNG_LANES; j++) {
+                    float e = e_lo + e_span * prng_unit(x[w][j]);
+                    float z = 1.41421356237309505f * vmath_erfinvf(e);
+                    z = (z < hi) ? z : hi;
+                    z = (z > lo) ? z : lo;
+                    dst[w * PRNG_LANES + j] = shift + scale * z;
+                }
+            }
+            break;
+        }
+    }
+}
+
+static void prng_range(void* ctx, size_t begin, size_t end) {
+    const PrngArgs* args = ctx;
+    for (size_t g = begin; g < end; g++) {
+        size_t start = g * PRNG_GROUP;
+        if (start + PRNG_GROUP <= args->n) {
+            prng_group(args, g, args->out + start);
+        } else {
+            float last[PRNG_GROUP];
+            prng_group(args, g, last);
+            memcpy(args->out + start, last,
+                   (args->n - start) * sizeof(float));
+        }
+    }
+}
+
+static bool prng_fill(Prng* rng, Vec* out, PrngArgs* args) {
+    if (rng == NULL || out == NULL || out->data == NULL) return false;
+    size_t groups = (out->dim + PRNG_GROUP - 1) / PRNG_GROUP;
+    args->out = out->data;
+    args->n = out->dim;
+    args->key = rng->key;
+    args->counter = rng->counter;
+    parallel_for(groups, PRNG_GRAIN, prng_range, args);
+    rng->counter += groups * PRNG_LANES;
+    return true;
+}
+
+Prng prng_init(uint64_t seed) {
+    return (Prng){ seed, 0 };
+}
+
+bool prng_uniform(Prng* rng, Vec* out, float lo, float hi) {
+    if (!(lo <= hi) || !isfinite(lo) || !isfinite(hi)) return false;
+    PrngArgs args = { .kind = PRNG_UNIFORM, .scale = hi - lo, .shift = lo };
+    return prng_fill(rng, out, &args);
+}
+
+bool prng_normal(Prng* rng, Vec* out, float mean, float std) {
+    if (!(std >= 0) || !isfinite(mean) || !isfinite(std)) return false;
+    PrngArgs args = { .kind = PRNG_NORMAL, .scale = std, .shift = mean };
+    return prng_fill(rng, out, &args);
+}
+
+/* normal values from [a, b] only, in std units: mean + std * a is the
+ * least value made */
+bool prng_truncated_normal(Prng* rng, Vec* out, float mean, float std,
+                           float a, float b) {
+    if (!(std >= 0) || !isfinite(mean) || !isfinite(std)) return false;
+    if (!(a < b) || !isfinite(a) || !isfinite(b)) return false;
+    // erf^-1 of +-1 is infinite. rounding can still take a value an ulp
+    // past erf_hi, which the clamp to [a, b] takes care of
+    const double edge = 0.99999994;     // 1 - 2^-24
+    double erf_lo = erf(a / 1.41421356237309505);
+    double erf_hi = erf(b / 1.41421356237309505);
+    PrngArgs args = {
+        .kind = PRNG_TRUNCATED, .scale = std, .shift = mean,
+        .erf_lo = (float)fmax(fmin(erf_lo, edge), -edge),
+        .erf_hi = (float)fmax(fmin(erf_hi, edge), -edge),
+        .lo = a, .hi = b,
+    };
+    return prng_fill(rng, out, &args);
+}
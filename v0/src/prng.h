@@ -0,0 +1,46 @@
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <stdint.h>  // uint32_t, uint64_t
+#include <stdbool.h> // bool
+#include "tensor.h"  // Vec
+
+/* counter-based random numbers for filling Vecs: weight initialization,
+ * noise. the generator is philox4x32-10 (salmon et al., "parallel random
+ * numbers: as easy as 1, 2, 3"), which maps a 128-bit counter and a
+ * 64-bit key to 128 random bits.
+ *
+ * a Prng is only a key, the seed, and the next counter. no value depends
+ * on the ones made before it, so a fill is split over the threads by
+ * counter range and its bits are the same whatever the thread count. fills
+ * take PRNG_GROUP floats from every PRNG_GROUP / 4 counters and always
+ * use whole groups, so each one starts where the last stopped and the
+ * whole sequence is reproducible from the seed.
+ *
+ * floats are made from 24 random bits:
+ *   prng_uniform: lo + (hi - lo) u, with u in [0, 1); rounding can give
+ *     hi itself
+ *   prng_normal: box-muller, so never more than ~5.8 std from the mean
+ *   prng_truncated_normal: the normal cdf inverted over [a, b], which
+ *     are in units of std around the mean. they should be within a few
+ *     std of 0: the cdf is only float precise
+ *
+ * fills return false, and do nothing, if the parameters aren't valid */
+
+#define PRNG_GROUP 64
+
+typedef struct {
+    uint64_t key;
+    uint64_t counter;
+} Prng;
+
+Prng prng_init(uint64_t seed);
+void prng_philox(const uint32_t counter[4], const uint32_t key[2],
+                 uint32_t out[4]);
+
+bool prng_uniform(Prng* rng, Vec* out, float lo, float hi);
+bool prng_normal(Prng* rng, Vec* out, float mean, float std);
+bool prng_truncated_normal(Prng* rng, Vec* out, float mean, float std,
+                           float a, float b);
+
+#endif // PRNG_H
@@ -0,0 +1,320 @@
+#include "reduce.h"
+#include "parallel.h"       // parallel_for
+#include "vmath.h"          // vmath_expf
+#include <math.h>           // INFINITY, exp, log, sqrt
+
+/* elements per parallel_for range, as for the vec kernels */
+#define REDUCE_GRAIN (1 << 14)
+
+/* independent accumulators, so the block loops vectorize without
+ * -ffast-math */
+#define REDUCE_LANES 16
+
+/* --- blocks: at most REDUCE_BLOCK floats, summed in float --- */
+
+/* lanes are folded pairwise, the tail is added last */
+static float lanes_sum(float acc[REDUCE_LANES], float tail) {
+    for (size_t w = REDUCE_LANES / 2; w > 0; w /= 2)
+        for (size_t j = 0; j < w; j++) acc[j] += acc[j + w];
+    return acc[0] + tail;
+}
+
+static float block_sum(const float* x, size_t n) {
+    float acc[REDUCE_LANES] = {0};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES)
+        for (size_t j = 0; j < REDUCE_LANES; j++) acc[j] += x[i + j];
+    float tail = 0;
+    for (; i < n; i++) tail += x[i];
+    return lanes_sum(acc, tail);
+}
+
+/* sum of (x - c)^2 */
+static float block_sum_sq(const float* x, size_t n, float c) {
+    float acc[REDUCE_LANES] = {0};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES) {
+        for (size_t j = 0; j < REDUCE_LANES; j++) {
+            float d = x[i + j] - c;
+            acc[j] += d * d;
+        }
+    }
+    float tail = 0;
+    for (; i < n; i++) tail += (x[i] - c) * (x[i] - c);
+    return lanes_sum(acc, tail);
+}
+
+/* sum of e^(x - m) */
+static float block_exp_sum(const float* x, size_t n, float m) {
+    float acc[REDUCE_LANES] = {0};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES)
+        for (size_t j = 0; j < REDUCE_LANES; j++)
+            acc[j] += vmath_expf(x[i + j] - m);
+    float tail = 0;
+    for (; i < n; i++) tail += vmath_expf(x[i] - m);
+    return lanes_sum(acc, tail);
+}
+
+static float block_max(const float* x, size_t n) {
+    float acc[REDUCE_LANES];
+    for (size_t j = 0; j < REDUCE_LANES; j++) acc[j] = -INFINITY;
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES) {
+        // fully unrolled, gcc leaves this as 16 scalar maxes
+        #pragma GCC unroll 1
+        for (size_t j = 0; j < REDUCE_LANES; j++)
+            acc[j] = (x[i + j] > acc[j]) ? x[i + j] : acc[j];
+    }
+    float m = -INFINITY;
+    for (; i < n; i++) m = (x[i] > m) ? x[i] : m;
+    for (size_t j = 0; j < REDUCE_LANES; j++) m = (acc[j] > m) ? acc[j] : m;
+    return m;
+}
+
+/* --- rows: one pass over memory, blocks combined in double --- */
+
+static double row_sum(const float* x, size_t n) {
+    double sum = 0;
+    for (size_t lo = 0; lo < n; lo += REDUCE_BLOCK) {
+        size_t nb = (n - lo < REDUCE_BLOCK) ? n - lo : REDUCE_BLOCK;
+        sum += block_sum(x + lo, nb);
+    }
+    return sum;
+}
+
+static float row_max(const float* x, size_t n) {
+    float m = -INFINITY;
+    for (size_t lo = 0; lo < n; lo += REDUCE_BLOCK) {
+        size_t nb = (n - lo < REDUCE_BLOCK) ? n - lo : REDUCE_BLOCK;
+        float bm = block_max(x + lo, nb);
+        m = (bm > m) ? bm : m;
+    }
+    return m;
+}
+
+/* population variance: each block's mean and squared deviations (the
+ * block is in l1 for the second look), merged with chan's update */
+static void row_mean_var(const float* x, size_t n, double* mean_out,
+                         double* var_out) {
+    double mean = 0, m2 = 0;
+    size_t count = 0;
+    for (size_t lo = 0; lo < n; lo += REDUCE_BLOCK) {
+        size_t nb = (n - lo < REDUCE_BLOCK) ? n - lo : REDUCE_BLOCK;
+        float block_mean = block_sum(x + lo, nb) / (float)nb;
+        double block_m2 = block_sum_sq(x + lo, nb, block_mean);
+        double delta = (double)block_mean - mean;
+        size_t total = count + nb;
+        mean += delta * (double)nb / (double)total;
+        m2 += block_m2 + delta * delta * (double)count * (double)nb
+                         / (double)total;
+        count = total;
+    }
+    *mean_out = mean;
+    *var_out = m2 / (double)n;
+}
+
+static double row_sum_sq(const float* x, size_t n) {
+    double sum = 0;
+    for (size_t lo = 0; lo < n; lo += REDUCE_BLOCK) {
+        size_t nb = (n - lo < REDUCE_BLOCK) ? n - lo : REDUCE_BLOCK;
+        sum += block_sum_sq(x + lo, nb, 0);
+    }
+    return sum;
+}
+
+/* the max and sum(e^(x - max)) in one pass: the running sum is rescaled
+ * whenever a block raises the max, at most once per block */
+static void row_softmax_stats(const float* x, size_t n, float* max_out,
+                              double* sum_out) {
+    float m = -INFINITY;
+    double sum = 0;
+    for (size_t lo = 0; lo < n; lo += REDUCE_BLOCK) {
+        size_t nb = (n - lo < REDUCE_BLOCK) ? n - lo : REDUCE_BLOCK;
+        float bm = block_max(x + lo, nb);
+        if (bm > m) {
+            if (sum > 0) sum *= exp((double)m - (double)bm);
+            m = bm;
+        }
+        sum += block_exp_sum(x + lo, nb, m);
+    }
+    *max_out = m;
+    *sum_out = sum;
+}
+
+/* --- threaded over rows --- */
+
+typedef enum {
+    OP_SUM, OP_MAX, OP_MEAN_VAR, OP_SOFTMAX, OP_LOG_SOFTMAX, OP_LAYERNORM,
+    OP_RMSNORM,
+} ReduceOp;
+
+typedef struct {
+    ReduceOp op;
+    const Mat* x;
+    Mat* out;           // normalizations
+    float* row_a;       // reductions: sum, max or mean
+    float* row_b;       // var
+    const float* gamma;
+    const float* beta;
+    float eps;
+} ReduceArgs;
+
+static void normalize_row(const float* x, float* out, size_t n, float shift,
+                          float scale, const float* gamma, const float* beta) {
+    if (gamma != NULL && beta != NULL) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = (x[i] - shift) * scale * gamma[i] + beta[i];
+    } else if (gamma != NULL) {
+        for (size_t i = 0; i < n; i++) out[i] = (x[i] - shift) * scale * gamma[i];
+    } else if (beta != NULL) {
+        for (size_t i = 0; i < n; i++) out[i] = (x[i] - shift) * scale + beta[i];
+    } else {
+        for (size_t i = 0; i < n; i++) out[i] = (x[i] - shift) * scale;
+    }
+}
+
+static void reduce_range(void* ctx, size_t begin, size_t end) {
+    ReduceArgs* args = ctx;
+    size_t n = args->x->cols;
+    for (size_t r = begin; r < end; r++) {
+        const float* x = args->x->data + r * args->x->stride;
+        float* out = (args->out != NULL)
+                   ? args->out->data + r * args->out->stride : NULL;
+        switch (args->op) {
+            case OP_SUM:
+                args->row_a[r] = (float)row_sum(x, n);
+                break;
+            case OP_MAX:
+                args->row_a[r] = row_max(x, n);
+                break;
+            case OP_MEAN_VAR: {
+                double mean, var;
+                row_mean_var(x, n, &mean, &var);
+                if (args->row_a != NULL) args->row_a[r] = (float)mean;
+                if (args->row_b != NULL) args->row_b[r] = (float)var;
+                break;
+            }
+            case OP_SOFTMAX: {
+                float m;
+                double sum;
+                row_softmax_stats(x, n, &m, &sum);
+                float inv = (float)(1.0 / sum);
+                for (size_t i = 0; i < n; i++)
+                    out[i] = vmath_expf(x[i] - m) * inv;
+                break;
+            }
+            case OP_LOG_SOFTMAX: {
+                float m;
+                double sum;
+                row_softmax_stats(x, n, &m, &sum);
+                float lse = (float)((double)m + log(sum));
+                for (size_t i = 0; i < n; i++) out[i] = x[i] - lse;
+                break;
+            }
+            case OP_LAYERNORM: {
+                double mean, var;
+                row_mean_var(x, n, &mean, &var);
+                float rstd = (float)(1.0 / sqrt(var + args->eps));
+                normalize_row(x, out, n, (float)mean, rstd,
+                              args->gamma, args->beta);
+                break;
+            }
+            case OP_RMSNORM: {
+                double ms = row_sum_sq(x, n) / (double)n;
+                float rstd = (float)(1.0 / sqrt(ms + args->eps));
+                normalize_row(x, out, n, 0, rstd, args->gamma, NULL);
+                break;
+            }
+        }
+    }
+}
+
+static void reduce_rows(ReduceArgs* args) {
+    size_t grain = REDUCE_GRAIN / args->x->cols;
+    parallel_for(args->x->rows, grain ? grain : 1, reduce_range, args);
+}
+
+static bool mat_ok(const Mat* m) {
+    return m != NULL && m->data != NULL && m->cols > 0 && m->stride >= m->cols;
+}
+
+static bool row_out_ok(const Mat* x, const Vec* v) {
+    return v != NULL && v->data != NULL && v->dim == x->rows;
+}
+
+static bool same_shape(const Mat* x, const Mat* out) {
+    return mat_ok(x) && mat_ok(out)
+        && x->rows == out->rows && x->cols == out->cols;
+}
+
+static bool col_param_ok(const Mat* x, const Vec* v) {
+    return v == NULL || (v->data != NULL && v->dim == x->cols);
+}
+
+/* out[r] = sum of row r */
+bool mat_row_sum(const Mat* x, Vec* out) {
+    if (!mat_ok(x) || !row_out_ok(x, out)) return false;
+    ReduceArgs args = { .op = OP_SUM, .x = x, .row_a = out->data };
+    reduce_rows(&args);
+    return true;
+}
+
+/* out[r] = max of row r */
+bool mat_row_max(const Mat* x, Vec* out) {
+    if (!mat_ok(x) || !row_out_ok(x, out)) return false;
+    ReduceArgs args = { .op = OP_MAX, .x = x, .row_a = out->data };
+    reduce_rows(&args);
+    return true;
+}
+
+/* mean and population variance of each row; either output may be NULL */
+bool mat_row_mean_var(const Mat* x, Vec* mean, Vec* var) {
+    if (!mat_ok(x)) return false;
+    if ((mean != NULL && !row_out_ok(x, mean))
+        || (var != NULL && !row_out_ok(x, var)))
+        return false;
+    ReduceArgs args = { .op = OP_MEAN_VAR, .x = x,
+                        .row_a = mean ? mean->data : NULL,
+                        .row_b = var ? var->data : NULL };
+    reduce_rows(&args);
+    return true;
+}
+
+/* out = e^(x - max) / sum(e^(x - max)), per row */
+bool mat_softmax(const Mat* x, Mat* out) {
+    if (!same_shape(x, out)) return false;
+    ReduceArgs args = { .op = OP_SOFTMAX, .x = x, .out = out };
+    reduce_rows(&args);
+    return true;
+}
+
+/* out = x - max - log(sum(e^(x - max))), per row */
+bool mat_log_softmax(const Mat* x, Mat* out) {
+    if (!same_shape(x, out)) return false;
+    ReduceArgs args = { .op = OP_LOG_SOFTMAX, .x = x, .out = out };
+    reduce_rows(&args);
+    return true;
+}
+
+/* out = (x - mean) / sqrt(var + eps) * gamma + beta, per row */
+bool mat_layernorm(const Mat* x, const Vec* gamma, const Vec* beta,
+                   float eps, Mat* out) {
+    if (!same_shape(x, out) || !col_param_ok(x, gamma)
+        || !col_param_ok(x, beta))
+        return false;
+    ReduceArgs args = { .op = OP_LAYERNORM, .x = x, .out = out,
+                        .gamma = gamma ? gamma->data : NULL,
+                        .beta = beta ? beta->data : NULL, .eps = eps };
+    reduce_rows(&args);
+    return true;
+}
+
+/* out = x / sqrt(mean(x^2) + eps) * gamma, per row */
+bool mat_rmsnorm(const Mat* x, const Vec* gamma, float eps, Mat* out) {
+    if (!same_shape(x, out) || !col_param_ok(x, gamma)) return false;
+    ReduceArgs args = { .op = OP_RMSNORM, .x = x, .out = out,
+                        .gamma = gamma ? gamma->data : NULL, .eps = eps };
+    reduce_rows(&args);
+    return true;
+}
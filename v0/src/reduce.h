@@ -0,0 +1,32 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stdbool.h> // bool
+#include "tensor.h" // Vec, Mat
+
+/* row-wise reductions and normalizations over a Mat, threaded across rows
+ * with parallel_for.
+ *
+ * rows are walked in blocks of REDUCE_BLOCK floats: each block is summed
+ * in float lanes and the block results are accumulated in double, so the
+ * error doesn't grow with the row length. every kernel reads its input at
+ * most twice (once for the statistics, once to write the output); out may
+ * be the same matrix as x.
+ *
+ * all return false, and do nothing, if the shapes don't match or cols is
+ * 0. row outputs are Vecs of dim x->rows; gamma and beta are Vecs of dim
+ * x->cols, or NULL */
+
+#define REDUCE_BLOCK 256
+
+bool mat_row_sum(const Mat* x, Vec* out);
+bool mat_row_max(const Mat* x, Vec* out);
+bool mat_row_mean_var(const Mat* x, Vec* mean, Vec* var);
+
+bool mat_softmax(const Mat* x, Mat* out);
+bool mat_log_softmax(const Mat* x, Mat* out);
+bool mat_layernorm(const Mat* x, const Vec* gamma, const Vec* beta,
+                   float eps, Mat* out);
+bool mat_rmsnorm(const Mat* x, const Vec* gamma, float eps, Mat* out);
+
+#endif // REDUCE_H
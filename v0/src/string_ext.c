@@ -1,13 +1,23 @@
+#define _POSIX_C_SOURCE 200809L    // writev
 #include "string_ext.h"
-#include <stdio.h>  // fprintf, stderr
-#include <string.h> // strlen, strcpy, strcmp
+#include "mem.h"
+#include <stdio.h>      // fprintf, stderr
+#include <string.h>     // strlen, memcpy, strcmp
+#include <errno.h>      // errno, EINTR
+#include <sys/uio.h>    // writev, struct iovec
 
 /* resizes in-place if needed, may exit on allocation failure */
 static void string_resize_if_needed(String* str, size_t new_len) {
     if (str->capacity > new_len) return;
     size_t new_capacity = str->capacity;
     while (new_capacity <= new_len) new_capacity *= 2;
-    char* new_data = realloc(str->data, new_capacity);
+    char* new_data;
+    if (str->data == str->inline_buf) {
+        new_data = mem_malloc(new_capacity, MEM_STRING);
+        if (new_data != NULL) memcpy(new_data, str->data, str->length + 1);
+    } else {
+        new_data = mem_realloc(str->data, new_capacity, MEM_STRING);
+    }
     if (new_data == NULL) {
         fprintf(stderr, "failed to realloc string during resize attempt");
         exit(1);        // if this realloc fails, gg
@@ -17,31 +27,42 @@ static void string_resize_if_needed(String* str, size_t new_len) {
     str->data[new_len] = '\0';
 }
 
+/* sets up an empty string in caller-provided storage, eg. on the stack */
+void string_init(String* str) {
+    str->data = str->inline_buf;
+    str->capacity = STRING_INLINE_CAPACITY;
+    str->length = 0;
+    str->inline_buf[0] = '\0';
+}
+
+/* frees the data of a string set up with string_init, leaving it empty */
+void string_deinit(String* str) {
+    if (str->data != str->inline_buf) mem_free(str->data);
+    string_init(str);
+}
+
 /* allocates new string, caller owns */
 String* string_new(size_t capacity) {
-    String* s = malloc(sizeof(String));
+    String* s = mem_malloc(sizeof(String), MEM_STRING);
     if (!s) return NULL;
-    s->capacity = (capacity <= 1) ? DEFAULT_STRING_CAPACITY: capacity;
-    s->data = malloc(s->capacity);
-    *(s->data) = '\0';      // null-termination:
-    s->length = 0;          // requires capacity > length (strictly!)
+    string_init(s);
+    if (capacity > STRING_INLINE_CAPACITY)
+        string_resize_if_needed(s, capacity - 1);
     return s;
 }
 
 /* creates new string from c-string, copies data, caller owns */
 String* string_from(const char* src) {
     String* dst = string_new(0);
-    size_t dst_len = strlen(src);
-    string_resize_if_needed(dst, dst_len);
-    strcpy(dst->data, src);
-    dst->length = dst_len;
+    if (dst == NULL) return NULL;
+    string_append(dst, src);
     return dst;
 }
 
 /* frees string and its data */
 void string_free(String* str) {
-    free(str->data);
-    free(str);
+    string_deinit(str);
+    mem_free(str);
 }
 
 /* prints to stdout, safe with null */
@@ -53,19 +74,29 @@ void string_print(const String* str) {
 
 /* appends c-string in-place */
 void string_append(String* dst, const char* src) {
-    size_t new_len = dst->length + strlen(src);
+    string_append_n(dst, src, strlen(src));
+}
+
+/* appends `len` bytes of `src` in-place */
+void string_append_n(String* dst, const char* src, size_t len) {
+    size_t new_len = dst->length + len;
     string_resize_if_needed(dst, new_len);
-    strcpy(dst->data + dst->length, src);
+    memcpy(dst->data + dst->length, src, len);
     dst->length = new_len;
+    dst->data[new_len] = '\0';
 }
 
-/* prepends c-string in-place */
+/* prepends c-string in-place. moves the whole string, see StringBuilder */
 void string_prepend(String* dst, const char* src) {
-    size_t src_len = strlen(src);
-    size_t new_len = dst->length + src_len;
+    string_prepend_n(dst, src, strlen(src));
+}
+
+/* prepends `len` bytes of `src` in-place */
+void string_prepend_n(String* dst, const char* src, size_t len) {
+    size_t new_len = dst->length + len;
     string_resize_if_needed(dst, new_len);
-    memmove(dst->data + src_len, dst->data, dst->length);
-    memcpy(dst->data, src, src_len);
+    memmove(dst->data + len, dst->data, dst->length);
+    memcpy(dst->data, src, len);
     dst->length = new_len;
     dst->data[new_len] = '\0';
 }
@@ -92,16 +123,38 @@ char* string_to_chars(const String* str) {
         return NULL;
     }
     
-    char* copy = malloc(str->length + 1);  // +1 for null terminator
+    char* copy = mem_malloc(str->length + 1, MEM_STRING);  // +1 for null
     if (copy == NULL) {
         fprintf(stderr, "Memory allocation failed in string_to_chars");
         return NULL;
     }
     
-    strcpy(copy, str->data);
+    memcpy(copy, str->data, str->length + 1);
     return copy;
 }
 
+/* hands the buffer over to the caller instead of copying it (only short
+ * strings in the inline buffer are copied out) and leaves `str` empty.
+ * the spare capacity is given back with mem_realloc, which may move the
+ * buffer */
+char* string_take(String* str, size_t* len) {
+    char* out = str->data;
+    if (out == str->inline_buf) {
+        out = mem_malloc(str->length + 1, MEM_STRING);
+        if (out == NULL) {
+            fprintf(stderr, "Memory allocation failed in string_take");
+            return NULL;
+        }
+        memcpy(out, str->data, str->length + 1);
+    } else if (str->capacity > str->length + 1) {
+        char* shrunk = mem_realloc(out, str->length + 1, MEM_STRING);
+        if (shrunk != NULL) out = shrunk;
+    }
+    if (len != NULL) *len = str->length;
+    string_init(str);
+    return out;
+}
+
 /* strlen analog */
 int string_len(const String* str) {
     return str->length;
@@ -115,9 +168,160 @@ int string_cmp(const String* s1, const String* s2) {
 /* strdup analog; creates new c-str by copy */
 char* strdup_local(const char* s) {
    size_t len = strlen(s) + 1;
-   char* new_str = malloc(len);
+   char* new_str = mem_malloc(len, MEM_STRING);
    if (new_str) {
        memcpy(new_str, s, len);
    }
    return new_str;
 }
+
+/* --- builder --- */
+
+#define STRING_CHUNK_MIN (4 * 1024)
+#define STRING_CHUNK_MAX_SHIFT 8        // chunks grow up to 1 MB
+#define STRING_IOV_BATCH 64
+
+/* holds data[start, end). appended chunks fill up from the front,
+ * prepended ones from the back; all but the outermost two are full */
+struct StringChunk {
+    StringChunk* next;
+    size_t start;
+    size_t end;
+    size_t capacity;
+    char data[];
+};
+
+void string_builder_init(StringBuilder* b) {
+    b->head = NULL;
+    b->tail = NULL;
+    b->length = 0;
+    b->n_chunks = 0;
+}
+
+void string_builder_free(StringBuilder* b) {
+    StringChunk* c = b->head;
+    while (c != NULL) {
+        StringChunk* next = c->next;
+        mem_free(c);
+        c = next;
+    }
+    string_builder_init(b);
+}
+
+/* chunks double in size as the output grows, so large outputs stay a
+ * handful of chunks and small ones don't reserve much */
+static StringChunk* string_chunk_new(StringBuilder* b, bool from_back) {
+    size_t shift = (b->n_chunks < STRING_CHUNK_MAX_SHIFT)
+                 ? b->n_chunks : STRING_CHUNK_MAX_SHIFT;
+    size_t capacity = (size_t)STRING_CHUNK_MIN << shift;
+    StringChunk* c = mem_malloc(sizeof(StringChunk) + capacity, MEM_STRING);
+    if (c == NULL) {
+        fprintf(stderr, "malloc StringChunk failed!");
+        return NULL;
+    }
+    c->next = NULL;
+    c->capacity = capacity;
+    c->start = c->end = from_back ? capacity : 0;
+    b->n_chunks++;
+    return c;
+}
+
+/* false on allocation failure, with whatever fit already appended */
+bool string_builder_append(StringBuilder* b, const char* src, size_t len) {
+    while (len > 0) {
+        StringChunk* c = b->tail;
+        if (c == NULL || c->end == c->capacity) {
+            c = string_chunk_new(b, false);
+            if (c == NULL) return false;
+            if (b->tail == NULL) b->head = c;
+            else                 b->tail->next = c;
+            b->tail = c;
+        }
+        size_t n = c->capacity - c->end;
+        if (n > len) n = len;
+        memcpy(c->data + c->end, src, n);
+        c->end += n;
+        src += n;
+        len -= n;
+        b->length += n;
+    }
+    return true;
+}
+
+/* false on allocation failure, with the tail of `src` that fit prepended */
+bool string_builder_prepend(StringBuilder* b, const char* src, size_t len) {
+    while (len > 0) {
+        StringChunk* c = b->head;
+        if (c == NULL || c->start == 0) {
+            c = string_chunk_new(b, true);
+            if (c == NULL) return false;
+            c->next = b->head;
+            if (b->tail == NULL) b->tail = c;
+            b->head = c;
+        }
+        size_t n = (c->start < len) ? c->start : len;
+        memcpy(c->data + c->start - n, src + len - n, n);
+        c->start -= n;
+        len -= n;
+        b->length += n;
+    }
+    return true;
+}
+
+/* copies the contents into one null-terminated buffer, caller owns */
+char* string_builder_flatten(const StringBuilder* b, size_t* len) {
+    char* out = mem_malloc(b->length + 1, MEM_STRING);
+    if (out == NULL) {
+        fprintf(stderr, "Memory allocation failed in string_builder_flatten");
+        return NULL;
+    }
+    size_t at = 0;
+    for (StringChunk* c = b->head; c != NULL; c = c->next) {
+        memcpy(out + at, c->data + c->start, c->end - c->start);
+        at += c->end - c->start;
+    }
+    out[at] = '\0';
+    if (len != NULL) *len = at;
+    return out;
+}
+
+/* writes the contents to `fd` straight from the chunks, retrying short
+ * writes. false on error, with errno set by writev */
+bool string_builder_writev(const StringBuilder* b, int fd) {
+    struct iovec iov[STRING_IOV_BATCH];
+    StringChunk* c = b->head;
+    size_t done = 0;    // bytes of `c` already written
+    for (;;) {
+        while (c != NULL && done == c->end - c->start) {
+            c = c->next;
+            done = 0;
+        }
+        if (c == NULL) return true;
+
+        int n = 0;
+        size_t skip = done;
+        for (StringChunk* it = c; it != NULL && n < STRING_IOV_BATCH;
+                it = it->next, skip = 0) {
+            if (it->end - it->start == skip) continue;
+            iov[n].iov_base = it->data + it->start + skip;
+            iov[n].iov_len = it->end - it->start - skip;
+            n++;
+        }
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t left = (size_t)written;
+        while (left > 0) {
+            size_t rest = c->end - c->start - done;
+            if (left < rest) {
+                done += left;
+                break;
+            }
+            left -= rest;
+            c = c->next;
+            done = 0;
+        }
+    }
+}
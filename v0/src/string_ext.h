@@ -2,24 +2,53 @@
 #define STRING_EXT_H
 
 #include <stdlib.h>
-#define DEFAULT_STRING_CAPACITY 8
+#include <stdbool.h> // bool
+#define STRING_INLINE_CAPACITY 24
 
+/* short strings live in `inline_buf` and `data` points at it, so a String
+ * must not be copied by value; strings that outgrow it move to the heap */
 typedef struct {
     char* data;
     size_t capacity;
     size_t length;
+    char inline_buf[STRING_INLINE_CAPACITY];
 } String;
 
 String* string_new(size_t capacity);
 String* string_from(const char* src);
 String* string_concat(const String* str1, const String* str2);
 void string_free(String* str);
+void string_init(String* str);
+void string_deinit(String* str);
 void string_print(const String* str);
 void string_append(String* dst, const char* src);
+void string_append_n(String* dst, const char* src, size_t len);
 void string_prepend(String* dst, const char* src);
+void string_prepend_n(String* dst, const char* src, size_t len);
 int string_len(const String* str);
 int string_cmp(const String* s1, const String* s2);
 char* string_to_chars(const String* str);
+char* string_take(String* str, size_t* len);
 char* strdup_local(const char* s);
 
+/* a rope of chunks for building large outputs: appends and prepends are
+ * O(len) and never move what was already written. the result is copied
+ * once by string_builder_flatten, or not at all by string_builder_writev */
+
+typedef struct StringChunk StringChunk;
+
+typedef struct {
+    StringChunk* head;
+    StringChunk* tail;
+    size_t length;
+    size_t n_chunks;
+} StringBuilder;
+
+void string_builder_init(StringBuilder* b);
+void string_builder_free(StringBuilder* b);
+bool string_builder_append(StringBuilder* b, const char* src, size_t len);
+bool string_builder_prepend(StringBuilder* b, const char* src, size_t len);
+char* string_builder_flatten(const StringBuilder* b, size_t* len);
+bool string_builder_writev(const StringBuilder* b, int fd);
+
 #endif // STRING_EXT_H
@@ -1,16 +1,19 @@
 #include "tensor.h"
 #include "string_ext.h"     // for string repr
+#include "parallel.h"       // parallel_for
+#include "mem.h"
+#include "trace.h"
 #include <string.h>         // memcpy
 #include <stdio.h>          // snprintf
 #include <float.h>          // DBL_DECIMAL_DIG
 
 /* allocates new vec, caller owns returned vec */
 Vec* vec_init(size_t dim) {
-    Vec* vec = malloc(sizeof(Vec));
+    Vec* vec = mem_malloc(sizeof(Vec), MEM_VEC);
     if (vec == NULL) return NULL;
     
     vec->dim = dim;
-    vec->data = malloc(dim * sizeof(float));
+    vec->data = mem_malloc(dim * sizeof(float), MEM_VEC);
     return vec;
 }
 
@@ -22,9 +25,9 @@ Vec* vec_from_copy(const float* data, size_t dim) {
     memcpy(v->data, data, dim * sizeof(float)); 
     return v;
 }
-/* references data, caller owns returned vec */
+/* takes ownership of data (from mem_malloc), caller owns returned vec */
 Vec* vec_from_takes(float* data, size_t dim) {
-    Vec* vec = malloc(sizeof(Vec));
+    Vec* vec = mem_malloc(sizeof(Vec), MEM_VEC);
     if (vec == NULL) return NULL;
     vec->dim = dim;
     vec->data = data;
@@ -34,29 +37,172 @@ Vec* vec_from_takes(float* data, size_t dim) {
 /* frees vec and its data */
 void vec_free(Vec* v) {
     if (v == NULL) return;
-    if (v->data) free(v->data);
-    free(v);
+    if (v->data) mem_free(v->data);
+    mem_free(v);
 }
 
-/* returns new string representation, caller must free */
-char* vec_to_str(Vec* v) {
-    if (v == NULL || v->data == NULL) return strdup_local("");
+/* elements per parallel_for range: big enough to amortize the handoff */
+#define VEC_GRAIN (1 << 14)
 
-    String* s = string_from("[");
-    char buffer[32];
+/* independent partial sums, so reductions vectorize without -ffast-math */
+#define VEC_LANES 16
 
-    for (size_t i = 0; i < v->dim; i++) {
-        if (i > 0) string_append(s, ", ");
-        snprintf(buffer, sizeof(buffer), "%.*g", 
-                 DBL_DECIMAL_DIG, v->data[i]);
-        string_append(s, buffer);
+typedef enum { OP_ADD, OP_MUL, OP_SCALE, OP_AXPY } VecOp;
+
+typedef struct {
+    VecOp op;
+    const float* a;
+    const float* b;
+    float* out;
+    float s;
+} VecOpArgs;
+
+static void vec_op_range(void* ctx, size_t begin, size_t end) {
+    VecOpArgs* args = ctx;
+    const float* a = args->a;
+    const float* b = args->b;
+    float* out = args->out;
+    float s = args->s;
+    switch (args->op) {
+        case OP_ADD:
+            for (size_t i = begin; i < end; i++) out[i] = a[i] + b[i];
+            break;
+        case OP_MUL:
+            for (size_t i = begin; i < end; i++) out[i] = a[i] * b[i];
+            break;
+        case OP_SCALE:
+            for (size_t i = begin; i < end; i++) out[i] = a[i] * s;
+            break;
+        case OP_AXPY:   // out = s * a + out
+            for (size_t i = begin; i < end; i++) out[i] += s * a[i];
+            break;
     }
-    string_append(s, "]");
-    char* result = string_to_chars(s);
-    string_free(s);
+}
 
-    return result;
+static void vec_op(VecOp op, const float* a, const float* b, float* out,
+                   float s, size_t dim) {
+    VecOpArgs args = { op, a, b, out, s };
+    parallel_for(dim, VEC_GRAIN, vec_op_range, &args);
 }
 
+/* out = a + b */
+bool vec_add(const Vec* a, const Vec* b, Vec* out) {
+    if (a->dim != b->dim || a->dim != out->dim) return false;
+    vec_op(OP_ADD, a->data, b->data, out->data, 0, a->dim);
+    return true;
+}
 
+/* out = a * b, elementwise */
+bool vec_mul(const Vec* a, const Vec* b, Vec* out) {
+    if (a->dim != b->dim || a->dim != out->dim) return false;
+    vec_op(OP_MUL, a->data, b->data, out->data, 0, a->dim);
+    return true;
+}
 
+/* out = s * a */
+bool vec_scale(const Vec* a, float s, Vec* out) {
+    if (a->dim != out->dim) return false;
+    vec_op(OP_SCALE, a->data, NULL, out->data, s, a->dim);
+    return true;
+}
+
+/* y += alpha * x */
+bool vec_axpy(float alpha, const Vec* x, Vec* y) {
+    if (x->dim != y->dim) return false;
+    vec_op(OP_AXPY, x->data, NULL, y->data, alpha, x->dim);
+    return true;
+}
+
+typedef struct {
+    const float* a;
+    const float* b;
+    size_t dim;
+    double* partials;   // one per VEC_GRAIN chunk
+} VecDotArgs;
+
+static double vec_dot_chunk(const float* a, const float* b, size_t n) {
+    float acc[VEC_LANES] = {0};
+    size_t i = 0;
+    for (; i + VEC_LANES <= n; i += VEC_LANES)
+        for (size_t j = 0; j < VEC_LANES; j++) acc[j] += a[i + j] * b[i + j];
+    double sum = 0;
+    for (; i < n; i++) sum += (double)a[i] * b[i];
+    for (size_t j = 0; j < VEC_LANES; j++) sum += acc[j];
+    return sum;
+}
+
+/* chunks are fixed-size rather than one per thread, so the summation
+ * order (and the result) doesn't depend on the thread count */
+static void vec_dot_range(void* ctx, size_t begin, size_t end) {
+    VecDotArgs* args = ctx;
+    for (size_t c = begin; c < end; c++) {
+        size_t lo = c * VEC_GRAIN;
+        size_t hi = (lo + VEC_GRAIN < args->dim) ? lo + VEC_GRAIN : args->dim;
+        args->partials[c] = vec_dot_chunk(args->a + lo, args->b + lo, hi - lo);
+    }
+}
+
+/* *out = sum(a * b), accumulated in double across chunks */
+bool vec_dot(const Vec* a, const Vec* b, float* out) {
+    if (a->dim != b->dim) return false;
+    size_t n_chunks = (a->dim + VEC_GRAIN - 1) / VEC_GRAIN;
+    double stack_partials[64];
+    double* partials = stack_partials;
+    if (n_chunks > 64) {
+        partials = mem_malloc(n_chunks * sizeof(double), MEM_VEC);
+        if (partials == NULL) {
+            fprintf(stderr, "malloc partials failed!");
+            return false;
+        }
+    }
+    VecDotArgs args = { a->data, b->data, a->dim, partials };
+    parallel_for(n_chunks, 1, vec_dot_range, &args);
+    double sum = 0;
+    for (size_t c = 0; c < n_chunks; c++) sum += partials[c];
+    if (partials != stack_partials) mem_free(partials);
+    *out = (float)sum;
+    return true;
+}
+
+/* views `v` as rows x cols; an empty view (data NULL) if the sizes don't
+ * match. the view is only valid while `v` is */
+Mat mat_view(const Vec* v, size_t rows, size_t cols) {
+    Mat m = { NULL, 0, 0, 0 };
+    if (v == NULL || v->data == NULL || rows * cols != v->dim) return m;
+    m.data = v->data;
+    m.rows = rows;
+    m.cols = cols;
+    m.stride = cols;
+    return m;
+}
+
+/* appends the string representation to `out` */
+void vec_write(const Vec* v, String* out) {
+    if (v == NULL || v->data == NULL) return;
+
+    TRACE_BEGIN(TRACE_VEC_TO_STR);
+    size_t start = out->length;
+    char buffer[32];
+    string_append_n(out, "[", 1);
+    for (size_t i = 0; i < v->dim; i++) {
+        if (i > 0) string_append_n(out, ", ", 2);
+        int len = snprintf(buffer, sizeof(buffer), "%.*g",
+                           DBL_DECIMAL_DIG, v->data[i]);
+        string_append_n(out, buffer, (size_t)len);
+    }
+    string_append_n(out, "]", 1);
+    TRACE_END(TRACE_VEC_TO_STR, out->length - start, v->dim);
+}
+
+/* returns new string representation, caller must free */
+char* vec_to_str(Vec* v) {
+    if (v == NULL || v->data == NULL) return mem_strdup("", MEM_STRING);
+
+    String s;
+    string_init(&s);
+    vec_write(v, &s);
+    char* result = string_take(&s, NULL);
+    string_deinit(&s);
+
+    return result;
+}
@@ -2,18 +2,40 @@
 #define TENSOR_H
 
 #include <stdlib.h> // size_t
+#include <stdbool.h> // bool
+#include "string_ext.h" // String
 
 typedef struct {
     float* data;
     size_t dim;
 } Vec;
 
+/* a row-major view of floats it doesn't own: row r starts at
+ * data + r * stride, with stride >= cols */
+typedef struct {
+    float* data;
+    size_t rows;
+    size_t cols;
+    size_t stride;
+} Mat;
+
 
 Vec* vec_init(size_t dim);
 Vec* vec_from_copy(const float* data, size_t dim);
 Vec* vec_from_takes(float* data, size_t dim);
 void vec_free(Vec* v);
 char* vec_to_str(Vec* v);
+void vec_write(const Vec* v, String* out);
+
+// elementwise kernels, threaded through parallel_for. all return false
+// (and do nothing) if the dims don't match; `out` may alias an input
+bool vec_add(const Vec* a, const Vec* b, Vec* out);
+bool vec_mul(const Vec* a, const Vec* b, Vec* out);
+bool vec_scale(const Vec* a, float s, Vec* out);
+bool vec_axpy(float alpha, const Vec* x, Vec* y);
+bool vec_dot(const Vec* a, const Vec* b, float* out);
+
+Mat mat_view(const Vec* v, size_t rows, size_t cols);
 
 
 #endif // TENSOR_H
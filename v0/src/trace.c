@@ -0,0 +1,234 @@
+#define _POSIX_C_SOURCE 200809L    // pthread
+// the counters are always built, JSON_TRACE only decides whether the call
+// sites in the library record into them
+#ifndef JSON_TRACE
+#define JSON_TRACE
+#endif
+#include "trace.h"
+#include "json.h"
+#include "mem.h"
+#include <stdio.h>          // fopen, fputs
+#include <stdbool.h>        // bool
+#include <string.h>         // memset
+#include <time.h>           // timespec_get
+#include <stdatomic.h>      // atomic_uint_fast64_t
+#include <pthread.h>        // pthread_mutex_t, pthread_once
+
+enum { FIELD_CALLS, FIELD_CYCLES, FIELD_BYTES, FIELD_ITEMS, N_FIELDS };
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    TraceStage stage;
+} TraceEvent;
+
+/* one per thread that ever recorded. only its owner writes to it; other
+ * threads read it through the atomics, so it is never freed */
+typedef struct TraceThread TraceThread;
+struct TraceThread {
+    TraceThread* next;
+    uint32_t tid;
+    atomic_uint_fast64_t stats[TRACE_STAGE_COUNT][N_FIELDS];
+    TraceEvent* events;             // allocated on the first span
+    atomic_size_t n_events;
+    atomic_uint_fast64_t dropped;
+};
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceThread* threads = NULL;
+static uint32_t next_tid = 1;
+static _Thread_local TraceThread* local = NULL;
+
+// a (ticks, ns) pair taken before the first event, to convert spans to time
+static pthread_once_t anchor_once = PTHREAD_ONCE_INIT;
+static uint64_t anchor_ticks;
+static uint64_t anchor_ns;
+
+static const bool is_span[TRACE_STAGE_COUNT] = {
+    [TRACE_PARSE] = true,
+    [TRACE_PARSE_VEC] = true,
+    [TRACE_DUMP] = true,
+    [TRACE_VEC_TO_STR] = true,
+};
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void anchor_init(void) {
+    anchor_ns = wall_ns();
+    anchor_ticks = trace_now();
+}
+
+/* allocated with libc: going through mem_malloc would record TRACE_ALLOC
+ * from inside trace_record */
+static TraceThread* trace_thread(void) {
+    if (local != NULL) return local;
+    pthread_once(&anchor_once, anchor_init);
+    TraceThread* t = calloc(1, sizeof(TraceThread));
+    if (t == NULL) return NULL;
+    pthread_mutex_lock(&threads_lock);
+    t->tid = next_tid++;
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&threads_lock);
+    local = t;
+    return local;
+}
+
+static void counter_add(atomic_uint_fast64_t* c, uint64_t x) {
+    // single writer: a relaxed load and store, no locked add needed
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + x,
+                          memory_order_relaxed);
+}
+
+/* called by TRACE_END; `start` comes from TRACE_BEGIN */
+void trace_record(TraceStage stage, uint64_t start,
+                  uint64_t bytes, uint64_t items) {
+    uint64_t end = trace_now();
+    TraceThread* t = trace_thread();
+    if (t == NULL) return;
+    counter_add(&t->stats[stage][FIELD_CALLS], 1);
+    counter_add(&t->stats[stage][FIELD_CYCLES], end - start);
+    counter_add(&t->stats[stage][FIELD_BYTES], bytes);
+    counter_add(&t->stats[stage][FIELD_ITEMS], items);
+    if (!is_span[stage]) return;
+
+    if (t->events == NULL)
+        t->events = malloc(TRACE_MAX_EVENTS * sizeof(TraceEvent));
+    size_t n = atomic_load_explicit(&t->n_events, memory_order_relaxed);
+    if (t->events == NULL || n == TRACE_MAX_EVENTS) {
+        counter_add(&t->dropped, 1);
+        return;
+    }
+    t->events[n] = (TraceEvent){ start, end, stage };
+    atomic_store_explicit(&t->n_events, n + 1, memory_order_release);
+}
+
+/* sums the counters of every thread */
+void trace_read(TraceStats out[TRACE_STAGE_COUNT]) {
+    memset(out, 0, TRACE_STAGE_COUNT * sizeof(TraceStats));
+    pthread_mutex_lock(&threads_lock);
+    for (TraceThread* t = threads; t != NULL; t = t->next) {
+        for (size_t s = 0; s < TRACE_STAGE_COUNT; s++) {
+            atomic_uint_fast64_t* f = t->stats[s];
+            out[s].calls += atomic_load_explicit(f + FIELD_CALLS,
+                                                 memory_order_relaxed);
+            out[s].cycles += atomic_load_explicit(f + FIELD_CYCLES,
+                                                  memory_order_relaxed);
+            out[s].bytes += atomic_load_explicit(f + FIELD_BYTES,
+                                                 memory_order_relaxed);
+            out[s].items += atomic_load_explicit(f + FIELD_ITEMS,
+                                                 memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/* zeroes every counter and drops the recorded spans. only meant to be
+ * called while no other thread is tracing */
+void trace_reset(void) {
+    pthread_mutex_lock(&threads_lock);
+    for (TraceThread* t = threads; t != NULL; t = t->next) {
+        for (size_t s = 0; s < TRACE_STAGE_COUNT; s++)
+            for (size_t f = 0; f < N_FIELDS; f++)
+                atomic_store_explicit(&t->stats[s][f], 0,
+                                      memory_order_relaxed);
+        atomic_store_explicit(&t->n_events, 0, memory_order_relaxed);
+        atomic_store_explicit(&t->dropped, 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/* spans that did not fit in TRACE_MAX_EVENTS, summed over threads */
+uint64_t trace_events_dropped(void) {
+    uint64_t dropped = 0;
+    pthread_mutex_lock(&threads_lock);
+    for (TraceThread* t = threads; t != NULL; t = t->next)
+        dropped += atomic_load_explicit(&t->dropped, memory_order_relaxed);
+    pthread_mutex_unlock(&threads_lock);
+    return dropped;
+}
+
+const char* trace_stage_name(TraceStage stage) {
+    static const char* names[TRACE_STAGE_COUNT] = {
+        "json_parse", "parse_vec", "strtof", "parse_string",
+        "whitespace", "json_dumps", "vec_to_str", "alloc",
+    };
+    return (stage < TRACE_STAGE_COUNT) ? names[stage] : "unknown";
+}
+
+/* the totals, keyed by stage name */
+static JsonObject* trace_totals(void) {
+    TraceStats stats[TRACE_STAGE_COUNT];
+    trace_read(stats);
+    JsonObject* totals = json_init();
+    for (size_t s = 0; s < TRACE_STAGE_COUNT; s++) {
+        JsonObject* stage = json_init();
+        json_set_num(stage, "calls", (double)stats[s].calls);
+        json_set_num(stage, "cycles", (double)stats[s].cycles);
+        json_set_num(stage, "bytes", (double)stats[s].bytes);
+        json_set_num(stage, "items", (double)stats[s].items);
+        json_set_obj(totals, trace_stage_name(s), stage);
+    }
+    json_set_num(totals, "dropped_events", (double)trace_events_dropped());
+    return totals;
+}
+
+/* writes the recorded spans as a chrome trace (chrome://tracing, perfetto)
+ * with the per-stage totals under "otherData". returns 0, or -1 if the
+ * file could not be written */
+int trace_export_chrome(const char* filename) {
+    pthread_once(&anchor_once, anchor_init);
+    double us_per_tick = (double)(wall_ns() - anchor_ns) / 1000.0
+                       / (double)(trace_now() - anchor_ticks + 1);
+    JsonObject* totals = trace_totals();
+
+    pthread_mutex_lock(&threads_lock);
+    size_t n = 0;
+    for (TraceThread* t = threads; t != NULL; t = t->next)
+        n += atomic_load_explicit(&t->n_events, memory_order_acquire);
+    JsonObject** events = mem_malloc((n ? n : 1) * sizeof(JsonObject*),
+                                     MEM_OTHER);
+    if (events == NULL) {
+        pthread_mutex_unlock(&threads_lock);
+        json_free(totals);
+        return -1;
+    }
+    size_t i = 0;
+    for (TraceThread* t = threads; t != NULL && i < n; t = t->next) {
+        size_t count = atomic_load_explicit(&t->n_events, memory_order_acquire);
+        for (size_t e = 0; e < count && i < n; e++) {
+            TraceEvent ev = t->events[e];
+            JsonObject* o = json_init();
+            json_set_str(o, "name", trace_stage_name(ev.stage));
+            json_set_str(o, "cat", "json");
+            json_set_str(o, "ph", "X");
+            json_set_num(o, "ts",
+                         (double)(ev.start - anchor_ticks) * us_per_tick);
+            json_set_num(o, "dur",
+                         (double)(ev.end - ev.start) * us_per_tick);
+            json_set_num(o, "pid", 1);
+            json_set_num(o, "tid", t->tid);
+            events[i++] = o;
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+
+    JsonObject* doc = json_init();
+    json_set_arr(doc, "traceEvents", J_OBJ, (void**)events, i);
+    json_set_str(doc, "displayTimeUnit", "ns");
+    json_set_obj(doc, "otherData", totals);
+    mem_free(events);
+
+    char* out = json_dumps(doc);
+    json_free(doc);
+    if (out == NULL) return -1;
+    FILE* file = fopen(filename, "w");
+    int res = (file != NULL && fputs(out, file) >= 0) ? 0 : -1;
+    if (file != NULL && fclose(file) != 0) res = -1;
+    mem_free(out);
+    return res;
+}
@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h> // uint64_t
+#include <stdlib.h> // size_t
+
+/* hot-path counters for the parse and dump stages. they are compiled in
+ * with -DJSON_TRACE (`make TRACE=1`, after a `make clean`); otherwise the
+ * TRACE_* macros expand to nothing and the api below reports zeros.
+ *
+ * each thread counts into its own slots and trace_read sums them. cycles
+ * are inclusive: TRACE_PARSE includes the strtof calls made under it. the
+ * coarse stages (parse, parse_vec, dump, vec_to_str) are also kept as
+ * timed spans, up to TRACE_MAX_EVENTS per thread, for trace_export_chrome */
+
+typedef enum {
+    TRACE_PARSE,        // json_parse: bytes of input
+    TRACE_PARSE_VEC,    // numeric arrays: bytes, floats
+    TRACE_STRTOF,       // float conversion: bytes, floats
+    TRACE_PARSE_STRING, // string copies: bytes
+    TRACE_WHITESPACE,   // whitespace runs: bytes
+    TRACE_DUMP,         // json_dumps(_cached): bytes of output
+    TRACE_VEC_TO_STR,   // vec_write and vec_to_str: bytes, floats
+    TRACE_ALLOC,        // mem_malloc / calloc / realloc: bytes requested
+    TRACE_STAGE_COUNT,
+} TraceStage;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t cycles;    // timestamp counter ticks
+    uint64_t bytes;
+    uint64_t items;
+} TraceStats;
+
+#define TRACE_MAX_EVENTS (1 << 16)
+
+void trace_read(TraceStats out[TRACE_STAGE_COUNT]);
+void trace_reset(void);
+uint64_t trace_events_dropped(void);
+const char* trace_stage_name(TraceStage stage);
+int trace_export_chrome(const char* filename);
+
+#ifdef JSON_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // __rdtsc
+static inline uint64_t trace_now(void) {
+    return __rdtsc();
+}
+#else
+#include <time.h>       // timespec_get
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+void trace_record(TraceStage stage, uint64_t start,
+                  uint64_t bytes, uint64_t items);
+
+#define TRACE_BEGIN(stage) uint64_t trace_start_##stage = trace_now()
+#define TRACE_END(stage, bytes, items) \
+    trace_record(stage, trace_start_##stage, bytes, items)
+
+#else
+
+// sizeof doesn't evaluate its operand, it only keeps the counts "used"
+#define TRACE_BEGIN(stage) ((void)0)
+#define TRACE_END(stage, bytes, items) ((void)sizeof((bytes) + (items)))
+
+#endif // JSON_TRACE
+
+#endif // TRACE_H
@@ -0,0 +1,1023 @@
+#include "vec_index.h"
+#include "parallel.h"       // parallel_for, parallel_threads
+#include "mem.h"
+#include <stdatomic.h>      // atomic_bool
+#include <limits.h>         // UINT_MAX
+#include <stdio.h>          // fprintf
+#include <string.h>         // memcpy, memset, strcmp
+#include <math.h>           // INFINITY, sqrt, log, floor
+
+/* independent partial sums, so the distances vectorize without
+ * -ffast-math */
+#define INDEX_LANES 16
+
+/* queries per flat search task: each chunk of stored vectors is compared
+ * with all of them, FLAT_QUERY_BLOCK at a time, while it's in cache */
+#define FLAT_QUERY_CHUNK 64
+#define FLAT_QUERY_BLOCK 4
+#define FLAT_CHUNK_BYTES (1 << 17)
+
+/* fewest stored vectors a flat search splits off for a thread */
+#define FLAT_MIN_PART 4096
+
+/* queries per parallel_for range of an hnsw search, each range sets up
+ * its own visited marks */
+#define HNSW_QUERY_GRAIN 16
+#define HNSW_MAX_LEVEL   31
+
+/* --- storage --- */
+
+typedef struct {
+    float* data;            // count x dim
+    size_t dim;
+    size_t count;
+    size_t capacity;        // vectors
+    VecMetric metric;
+} VecStore;
+
+static bool store_reserve(VecStore* s, size_t n) {
+    if (n <= s->capacity) return true;
+    size_t capacity = s->capacity ? s->capacity : 64;
+    while (capacity < n) capacity *= 2;
+    float* data = mem_realloc(s->data, capacity * s->dim * sizeof(float),
+                              MEM_INDEX);
+    if (data == NULL) {
+        fprintf(stderr, "malloc index vectors failed!");
+        return false;
+    }
+    s->data = data;
+    s->capacity = capacity;
+    return true;
+}
+
+static const float* store_row(const VecStore* s, size_t i) {
+    return s->data + i * s->dim;
+}
+
+/* copies x, scaled to unit length for VEC_COSINE; zeros stay zeros */
+static void store_copy(VecMetric metric, float* dst, const float* x,
+                       size_t dim) {
+    double norm = 0;
+    if (metric == VEC_COSINE)
+        for (size_t c = 0; c < dim; c++) norm += (double)x[c] * x[c];
+    float scale = (norm > 0) ? (float)(1.0 / sqrt(norm)) : 1;
+    for (size_t c = 0; c < dim; c++) dst[c] = x[c] * scale;
+}
+
+static bool store_add(VecStore* s, const Mat* rows) {
+    if (rows == NULL || rows->cols != s->dim || rows->stride < rows->cols
+        || (rows->rows > 0 && rows->data == NULL))
+        return false;
+    if (!store_reserve(s, s->count + rows->rows)) return false;
+    for (size_t i = 0; i < rows->rows; i++)
+        store_copy(s->metric, s->data + (s->count + i) * s->dim,
+                   rows->data + i * rows->stride, s->dim);
+    s->count += rows->rows;
+    return true;
+}
+
+/* the queries as searched: normalized copies for VEC_COSINE (into
+ * *buffer, to be freed), the caller's rows otherwise */
+static bool store_queries(const VecStore* s, const Mat* queries,
+                          float** buffer, Mat* out) {
+    *buffer = NULL;
+    if (queries == NULL || queries->cols != s->dim
+        || queries->stride < queries->cols
+        || (queries->rows > 0 && queries->data == NULL))
+        return false;
+    *out = *queries;
+    if (s->metric != VEC_COSINE || queries->rows == 0) return true;
+    *buffer = mem_malloc(queries->rows * s->dim * sizeof(float), MEM_INDEX);
+    if (*buffer == NULL) {
+        fprintf(stderr, "malloc index queries failed!");
+        return false;
+    }
+    for (size_t i = 0; i < queries->rows; i++)
+        store_copy(VEC_COSINE, *buffer + i * s->dim,
+                   queries->data + i * queries->stride, s->dim);
+    *out = (Mat){ *buffer, queries->rows, s->dim, s->dim };
+    return true;
+}
+
+/* --- distances: smaller is nearer --- */
+
+/* lanes are folded pairwise, the tail is added last */
+static inline float lanes_sum(float acc[INDEX_LANES], float tail) {
+    for (size_t w = INDEX_LANES / 2; w > 0; w /= 2)
+        for (size_t j = 0; j < w; j++) acc[j] += acc[j + w];
+    return acc[0] + tail;
+}
+
+static inline float index_dot(const float* a, const float* b, size_t n) {
+    float acc[INDEX_LANES] = {0};
+    size_t i = 0;
+    for (; i + INDEX_LANES <= n; i += INDEX_LANES)
+        for (size_t j = 0; j < INDEX_LANES; j++) acc[j] += a[i + j] * b[i + j];
+    float tail = 0;
+    for (; i < n; i++) tail += a[i] * b[i];
+    return lanes_sum(acc, tail);
+}
+
+static inline float index_l2(const float* a, const float* b, size_t n) {
+    float acc[INDEX_LANES] = {0};
+    size_t i = 0;
+    for (; i + INDEX_LANES <= n; i += INDEX_LANES) {
+        for (size_t j = 0; j < INDEX_LANES; j++) {
+            float d = a[i + j] - b[i + j];
+            acc[j] += d * d;
+        }
+    }
+    float tail = 0;
+    for (; i < n; i++) tail += (a[i] - b[i]) * (a[i] - b[i]);
+    return lanes_sum(acc, tail);
+}
+
+static inline float index_dist(VecMetric metric, const float* a,
+                               const float* b, size_t n) {
+    switch (metric) {
+        case VEC_L2:     return index_l2(a, b, n);
+        case VEC_COSINE: return 1 - index_dot(a, b, n);
+        case VEC_DOT:    return -index_dot(a, b, n);
+    }
+    return INFINITY;
+}
+
+/* --- heaps of hits, the worst on top --- */
+
+static bool hit_worse(VecHit a, VecHit b) {
+    return a.dist > b.dist || (a.dist == b.dist && a.id > b.id);
+}
+
+static void heap_sift_down(VecHit* heap, size_t n, size_t i) {
+    for (;;) {
+        size_t worst = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && hit_worse(heap[l], heap[worst])) worst = l;
+        if (r < n && hit_worse(heap[r], heap[worst])) worst = r;
+        if (worst == i) return;
+        VecHit t = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = t;
+        i = worst;
+    }
+}
+
+/* the heap's capacity is the caller's to check */
+static void heap_push(VecHit* heap, size_t* n, VecHit hit) {
+    size_t i = (*n)++;
+    while (i > 0 && hit_worse(hit, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = hit;
+}
+
+static VecHit heap_pop(VecHit* heap, size_t* n) {
+    VecHit top = heap[0];
+    heap[0] = heap[--*n];
+    heap_sift_down(heap, *n, 0);
+    return top;
+}
+
+/* keeps the k best of what's pushed */
+static void heap_offer(VecHit* heap, size_t* n, size_t k, VecHit hit) {
+    if (*n < k) {
+        heap_push(heap, n, hit);
+    } else if (hit_worse(heap[0], hit)) {
+        heap[0] = hit;
+        heap_sift_down(heap, k, 0);
+    }
+}
+
+/* in place, nearest first */
+static void heap_sort(VecHit* heap, size_t n) {
+    while (n > 1) {
+        VecHit top = heap[0];
+        heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0);
+        heap[n] = top;
+    }
+}
+
+/* fills the k - n slots past the n hits found */
+static void hits_pad(VecHit* hits, size_t n, size_t k) {
+    for (size_t i = n; i < k; i++)
+        hits[i] = (VecHit){ VEC_INDEX_NONE, INFINITY };
+}
+
+/* sorts a heap of n hits and pads them out to k */
+static void hits_finish(VecHit* hits, size_t n, size_t k) {
+    heap_sort(hits, n);
+    hits_pad(hits, n, k);
+}
+
+/* --- json --- */
+
+static const char* metric_name(VecMetric metric) {
+    switch (metric) {
+        case VEC_L2:     return "l2";
+        case VEC_COSINE: return "cosine";
+        case VEC_DOT:    return "dot";
+    }
+    return "";
+}
+
+static bool metric_parse(const char* name, VecMetric* out) {
+    for (VecMetric m = VEC_L2; m <= VEC_DOT; m++) {
+        if (strcmp(name, metric_name(m)) == 0) {
+            *out = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* json_set_num numbers come back from the parser as strings */
+static bool index_get_size(const JsonObject* obj, const char* k,
+                           size_t* out) {
+    double x;
+    char* s;
+    if (!json_get_num(obj, k, &x)) {
+        if (!json_get_str(obj, k, &s)) return false;
+        char* end;
+        x = strtod(s, &end);
+        if (end == s || *end != '\0') return false;
+    }
+    if (!(x >= 0 && x <= 9007199254740992.0) || x != floor(x)) return false;
+    *out = (size_t)x;
+    return true;
+}
+
+/* kind, metric, dim, count and a copy of the vectors */
+static JsonObject* store_to_json(const VecStore* s, const char* kind) {
+    JsonObject* obj = json_init();
+    if (obj == NULL) return NULL;
+    json_set_str(obj, "kind", kind);
+    json_set_str(obj, "metric", metric_name(s->metric));
+    json_set_num(obj, "dim", (double)s->dim);
+    json_set_num(obj, "count", (double)s->count);
+    // an empty list would read back as an array
+    if (s->count > 0) {
+        Vec* data = vec_from_copy(s->data, s->count * s->dim);
+        if (data == NULL || data->data == NULL) {
+            vec_free(data);
+            json_free(obj);
+            return NULL;
+        }
+        json_set_vec(obj, "data", data);
+    }
+    return obj;
+}
+
+/* reads what store_to_json wrote, checking the kind and the sizes; the
+ * vectors are copied as they are, already normalized */
+static bool store_from_json(const JsonObject* obj, const char* kind,
+                            VecStore* s) {
+    char* str;
+    size_t dim, count;
+    VecMetric metric;
+    *s = (VecStore){0};
+    if (obj == NULL || !json_get_str(obj, "kind", &str)
+        || strcmp(str, kind) != 0 || !json_get_str(obj, "metric", &str)
+        || !metric_parse(str, &metric) || !index_get_size(obj, "dim", &dim)
+        || !index_get_size(obj, "count", &count) || dim == 0)
+        return false;
+    *s = (VecStore){ NULL, dim, 0, 0, metric };
+    if (count == 0) return true;
+    Vec* data;
+    if (!json_get_vec(obj, "data", &data) || data->dim != count * dim
+        || !store_reserve(s, count))
+        return false;
+    memcpy(s->data, data->data, count * dim * sizeof(float));
+    s->count = count;
+    return true;
+}
+
+/* --- flat --- */
+
+struct FlatIndex {
+    VecStore store;
+};
+
+FlatIndex* flat_index_init(size_t dim, VecMetric metric) {
+    if (dim == 0) return NULL;
+    FlatIndex* index = mem_calloc(1, sizeof(FlatIndex), MEM_INDEX);
+    if (index == NULL) return NULL;
+    index->store = (VecStore){ NULL, dim, 0, 0, metric };
+    return index;
+}
+
+void flat_index_free(FlatIndex* index) {
+    if (index == NULL) return;
+    mem_free(index->store.data);
+    mem_free(index);
+}
+
+size_t flat_index_size(const FlatIndex* index) {
+    return index ? index->store.count : 0;
+}
+
+bool flat_index_add(FlatIndex* index, const Mat* rows) {
+    return index != NULL && store_add(&index->store, rows);
+}
+
+typedef struct {
+    const VecStore* store;
+    const Mat* queries;
+    size_t k;
+    size_t parts;           // ranges of the stored vectors per query chunk
+    VecHit* hits;           // parts x queries x k
+    atomic_bool failed;
+} FlatArgs;
+
+/* stored vectors [lo, lo + n) in groups of INDEX_LANES, each transposed:
+ * element c of the group's vectors is at group + c * INDEX_LANES. a short
+ * last group is padded with zeros */
+static void flat_transpose(const VecStore* s, size_t lo, size_t n,
+                           float* tile) {
+    size_t dim = s->dim;
+    for (size_t g = 0; g < n; g += INDEX_LANES) {
+        float* group = tile + g * dim;
+        for (size_t j = 0; j < INDEX_LANES; j++) {
+            const float* x = store_row(s, lo + g + j);
+            if (g + j < n)
+                for (size_t c = 0; c < dim; c++) group[c * INDEX_LANES + j] = x[c];
+            else
+                for (size_t c = 0; c < dim; c++) group[c * INDEX_LANES + j] = 0;
+        }
+    }
+}
+
+/* dist[r][j] of FLAT_QUERY_BLOCK queries to the vectors of a transposed
+ * group: a lane per vector, so there are no horizontal sums, and each
+ * row of the group is loaded once for all the queries. one function per
+ * metric, so the sums stay in registers */
+static void flat_group_l2(const float* q[], const float* group, size_t dim,
+                          float dist[][INDEX_LANES]) {
+    float acc[FLAT_QUERY_BLOCK][INDEX_LANES] = {{0}};
+    for (size_t c = 0; c < dim; c++) {
+        const float* x = group + c * INDEX_LANES;
+        for (size_t r = 0; r < FLAT_QUERY_BLOCK; r++) {
+            float qc = q[r][c];
+            for (size_t j = 0; j < INDEX_LANES; j++) {
+                float d = qc - x[j];
+                acc[r][j] += d * d;
+            }
+        }
+    }
+    memcpy(dist, acc, sizeof(acc));
+}
+
+/* the dot products, for 1 - sum or -sum */
+static void flat_group_dot(const float* q[], const float* group, size_t dim,
+                           float bias, float dist[][INDEX_LANES]) {
+    float acc[FLAT_QUERY_BLOCK][INDEX_LANES] = {{0}};
+    for (size_t c = 0; c < dim; c++) {
+        const float* x = group + c * INDEX_LANES;
+        for (size_t r = 0; r < FLAT_QUERY_BLOCK; r++) {
+            float qc = q[r][c];
+            for (size_t j = 0; j < INDEX_LANES; j++) acc[r][j] += qc * x[j];
+        }
+    }
+    for (size_t r = 0; r < FLAT_QUERY_BLOCK; r++)
+        for (size_t j = 0; j < INDEX_LANES; j++) dist[r][j] = bias - acc[r][j];
+}
+
+/* the k nearest of stored vectors [lo, hi) for queries [q0, q0 + nq):
+ * the vectors are taken a tile of tile_rows at a time, transposed once
+ * and then compared with every query */
+static void flat_scan(const FlatArgs* args, size_t q0, size_t nq, size_t lo,
+                      size_t hi, float* tile, size_t tile_rows,
+                      VecHit* hits) {
+    const VecStore* s = args->store;
+    size_t k = args->k;
+    size_t fill[FLAT_QUERY_CHUNK] = {0};
+    const float* q_rows[FLAT_QUERY_CHUNK];
+    for (size_t i = 0; i < nq; i++)
+        q_rows[i] = args->queries->data + (q0 + i) * args->queries->stride;
+
+    for (size_t b0 = lo; b0 < hi; b0 += tile_rows) {
+        size_t n = (hi - b0 < tile_rows) ? hi - b0 : tile_rows;
+        flat_transpose(s, b0, n, tile);
+        for (size_t i = 0; i < nq; i += FLAT_QUERY_BLOCK) {
+            // a short last block repeats its last query
+            const float* qb[FLAT_QUERY_BLOCK];
+            for (size_t r = 0; r < FLAT_QUERY_BLOCK; r++)
+                qb[r] = q_rows[(i + r < nq) ? i + r : nq - 1];
+            size_t rows = (nq - i < FLAT_QUERY_BLOCK) ? nq - i
+                                                      : FLAT_QUERY_BLOCK;
+            for (size_t g = 0; g < n; g += INDEX_LANES) {
+                float dist[FLAT_QUERY_BLOCK][INDEX_LANES];
+                const float* group = tile + g * s->dim;
+                if (s->metric == VEC_L2)
+                    flat_group_l2(qb, group, s->dim, dist);
+                else
+                    flat_group_dot(qb, group, s->dim,
+                                   (s->metric == VEC_COSINE) ? 1 : 0, dist);
+                size_t width = (n - g < INDEX_LANES) ? n - g : INDEX_LANES;
+                for (size_t r = 0; r < rows; r++) {
+                    VecHit* heap = hits + (i + r) * k;
+                    // most are further than the k-th best, and skipped
+                    float worst = (fill[i + r] < k) ? INFINITY : heap[0].dist;
+                    for (size_t j = 0; j < width; j++)
+                        if (dist[r][j] <= worst)
+                            heap_offer(heap, &fill[i + r], k,
+                                       (VecHit){ b0 + g + j, dist[r][j] });
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < nq; i++) hits_finish(hits + i * k, fill[i], k);
+}
+
+/* tasks are (query chunk, stored range) pairs; each range of them gets a
+ * tile of about FLAT_CHUNK_BYTES */
+static void flat_range(void* ctx, size_t begin, size_t end) {
+    FlatArgs* args = ctx;
+    size_t nq_total = args->queries->rows, count = args->store->count;
+    size_t dim = args->store->dim;
+    size_t tile_rows = FLAT_CHUNK_BYTES / (dim * sizeof(float))
+                     / INDEX_LANES * INDEX_LANES;
+    if (tile_rows == 0) tile_rows = INDEX_LANES;
+    float* tile = mem_malloc(tile_rows * dim * sizeof(float), MEM_INDEX);
+    if (tile == NULL) {
+        atomic_store(&args->failed, true);
+        return;
+    }
+    for (size_t t = begin; t < end; t++) {
+        size_t part = t % args->parts;
+        size_t q0 = t / args->parts * FLAT_QUERY_CHUNK;
+        size_t nq = (nq_total - q0 < FLAT_QUERY_CHUNK) ? nq_total - q0
+                                                      : FLAT_QUERY_CHUNK;
+        size_t lo = count * part / args->parts;
+        size_t hi = count * (part + 1) / args->parts;
+        flat_scan(args, q0, nq, lo, hi, tile, tile_rows,
+                  args->hits + (part * nq_total + q0) * args->k);
+    }
+    mem_free(tile);
+}
+
+/* out[i] = the best k of every part's k for query i */
+static void flat_merge_range(void* ctx, size_t begin, size_t end) {
+    const FlatArgs* args = ctx;
+    size_t k = args->k, nq_total = args->queries->rows;
+    VecHit* out = args->hits + args->parts * nq_total * k;
+    for (size_t i = begin; i < end; i++) {
+        VecHit* heap = out + i * k;
+        size_t n = 0;
+        for (size_t p = 0; p < args->parts; p++) {
+            const VecHit* part = args->hits + (p * nq_total + i) * k;
+            for (size_t j = 0; j < k && part[j].id != VEC_INDEX_NONE; j++)
+                heap_offer(heap, &n, k, part[j]);
+        }
+        hits_finish(heap, n, k);
+    }
+}
+
+bool flat_index_search(const FlatIndex* index, const Mat* queries, size_t k,
+                       VecHit* out) {
+    if (index == NULL || out == NULL) return false;
+    const VecStore* s = &index->store;
+    float* buffer;
+    Mat q;
+    if (!store_queries(s, queries, &buffer, &q)) return false;
+    if (q.rows == 0 || k == 0) {
+        mem_free(buffer);
+        return true;
+    }
+
+    // with fewer query chunks than threads, the stored vectors are split
+    // too, and each part's k best are merged after
+    size_t chunks = (q.rows + FLAT_QUERY_CHUNK - 1) / FLAT_QUERY_CHUNK;
+    size_t parts = parallel_threads() / chunks;
+    size_t max_parts = s->count / FLAT_MIN_PART;
+    if (parts > max_parts) parts = max_parts;
+    if (parts == 0) parts = 1;
+
+    FlatArgs args = { s, &q, k, parts, out, false };
+    VecHit* scratch = NULL;
+    if (parts > 1) {
+        scratch = mem_malloc((parts + 1) * q.rows * k * sizeof(VecHit),
+                             MEM_INDEX);
+        if (scratch == NULL) {
+            fprintf(stderr, "malloc index hits failed!");
+            mem_free(buffer);
+            return false;
+        }
+        args.hits = scratch;
+    }
+    parallel_for(chunks * parts, 1, flat_range, &args);
+    if (atomic_load(&args.failed)) {
+        fprintf(stderr, "malloc index tile failed!");
+        mem_free(scratch);
+        mem_free(buffer);
+        return false;
+    }
+    if (parts > 1) {
+        parallel_for(q.rows, FLAT_QUERY_CHUNK, flat_merge_range, &args);
+        memcpy(out, scratch + parts * q.rows * k, q.rows * k * sizeof(VecHit));
+    }
+    mem_free(scratch);
+    mem_free(buffer);
+    return true;
+}
+
+JsonObject* flat_index_to_json(const FlatIndex* index) {
+    return index ? store_to_json(&index->store, "flat") : NULL;
+}
+
+FlatIndex* flat_index_from_json(const JsonObject* obj) {
+    FlatIndex* index = mem_calloc(1, sizeof(FlatIndex), MEM_INDEX);
+    if (index == NULL) return NULL;
+    if (!store_from_json(obj, "flat", &index->store)) {
+        flat_index_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+/* --- hnsw --- */
+
+/* what one search needs besides the graph */
+typedef struct {
+    uint32_t* visited;      // per vector, the epoch it was last reached in
+    size_t n_visited;
+    uint32_t epoch;
+    VecHit* frontier;       // to expand, distances negated: nearest on top
+    size_t frontier_cap;
+    VecHit* best;           // the ef nearest so far, worst on top
+    size_t best_cap;
+} HnswScratch;
+
+struct HnswIndex {
+    VecStore store;
+    HnswParams params;
+    unsigned char* levels;  // top layer of each vector
+    uint32_t* links0;       // layer 0: per vector a count, then 2m ids
+    uint32_t** links;       // layers 1.. of each vector, m + 1 per layer,
+                            // NULL for vectors only on layer 0
+    size_t links_cap;       // vectors levels, links0 and links have room for
+    size_t entry;           // a vector on the top layer
+    size_t max_level;
+    HnswScratch scratch;    // for adds
+};
+
+static uint32_t* hnsw_links(const HnswIndex* index, size_t id, size_t layer) {
+    if (layer == 0) return index->links0 + id * (2 * index->params.m + 1);
+    return index->links[id] + (layer - 1) * (index->params.m + 1);
+}
+
+static size_t hnsw_max_links(const HnswIndex* index, size_t layer) {
+    return (layer == 0) ? 2 * index->params.m : index->params.m;
+}
+
+static float hnsw_dist(const HnswIndex* index, const float* q, size_t id) {
+    const VecStore* s = &index->store;
+    return index_dist(s->metric, q, store_row(s, id), s->dim);
+}
+
+/* layer l is reached with probability m^-l; drawn from the id and the
+ * seed, so an index loaded back goes on the same way */
+static size_t hnsw_level(const HnswIndex* index, size_t id) {
+    uint64_t z = index->params.seed + (uint64_t)id * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    double u = (double)((z >> 11) + 1) / 9007199254740992.0;   // (0, 1]
+    double level = floor(-log(u) / log((double)index->params.m));
+    return (level < HNSW_MAX_LEVEL) ? (size_t)level : HNSW_MAX_LEVEL;
+}
+
+static void scratch_deinit(HnswScratch* s) {
+    mem_free(s->visited);
+    mem_free(s->frontier);
+    mem_free(s->best);
+    memset(s, 0, sizeof(*s));
+}
+
+/* room to mark n vectors and keep ef + 1 best */
+static bool scratch_reserve(HnswScratch* s, size_t n, size_t ef) {
+    if (n > s->n_visited) {
+        size_t cap = s->n_visited ? s->n_visited : 1024;
+        while (cap < n) cap *= 2;
+        uint32_t* visited = mem_realloc(s->visited, cap * sizeof(uint32_t),
+                                        MEM_INDEX);
+        if (visited == NULL) return false;
+        memset(visited + s->n_visited, 0,
+               (cap - s->n_visited) * sizeof(uint32_t));
+        s->visited = visited;
+        s->n_visited = cap;
+    }
+    if (ef + 1 > s->best_cap) {
+        VecHit* best = mem_realloc(s->best, (ef + 1) * sizeof(VecHit),
+                                   MEM_INDEX);
+        if (best == NULL) return false;
+        s->best = best;
+        s->best_cap = ef + 1;
+    }
+    return true;
+}
+
+static bool frontier_push(HnswScratch* s, size_t* n, VecHit hit) {
+    if (*n == s->frontier_cap) {
+        size_t cap = s->frontier_cap ? 2 * s->frontier_cap : 256;
+        VecHit* frontier = mem_realloc(s->frontier, cap * sizeof(VecHit),
+                                       MEM_INDEX);
+        if (frontier == NULL) return false;
+        s->frontier = frontier;
+        s->frontier_cap = cap;
+    }
+    hit.dist = -hit.dist;
+    heap_push(s->frontier, n, hit);
+    return true;
+}
+
+/* from `cur`, moves to whichever link of `layer` is nearer q until none is */
+static VecHit hnsw_greedy(const HnswIndex* index, const float* q, VecHit cur,
+                          size_t layer) {
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        const uint32_t* links = hnsw_links(index, cur.id, layer);
+        for (size_t i = 1; i <= links[0]; i++) {
+            float dist = hnsw_dist(index, q, links[i]);
+            if (dist < cur.dist) {
+                cur = (VecHit){ links[i], dist };
+                moved = true;
+            }
+        }
+    }
+    return cur;
+}
+
+/* best-first walk of `layer` from `entry`: leaves the ef nearest found in
+ * s->best, nearest first, and returns how many there are (0 if out of
+ * memory) */
+static size_t hnsw_search_layer(const HnswIndex* index, HnswScratch* s,
+                                const float* q, VecHit entry, size_t ef,
+                                size_t layer) {
+    if (++s->epoch == 0) {
+        memset(s->visited, 0, s->n_visited * sizeof(uint32_t));
+        s->epoch = 1;
+    }
+    size_t n_frontier = 0, n_best = 0;
+    s->visited[entry.id] = s->epoch;
+    heap_push(s->best, &n_best, entry);
+    if (!frontier_push(s, &n_frontier, entry)) return 0;
+
+    while (n_frontier > 0) {
+        VecHit c = heap_pop(s->frontier, &n_frontier);
+        // nothing nearer can come from here on
+        if (-c.dist > s->best[0].dist && n_best == ef) break;
+        const uint32_t* links = hnsw_links(index, c.id, layer);
+        for (size_t i = 1; i <= links[0]; i++) {
+            uint32_t id = links[i];
+            if (s->visited[id] == s->epoch) continue;
+            s->visited[id] = s->epoch;
+            VecHit hit = { id, hnsw_dist(index, q, id) };
+            if (n_best == ef && !hit_worse(s->best[0], hit)) continue;
+            if (!frontier_push(s, &n_frontier, hit)) return 0;
+            heap_push(s->best, &n_best, hit);
+            if (n_best > ef) heap_pop(s->best, &n_best);
+        }
+    }
+    heap_sort(s->best, n_best);
+    return n_best;
+}
+
+/* keeps up to max_n of the candidates (nearest first) as links of the
+ * vector they were measured from: one is passed over if it's nearer to a
+ * link already kept than to that vector, so the links go different ways */
+static size_t hnsw_select(const HnswIndex* index, VecHit* cands, size_t n,
+                          size_t max_n) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n && kept < max_n; i++) {
+        const float* c = store_row(&index->store, cands[i].id);
+        bool keep = true;
+        for (size_t r = 0; r < kept && keep; r++)
+            keep = hnsw_dist(index, c, cands[r].id) >= cands[i].dist;
+        if (keep) cands[kept++] = cands[i];
+    }
+    return kept;
+}
+
+/* links `id` back from `to` on `layer`; a full list is selected again
+ * with `id` among the candidates */
+static void hnsw_link_back(HnswIndex* index, size_t to, size_t id,
+                           size_t layer, VecHit* cands) {
+    uint32_t* links = hnsw_links(index, to, layer);
+    size_t max_n = hnsw_max_links(index, layer);
+    if (links[0] < max_n) {
+        links[++links[0]] = (uint32_t)id;
+        return;
+    }
+    const float* base = store_row(&index->store, to);
+    size_t n = 0;
+    for (size_t i = 1; i <= links[0]; i++)
+        heap_push(cands, &n, (VecHit){ links[i], hnsw_dist(index, base,
+                                                          links[i]) });
+    heap_push(cands, &n, (VecHit){ id, hnsw_dist(index, base, id) });
+    heap_sort(cands, n);
+    links[0] = (uint32_t)hnsw_select(index, cands, n, max_n);
+    for (size_t i = 0; i < links[0]; i++) links[i + 1] = (uint32_t)cands[i].id;
+}
+
+static bool hnsw_reserve(HnswIndex* index, size_t n) {
+    if (n <= index->links_cap) return true;
+    size_t width = 2 * index->params.m + 1;
+    size_t max_cap = SIZE_MAX / sizeof(uint32_t) / width;
+    if (n > max_cap) return false;
+    size_t cap = index->links_cap ? index->links_cap : 64;
+    while (cap < n) cap = (cap > max_cap / 2) ? max_cap : 2 * cap;
+    unsigned char* levels = mem_realloc(index->levels, cap, MEM_INDEX);
+    if (levels != NULL) index->levels = levels;
+    uint32_t* links0 = mem_realloc(index->links0,
+                                   cap * width * sizeof(uint32_t), MEM_INDEX);
+    if (links0 != NULL) index->links0 = links0;
+    uint32_t** links = mem_realloc(index->links, cap * sizeof(uint32_t*),
+                                   MEM_INDEX);
+    if (links != NULL) index->links = links;
+    if (levels == NULL || links0 == NULL || links == NULL) {
+        fprintf(stderr, "malloc index links failed!");
+        return false;
+    }
+    index->links_cap = cap;
+    return true;
+}
+
+/* gives vector `id`, already stored, its layers and links: first the
+ * links of its own, which can run out of memory, then the links back to
+ * it, which can't, so a failed insert leaves the graph as it was */
+static bool hnsw_insert(HnswIndex* index, size_t id) {
+    HnswScratch* s = &index->scratch;
+    size_t m = index->params.m;
+    size_t ef = index->params.ef_construction;
+    size_t level = hnsw_level(index, id);
+    index->levels[id] = (unsigned char)level;
+    index->links[id] = NULL;
+    hnsw_links(index, id, 0)[0] = 0;
+    if (!scratch_reserve(s, id + 1, (ef > 2 * m) ? ef : 2 * m)) return false;
+    if (level > 0) {
+        index->links[id] = mem_calloc(level * (m + 1), sizeof(uint32_t),
+                                      MEM_INDEX);
+        if (index->links[id] == NULL) return false;
+    }
+    if (id == 0) {
+        index->entry = 0;
+        index->max_level = level;
+        return true;
+    }
+
+    const float* q = store_row(&index->store, id);
+    size_t top = (level < index->max_level) ? level : index->max_level;
+    VecHit cur = { index->entry, hnsw_dist(index, q, index->entry) };
+    for (size_t l = index->max_level; l > top; l--)
+        cur = hnsw_greedy(index, q, cur, l);
+    for (size_t l = top + 1; l-- > 0;) {
+        size_t n = hnsw_search_layer(index, s, q, cur, ef, l);
+        if (n == 0) return false;
+        cur = s->best[0];
+        size_t kept = hnsw_select(index, s->best, n, m);
+        uint32_t* links = hnsw_links(index, id, l);
+        links[0] = (uint32_t)kept;
+        for (size_t i = 0; i < kept; i++) links[i + 1] = (uint32_t)s->best[i].id;
+    }
+    // best has room for the 2m + 1 candidates of a full list
+    for (size_t l = 0; l <= top; l++) {
+        const uint32_t* links = hnsw_links(index, id, l);
+        for (size_t i = 1; i <= links[0]; i++)
+            hnsw_link_back(index, links[i], id, l, s->best);
+    }
+    if (level > index->max_level) {
+        index->entry = id;
+        index->max_level = level;
+    }
+    return true;
+}
+
+HnswIndex* hnsw_index_init(size_t dim, VecMetric metric,
+                           const HnswParams* params) {
+    HnswParams p = { HNSW_DEFAULT_M, HNSW_DEFAULT_EF_CONSTRUCTION, 0 };
+    if (params != NULL) p = *params;
+    if (dim == 0 || p.m < 2 || p.m > HNSW_MAX_M) return NULL;
+    if (p.ef_construction < p.m) p.ef_construction = p.m;
+    HnswIndex* index = mem_calloc(1, sizeof(HnswIndex), MEM_INDEX);
+    if (index == NULL) return NULL;
+    index->store = (VecStore){ NULL, dim, 0, 0, metric };
+    index->params = p;
+    return index;
+}
+
+void hnsw_index_free(HnswIndex* index) {
+    if (index == NULL) return;
+    for (size_t i = 0; i < index->store.count; i++) mem_free(index->links[i]);
+    mem_free(index->links);
+    mem_free(index->links0);
+    mem_free(index->levels);
+    mem_free(index->store.data);
+    scratch_deinit(&index->scratch);
+    mem_free(index);
+}
+
+size_t hnsw_index_size(const HnswIndex* index) {
+    return index ? index->store.count : 0;
+}
+
+/* vectors are linked in the order given; if that fails part way (out of
+ * memory), the ones not yet linked are dropped again */
+bool hnsw_index_add(HnswIndex* index, const Mat* rows) {
+    if (index == NULL || rows == NULL) return false;
+    size_t first = index->store.count;
+    if (first + rows->rows > UINT32_MAX
+        || !hnsw_reserve(index, first + rows->rows)
+        || !store_add(&index->store, rows))
+        return false;
+    for (size_t id = first; id < index->store.count; id++) {
+        if (!hnsw_insert(index, id)) {
+            fprintf(stderr, "malloc index links failed!");
+            mem_free(index->links[id]);
+            index->store.count = id;
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const HnswIndex* index;
+    const Mat* queries;
+    size_t k;
+    size_t ef;
+    VecHit* out;
+    atomic_bool failed;
+} HnswSearchArgs;
+
+static void hnsw_search_range(void* ctx, size_t begin, size_t end) {
+    HnswSearchArgs* args = ctx;
+    const HnswIndex* index = args->index;
+    size_t k = args->k;
+    HnswScratch s = {0};
+    if (!scratch_reserve(&s, index->store.count, args->ef)) {
+        atomic_store(&args->failed, true);
+        scratch_deinit(&s);
+        return;
+    }
+    for (size_t i = begin; i < end; i++) {
+        const float* q = args->queries->data + i * args->queries->stride;
+        VecHit* out = args->out + i * k;
+        VecHit cur = { index->entry, hnsw_dist(index, q, index->entry) };
+        for (size_t l = index->max_level; l > 0; l--)
+            cur = hnsw_greedy(index, q, cur, l);
+        size_t n = hnsw_search_layer(index, &s, q, cur, args->ef, 0);
+        if (n == 0) atomic_store(&args->failed, true);
+        n = (n < k) ? n : k;
+        memcpy(out, s.best, n * sizeof(VecHit));
+        hits_pad(out, n, k);
+    }
+    scratch_deinit(&s);
+}
+
+bool hnsw_index_search(const HnswIndex* index, const Mat* queries, size_t k,
+                       size_t ef, VecHit* out) {
+    if (index == NULL || out == NULL) return false;
+    float* buffer;
+    Mat q;
+    if (!store_queries(&index->store, queries, &buffer, &q)) return false;
+    if (index->store.count == 0) {
+        for (size_t i = 0; i < q.rows; i++) hits_pad(out + i * k, 0, k);
+    } else if (q.rows > 0 && k > 0) {
+        HnswSearchArgs args = { index, &q, k, (ef > k) ? ef : k, out, false };
+        parallel_for(q.rows, HNSW_QUERY_GRAIN, hnsw_search_range, &args);
+        if (atomic_load(&args.failed)) {
+            fprintf(stderr, "malloc index search failed!");
+            mem_free(buffer);
+            return false;
+        }
+    }
+    mem_free(buffer);
+    return true;
+}
+
+/* the store, the build parameters, the entry point, and per vector its
+ * level and each layer's links as a count and then ids, all as floats */
+JsonObject* hnsw_index_to_json(const HnswIndex* index) {
+    if (index == NULL || index->store.count > VEC_INDEX_MAX_JSON) return NULL;
+    size_t count = index->store.count, total = 0;
+    for (size_t i = 0; i < count; i++)
+        for (size_t l = 0; l <= index->levels[i]; l++)
+            total += 1 + hnsw_links(index, i, l)[0];
+
+    JsonObject* obj = store_to_json(&index->store, "hnsw");
+    if (obj == NULL) return NULL;
+    json_set_num(obj, "m", (double)index->params.m);
+    json_set_num(obj, "ef_construction",
+                 (double)index->params.ef_construction);
+    json_set_num(obj, "seed", (double)index->params.seed);
+    json_set_num(obj, "entry", (double)index->entry);
+    if (count == 0) return obj;
+
+    Vec* levels = vec_init(count);
+    Vec* links = vec_init(total);
+    if (levels == NULL || levels->data == NULL || links == NULL
+        || links->data == NULL) {
+        vec_free(levels);
+        vec_free(links);
+        json_free(obj);
+        return NULL;
+    }
+    float* dst = links->data;
+    for (size_t i = 0; i < count; i++) {
+        levels->data[i] = (float)index->levels[i];
+        for (size_t l = 0; l <= index->levels[i]; l++) {
+            const uint32_t* src = hnsw_links(index, i, l);
+            for (size_t j = 0; j <= src[0]; j++) *dst++ = (float)src[j];
+        }
+    }
+    json_set_vec(obj, "levels", levels);
+    json_set_vec(obj, "links", links);
+    return obj;
+}
+
+/* every level, count and id is checked, so a bad file can't send a
+ * search out of bounds: a link on layer l goes to a vector that has it */
+static bool hnsw_links_from_json(HnswIndex* index, size_t count,
+                                 const Vec* levels, const Vec* links) {
+    size_t m = index->params.m, pos = 0;
+    if (levels->dim != count || !hnsw_reserve(index, count)) return false;
+    for (size_t i = 0; i < count; i++) {
+        float level = levels->data[i];
+        if (!(level >= 0 && level <= HNSW_MAX_LEVEL) || level != floorf(level))
+            return false;
+        index->levels[i] = (unsigned char)level;
+        index->links[i] = NULL;
+        index->store.count = i + 1;     // for hnsw_index_free on failure
+        if (level > 0) {
+            index->links[i] = mem_calloc((size_t)level * (m + 1),
+                                         sizeof(uint32_t), MEM_INDEX);
+            if (index->links[i] == NULL) return false;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (size_t l = 0; l <= index->levels[i]; l++) {
+            uint32_t* dst = hnsw_links(index, i, l);
+            if (pos >= links->dim) return false;
+            float n = links->data[pos++];
+            if (!(n >= 0 && n <= (float)hnsw_max_links(index, l))
+                || n != floorf(n) || pos + (size_t)n > links->dim)
+                return false;
+            dst[0] = (uint32_t)n;
+            for (size_t j = 1; j <= dst[0]; j++) {
+                float id = links->data[pos++];
+                if (!(id >= 0 && id < (float)count) || id != floorf(id)
+                    || index->levels[(size_t)id] < l)
+                    return false;
+                dst[j] = (uint32_t)id;
+            }
+        }
+    }
+    return pos == links->dim;
+}
+
+HnswIndex* hnsw_index_from_json(const JsonObject* obj) {
+    VecStore store;
+    HnswParams p;
+    size_t seed, entry;
+    if (!store_from_json(obj, "hnsw", &store)
+        || !index_get_size(obj, "m", &p.m)
+        || !index_get_size(obj, "ef_construction", &p.ef_construction)
+        || !index_get_size(obj, "seed", &seed) || seed > UINT_MAX
+        || !index_get_size(obj, "entry", &entry)
+        || (store.count > 0 && entry >= store.count)) {
+        mem_free(store.data);
+        return NULL;
+    }
+    p.seed = (unsigned)seed;
+    HnswIndex* index = hnsw_index_init(store.dim, store.metric, &p);
+    if (index == NULL) {
+        mem_free(store.data);
+        return NULL;
+    }
+    size_t count = store.count;
+    index->store = store;
+    index->store.count = 0;     // raised as the links are read
+    if (count == 0) return index;
+
+    Vec* levels;
+    Vec* links;
+    if (!json_get_vec(obj, "levels", &levels)
+        || !json_get_vec(obj, "links", &links)
+        || !hnsw_links_from_json(index, count, levels, links)
+        || !scratch_reserve(&index->scratch, count, 2 * p.m)) {
+        hnsw_index_free(index);
+        return NULL;
+    }
+    // the entry is on the top layer
+    for (size_t i = 0; i < count; i++) {
+        if (index->levels[i] > index->levels[entry]) {
+            hnsw_index_free(index);
+            return NULL;
+        }
+    }
+    index->entry = entry;
+    index->max_level = index->levels[entry];
+    return index;
+}
@@ -0,0 +1,90 @@
+#ifndef VEC_INDEX_H
+#define VEC_INDEX_H
+
+#include <stdbool.h> // bool
+#include <stdint.h>  // SIZE_MAX, UINT32_MAX
+#include "tensor.h"  // Mat
+#include "json.h"    // JsonObject
+
+/* nearest-neighbor search over vectors of one dimension, eg. embeddings
+ * loaded with json_get_vec and viewed as rows with mat_view.
+ *
+ * an index copies the rows it's given into one contiguous array; ids are
+ * the order they were added in, from 0. with VEC_COSINE the copies (and
+ * the queries) are normalized, so only dot products are taken.
+ *
+ * FlatIndex compares every query with every vector, so it is exact. the
+ * stored vectors are walked in cache-sized chunks, each against a whole
+ * chunk of queries, and every query keeps its k best in a heap. queries
+ * are split over the threads with parallel_for, and so are the stored
+ * vectors when there are fewer query chunks than threads.
+ *
+ * HnswIndex is approximate: a hierarchical navigable small world graph
+ * (malkov & yashunin). each vector links to up to m near ones on each of
+ * its layers (2m on layer 0); a search goes greedily down from the top
+ * layer, then keeps the `ef` nearest it has seen on layer 0. a larger ef
+ * is slower, with better recall. adds are made on the calling thread,
+ * searches are threaded by query.
+ *
+ * searches write k VecHits per query row, nearest first: the squared
+ * euclidean distance (VEC_L2), 1 - cosine (VEC_COSINE) or minus the dot
+ * product (VEC_DOT); equal distances are ordered by id. when fewer than k
+ * are found the rest are VEC_INDEX_NONE at INFINITY.
+ *
+ * *_to_json saves an index as numbers and J_VECs, for json_dumps;
+ * *_from_json rebuilds it from that object or from its text parsed back.
+ * graph links are saved as floats, so an HnswIndex of more than
+ * VEC_INDEX_MAX_JSON vectors isn't saved (NULL).
+ *
+ * functions returning bool return false, and do nothing, if the shapes
+ * don't match or an allocation fails */
+
+typedef enum {
+    VEC_L2,
+    VEC_COSINE,
+    VEC_DOT,
+} VecMetric;
+
+typedef struct {
+    size_t id;
+    float dist;
+} VecHit;
+
+#define VEC_INDEX_NONE     SIZE_MAX
+#define VEC_INDEX_MAX_JSON (1 << 24)    // floats hold every integer below
+
+typedef struct FlatIndex FlatIndex;
+
+FlatIndex* flat_index_init(size_t dim, VecMetric metric);
+void flat_index_free(FlatIndex* index);
+size_t flat_index_size(const FlatIndex* index);
+bool flat_index_add(FlatIndex* index, const Mat* rows);
+bool flat_index_search(const FlatIndex* index, const Mat* queries, size_t k,
+                       VecHit* out);
+JsonObject* flat_index_to_json(const FlatIndex* index);
+FlatIndex* flat_index_from_json(const JsonObject* obj);
+
+typedef struct {
+    size_t m;               // links per vector and layer, 2m on layer 0
+    size_t ef_construction; // candidates kept while linking a new vector
+    unsigned seed;          // for the layers vectors are given
+} HnswParams;
+
+#define HNSW_DEFAULT_M               16
+#define HNSW_DEFAULT_EF_CONSTRUCTION 200
+#define HNSW_MAX_M                   (UINT32_MAX / 4)  // keeps link sizes in range
+
+typedef struct HnswIndex HnswIndex;
+
+/* params may be NULL for the defaults */
+HnswIndex* hnsw_index_init(size_t dim, VecMetric metric,
+                           const HnswParams* params);
+void hnsw_index_free(HnswIndex* index);
+size_t hnsw_index_size(const HnswIndex* index);
+bool hnsw_index_add(HnswIndex* index, const Mat* rows);
+bool hnsw_index_search(const HnswIndex* index, const Mat* queries, size_t k,
+                       size_t ef, VecHit* out);
+JsonObject* hnsw_index_to_json(const HnswIndex* index);
+HnswIndex* hnsw_index_from_json(const JsonObject* obj);
+
+#endif // VEC_INDEX_H
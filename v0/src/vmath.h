@@ -0,0 +1,145 @@
+#ifndef VMATH_H
+#define VMATH_H
+
+#include <stdint.h>  // uint32_t
+#include <stdbool.h> // bool
+#include <string.h>  // memcpy
+
+/* branch-free float math for inner loops: unlike libm's expf these inline
+ * and auto-vectorize. internal to the kernels, not part of the api */
+
+/* e^x to within 2 ulp over the normal range: 0 below -87, 2^127-ish
+ * above 88, nan stays nan. the range is reduced to x = k ln2 + r with
+ * |r| <= ln2 / 2, a degree 6 polynomial (cephes' expf) gives e^r and the
+ * exponent bits give 2^k */
+static inline float vmath_expf(float x) {
+    const float log2e = 1.44269504088896341f;
+    const float ln2_hi = 0.693359375f;
+    const float ln2_lo = -2.12194440e-4f;
+    // written so that nan clamps too: the int conversion must see a number
+    float xc = (x < 88.0f) ? x : 88.0f;
+    xc = (xc > -87.0f) ? xc : -87.0f;
+
+    // round to nearest: adding 1.5 * 2^23 pushes the fraction bits out
+    float fk = (xc * log2e + 12582912.0f) - 12582912.0f;
+    float r = xc - fk * ln2_hi - fk * ln2_lo;
+
+    float p = 1.9875691500e-4f;
+    p = p * r + 1.3981999507e-3f;
+    p = p * r + 8.3334519073e-3f;
+    p = p * r + 4.1665795894e-2f;
+    p = p * r + 1.6666665459e-1f;
+    p = p * r + 5.0000001201e-1f;
+    p = p * r * r + r + 1.0f;
+
+    uint32_t bits = (uint32_t)((int32_t)fk + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    // every value is computed before the selects, so they are blends
+    float y = p * scale;
+    y = (x < -87.0f) ? 0.0f : y;
+    return (x != x) ? x : y;
+}
+
+/* ln x for normal x > 0, to within ~2 ulp; other inputs are not handled.
+ * x = m 2^e with m in [sqrt(1/2), sqrt(2)), and a degree 8 polynomial
+ * (cephes' logf) gives ln m */
+static inline float vmath_logf(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int32_t e = (int32_t)(bits >> 23) - 126;
+    bits = (bits & 0x007fffffu) | 0x3f000000u;     // m in [0.5, 1)
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    bool small = m < 0.707106781186547524f;
+    e -= small;
+    m = small ? m + m - 1.0f : m - 1.0f;
+    float fe = (float)e;
+
+    float z = m * m;
+    float p = 7.0376836292e-2f;
+    p = p * m - 1.1514610310e-1f;
+    p = p * m + 1.1676998740e-1f;
+    p = p * m - 1.2420140846e-1f;
+    p = p * m + 1.4249322787e-1f;
+    p = p * m - 1.6668057665e-1f;
+    p = p * m + 2.0000714765e-1f;
+    p = p * m - 2.4999993993e-1f;
+    p = p * m + 3.3333331174e-1f;
+    float y = p * m * z;
+    y += fe * -2.12194440e-4f;
+    y -= 0.5f * z;
+    return m + y + fe * 0.693359375f;
+}
+
+/* sqrt x for x >= 0, to within ~2 ulp. libm's sqrtf keeps a branch for
+ * errno, which stops loops from vectorizing under -std=c11; this is the
+ * inverse square root bit trick and three newton steps, times x */
+static inline float vmath_sqrtf(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5f3759dfu - (bits >> 1);
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+    float h = 0.5f * x;
+    y = y * (1.5f - h * y * y);
+    y = y * (1.5f - h * y * y);
+    y = y * (1.5f - h * y * y);
+    return x * y;
+}
+
+/* sin and cos of 2 pi u, for u in [0, 1), to within ~2 ulp. u is folded
+ * to the nearest quarter turn exactly, which leaves |angle| <= pi / 4 for
+ * cephes' polynomials, and the quarter turns swap and negate them */
+static inline void vmath_sincos_turn(float u, float* s, float* c) {
+    float q = (u * 4.0f + 12582912.0f) - 12582912.0f;  // round to nearest
+    float a = (u - q * 0.25f) * 6.28318530717958648f;
+    float z = a * a;
+
+    float sp = -1.9515295891e-4f;
+    sp = sp * z + 8.3321608736e-3f;
+    sp = sp * z - 1.6666654611e-1f;
+    float sa = sp * z * a + a;
+    float cp = 2.443315711809948e-5f;
+    cp = cp * z - 1.388731625493765e-3f;
+    cp = cp * z + 4.166664568298827e-2f;
+    float ca = cp * z * z - 0.5f * z + 1.0f;
+
+    uint32_t quarter = (uint32_t)(int32_t)q & 3u;
+    float so = (quarter & 1u) ? ca : sa;
+    float co = (quarter & 1u) ? sa : ca;
+    *s = (quarter & 2u) ? -so : so;
+    *c = ((quarter + 1u) & 2u) ? -co : co;
+}
+
+/* erf^-1 x for |x| < 1, to within a few ulp (giles' single precision
+ * approximation): one polynomial in ln(1 - x^2) for the center, one in
+ * its square root for the tails */
+static inline float vmath_erfinvf(float x) {
+    float w = -vmath_logf((1.0f - x) * (1.0f + x));
+
+    float c = w - 2.5f;
+    float p = 2.81022636e-08f;
+    p = p * c + 3.43273939e-07f;
+    p = p * c - 3.5233877e-06f;
+    p = p * c - 4.39150654e-06f;
+    p = p * c + 0.00021858087f;
+    p = p * c - 0.00125372503f;
+    p = p * c - 0.00417768164f;
+    p = p * c + 0.246640727f;
+    p = p * c + 1.50140941f;
+
+    float t = vmath_sqrtf(w) - 3.0f;
+    float q = -0.000200214257f;
+    q = q * t + 0.000100950558f;
+    q = q * t + 0.00134934322f;
+    q = q * t - 0.00367342844f;
+    q = q * t + 0.00573950773f;
+    q = q * t - 0.0076224613f;
+    q = q * t + 0.00943887047f;
+    q = q * t + 1.00167406f;
+    q = q * t + 2.83297682f;
+    return ((w < 5.0f) ? p : q) * x;
+}
+
+#endif // VMATH_H
@@ -1,9 +1,23 @@
+#define _POSIX_C_SOURCE 200809L    // fileno
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include "../src/string_ext.h"
 #include "../src/tensor.h"
 #include "../src/json.h"
+#include "../src/json_batch.h"
+#include "../src/json_schema.h"
+#include "../src/parallel.h"
+#include "../src/mem.h"
+#include "../src/trace.h"
+#include "../src/expr.h"
+#include "../src/reduce.h"
+#include "../src/attention.h"
+#include "../src/vmath.h"
+#include "../src/vec_index.h"
+#include "../src/checkpoint.h"
+#include "../src/prng.h"
+#include <math.h>
 
 
 void test_json_build(void) {
@@ -104,10 +118,1344 @@ void test_json_parse(void) {
     printf("json parsing OK\n");
 }
 
+void test_json_batch(void) {
+    char* str = "[{\"id\": 1, \"label\": \"cat\", \"emb\": [0.5, 1, 2]},"
+                " {\"emb\": [3, 4, 5], \"extra\": {\"x\": [1]}, \"id\": 2},"
+                " {\"label\": \"d\\\"og\", \"id\": -3, \"emb\": [6,7,8]}]";
+    JsonColSpec specs[] = {
+        { "id", JSON_COL_I64, 0 },
+        { "label", JSON_COL_STR, 0 },
+        { "emb", JSON_COL_VEC, 0 },
+    };
+    JsonBatch* b = json_batch_init(specs, 3, 2);
+    assert(json_batch_parse(b, str) == 0 && "json_batch_parse failed");
+    assert(b->n_rows == 3);
+
+    JsonColumn* ids = json_batch_col(b, "id");
+    assert(ids->ints[0] == 1 && ids->ints[1] == 2 && ids->ints[2] == -3);
+
+    JsonColumn* emb = json_batch_col(b, "emb");
+    assert(emb->width == 3 && emb->vec->dim == 9);
+    for (size_t i = 0; i < 9; i++)
+        assert(emb->vec->data[i] == (i == 0 ? 0.5f : (float)i));
+
+    size_t len;
+    JsonColumn* labels = json_batch_col(b, "label");
+    const char* label = json_batch_str(labels, 0, &len);
+    assert(len == 3 && !strncmp(label, "cat", len));
+    json_batch_str(labels, 1, &len);
+    assert(len == 0 && "missing field should be empty");
+    label = json_batch_str(labels, 2, &len);
+    assert(len == 5 && !strncmp(label, "d\\\"og", len));
+
+    // a record with the wrong vector width is rejected, earlier ones kept
+    assert(json_batch_parse(b, "[{\"id\": 4, \"emb\": [1, 2]}]") != 0);
+    assert(b->n_rows == 3 && emb->vec->dim == 9);
+
+    json_batch_free(b);
+    printf("json batch decoding OK\n");
+}
+
+typedef struct {
+    int64_t id;
+    char* name;
+    float score;
+    double ratio;
+    bool ok;
+    Vec* v;
+} SchemaMsg;
+
+void test_json_schema(void) {
+    static const JsonField fields[] = {
+        JSON_FIELD(SchemaMsg, id, JSON_FIELD_I64),
+        JSON_FIELD(SchemaMsg, name, JSON_FIELD_STR),
+        JSON_FIELD(SchemaMsg, score, JSON_FIELD_F32),
+        JSON_FIELD_KEY("r", SchemaMsg, ratio, JSON_FIELD_F64),
+        JSON_FIELD(SchemaMsg, ok, JSON_FIELD_BOOL),
+        JSON_FIELD(SchemaMsg, v, JSON_FIELD_VEC),
+    };
+    JsonSchema schema;
+    assert(json_schema_init(&schema, fields, 6) == 0);
+
+    char* str = "{\"name\": \"abc\", \"skip\": [{\"a\": \"}\"}, 1],"
+                " \"id\": 42, \"score\": 0.5, \"r\": 0.25,"
+                " \"ok\": false, \"v\": [1, 2, 3], \"nam\": \"x\"}";
+    SchemaMsg m = {0};
+    m.ok = true;
+    assert(json_schema_parse(&schema, &m, str) == 0);
+    assert(m.id == 42 && !strcmp(m.name, "abc") && !m.ok);
+    assert(m.score == 0.5f && m.ratio == 0.25);
+    assert(m.v->dim == 3 && m.v->data[2] == 3.0f);
+    json_schema_release(&schema, &m);
+    assert(m.name == NULL && m.v == NULL);
+
+    // of a repeated key the last value is kept, the earlier one freed
+    assert(json_schema_parse(&schema, &m, "{\"name\": \"a\", \"v\": [1],"
+                             " \"name\": \"b\", \"v\": [2, 3]}") == 0);
+    assert(!strcmp(m.name, "b") && m.v->dim == 2 && m.v->data[0] == 2.0f);
+    json_schema_release(&schema, &m);
+
+    // a key whose value has the wrong type is an error, and so is a
+    // literal cut short
+    assert(json_schema_parse(&schema, &m, "{\"id\": \"42\"}") != 0);
+    assert(json_schema_parse(&schema, &m, "{\"ok\": tru") != 0);
+    assert(json_schema_parse(&schema, &m, "{\"ok\": ") != 0);
+
+    json_schema_free(&schema);
+    printf("json schema parsing OK\n");
+}
+
+void test_json_intern(void) {
+    char* str = "{\"rows\": [{\"id\": \"1\", \"tag\": \"a\"},"
+                " {\"id\": \"2\", \"tag\": \"b\"}], \"id\": \"0\"}";
+    JsonInterner* keys = json_interner_init(true);
+    JsonObject* j1 = json_init_interned(keys);
+    JsonObject* j2 = json_init_interned(keys);
+    JsonObject* plain = json_init();
+    assert(json_parse(j1, str) == 0 && json_parse(plain, str) == 0);
+    json_set_str(j2, "tag", "c");
+    json_interner_release(keys);    // the documents keep it alive
+
+    // "rows", "id", "tag" are stored once across both documents
+    assert(json_interner_count(keys) == 3);
+
+    char* s1 = json_dumps(j1);
+    char* s2 = json_dumps(plain);
+    assert(!strcmp(s1, s2) && "interned dump differs");
+    free(s1);
+    free(s2);
+
+    char* out = NULL;
+    assert(json_get_str(j1, "id", &out) && !strcmp(out, "0"));
+    assert(json_get_str(j2, "tag", &out) && !strcmp(out, "c"));
+    assert(!json_get_str(j2, "id", &out) && "key only in j1");
+    assert(!json_get_str(j1, "nope", &out));
+
+    json_free(j1);
+    json_free(j2);
+    json_free(plain);
+    printf("json key interning OK\n");
+}
+
+void test_json_deep(void) {
+    // 100k levels of nesting, alternating objects and arrays
+    size_t depth = 100000;
+    String* s = string_new(0);
+    for (size_t i = 0; i < depth; i++)
+        string_append(s, (i % 2) ? "[" : "{\"k\": ");
+    string_append(s, "\"leaf\"");
+    for (size_t i = depth; i-- > 0;)
+        string_append(s, (i % 2) ? "]" : "}");
+
+    JsonObject* j = json_init();
+    assert(json_parse(j, s->data) == 0 && "deep parse failed");
+    char* out = json_dumps(j);
+    assert(!strcmp(out, s->data) && "deep dump differs");
+    free(out);
+    json_free(j);
+
+    // the limit counts the root: depth levels fit, depth - 1 don't
+    j = json_init();
+    assert(json_parse_depth(j, s->data, depth) == 0);
+    json_free(j);
+    j = json_init();
+    assert(json_parse_depth(j, s->data, depth - 1) != 0);
+    json_free(j);
+
+    string_free(s);
+    printf("json deep nesting OK\n");
+}
+
+void test_json_wide(void) {
+    size_t n = 200000;
+    char buf[64];
+    String* s = string_from("{");
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%s\"k%zu\": [%zu]", i ? ", " : "", i, i);
+        string_append(s, buf);
+    }
+    string_append(s, "}");
+
+    JsonObject* j = json_init();
+    assert(json_parse(j, s->data) == 0 && "wide parse failed");
+    Vec* v = NULL;
+    assert(json_get_vec(j, "k199999", &v) && v->data[0] == 199999.0f);
+    char* out = json_dumps(j);
+    assert(!strcmp(out, s->data) && "wide dump differs");
+    free(out);
+    json_free(j);
+
+    string_free(s);
+    printf("json wide object OK\n");
+}
+
+void test_json_upsert(void) {
+    JsonObject* j = json_init();
+    json_set_str(j, "step", "1");
+    json_set_str(j, "step", "2");
+    Vec* w = vec_from_copy((float[]){1, 2, 3, 4, 5, 6, 7, 8}, 8);
+    JsonObject* weights = json_init();
+    json_set_vec(weights, "w", w);
+    json_set_vec(weights, "w", w);  // same vec again: kept, not freed
+    json_set_str(weights, "name", "a_long_enough_layer_name_to_be_cached");
+    json_set_obj(j, "weights", weights);
+
+    // a new array over the same objects: the objects are kept, not freed
+    JsonObject* model = json_init();
+    JsonObject* layers[2] = { json_init(), json_init() };
+    json_set_num(layers[0], "units", 4);
+    json_set_num(layers[1], "units", 2);
+    json_set_arr(model, "layers", J_OBJ, (void**)layers, 2);
+    json_set_arr(model, "layers", J_OBJ, (void**)layers, 2);
+    json_set_arr(model, "layers", J_OBJ, (void**)layers, 1);
+    json_set_obj(model, "layers", layers[0]);
+    double units = 0;
+    assert(json_get_num(layers[0], "units", &units) && units == 4);
+    char* model_out = json_dumps(model);
+    assert(!strcmp(model_out, "{\"layers\": {\"units\": 4}}"));
+    free(model_out);
+    json_free(model);
+
+    char* expected = "{\"step\": \"2\", \"weights\": {\"w\": "
+                     "[1, 2, 3, 4, 5, 6, 7, 8], \"name\": "
+                     "\"a_long_enough_layer_name_to_be_cached\"}}";
+    char* out = json_dumps_cached(j);
+    assert(!strcmp(out, expected) && "upsert left duplicates");
+    assert(j->cache == NULL && weights->cache != NULL);
+    free(out);
+
+    // the clean subtree comes from its cache: an unreported in-place
+    // change to the vec is not seen until the object is marked dirty
+    json_set_str(j, "step", "3");
+    w->data[0] = 9;
+    out = json_dumps_cached(j);
+    assert(strstr(out, "\"step\": \"3\"") && strstr(out, "[1, 2"));
+    free(out);
+
+    json_mark_dirty(weights);
+    out = json_dumps_cached(j);
+    assert(strstr(out, "[9, 2") && "json_mark_dirty ignored");
+    char* plain = json_dumps(j);
+    assert(!strcmp(out, plain));
+    free(out);
+    free(plain);
+
+    json_free(j);
+    printf("json upsert and cached dumps OK\n");
+}
+
+/* counts the visits to each index */
+static void count_range(void* ctx, size_t begin, size_t end) {
+    unsigned* visits = ctx;
+    for (size_t i = begin; i < end; i++) visits[i]++;
+}
+
+void test_vec_ops(void) {
+    size_t n = 100003;     // several parallel ranges and a ragged tail
+    Vec* a = vec_init(n);
+    Vec* b = vec_init(n);
+    Vec* out = vec_init(n);
+    double expected = 0;
+    for (size_t i = 0; i < n; i++) {
+        a->data[i] = (float)(i % 13) - 6.0f;
+        b->data[i] = (float)(i % 7) * 0.5f;
+        expected += (double)a->data[i] * b->data[i];
+    }
+
+    assert(vec_add(a, b, out));
+    for (size_t i = 0; i < n; i++) assert(out->data[i] == a->data[i] + b->data[i]);
+    assert(vec_mul(a, b, out));
+    for (size_t i = 0; i < n; i++) assert(out->data[i] == a->data[i] * b->data[i]);
+    assert(vec_scale(a, 2.0f, out));
+    assert(vec_axpy(-2.0f, a, out));
+    for (size_t i = 0; i < n; i++) assert(out->data[i] == 0.0f);
+
+    // the dot product must not depend on the thread count
+    float dots[3];
+    size_t threads[3] = { 1, 3, 8 };
+    for (size_t t = 0; t < 3; t++) {
+        parallel_set_threads(threads[t]);
+        assert(vec_dot(a, b, dots + t));
+    }
+    parallel_set_threads(0);
+    assert(dots[0] == (float)expected);
+    assert(dots[1] == dots[0] && dots[2] == dots[0]);
+
+    // a pool restarted after a shutdown runs each range of a job once
+    unsigned visits[64] = {0};
+    parallel_set_threads(4);
+    for (unsigned round = 1; round <= 200; round++) {
+        parallel_for(64, 1, count_range, visits);
+        for (size_t i = 0; i < 64; i++) assert(visits[i] == round);
+        parallel_shutdown();
+    }
+    parallel_set_threads(0);
+
+    Vec* short_vec = vec_init(3);
+    assert(!vec_add(a, short_vec, out) && !vec_dot(a, short_vec, dots));
+
+    vec_free(a);
+    vec_free(b);
+    vec_free(out);
+    vec_free(short_vec);
+    parallel_shutdown();
+    printf("vec ops OK\n");
+}
+
+typedef struct {
+    size_t mallocs;
+    size_t frees;
+} CountingCtx;
+
+static void* counting_malloc(void* ctx, size_t size, MemTag tag) {
+    (void)tag;
+    ((CountingCtx*)ctx)->mallocs++;
+    return malloc(size);
+}
+
+static void* counting_realloc(void* ctx, void* ptr, size_t size, MemTag tag) {
+    (void)ctx;
+    (void)tag;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void* ctx, void* ptr) {
+    ((CountingCtx*)ctx)->frees++;
+    free(ptr);
+}
+
+/* fails every allocation once `budget` of them have been made */
+typedef struct {
+    size_t budget;
+} FailingCtx;
+
+static void* failing_malloc(void* ctx, size_t size, MemTag tag) {
+    (void)tag;
+    FailingCtx* failing = ctx;
+    if (failing->budget == 0) return NULL;
+    failing->budget--;
+    return malloc(size);
+}
+
+static void* failing_realloc(void* ctx, void* ptr, size_t size, MemTag tag) {
+    (void)tag;
+    FailingCtx* failing = ctx;
+    if (failing->budget == 0) return NULL;
+    failing->budget--;
+    return realloc(ptr, size);
+}
+
+static void failing_free(void* ctx, void* ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+void test_mem_accounting(void) {
+    // accounting on top of a user allocator, to check ctx is passed along
+    CountingCtx counting = {0};
+    MemAllocator user = { counting_malloc, counting_realloc, counting_free,
+                          &counting };
+    MemAllocator accounting = mem_accounting(&user);
+    mem_set_allocator(&accounting);
+    mem_reset_stats();
+
+    JsonInterner* keys = json_interner_init(false);
+    JsonObject* j = json_init_interned(keys);
+    json_interner_release(keys);
+    assert(json_parse(j, "{\"name\": \"layer\", \"w\": [1, 2, 3, 4]}") == 0);
+    char* out = json_dumps(j);
+
+    MemSnapshot snap;
+    mem_snapshot(&snap);
+    assert(snap.tags[MEM_JSON].live_bytes > 0);
+    assert(snap.tags[MEM_INTERN].live_bytes > 0);
+    assert(snap.tags[MEM_VEC].live_bytes >= 4 * sizeof(float));
+    assert(snap.tags[MEM_STRING].live_bytes == strlen(out) + 1);
+    assert(snap.tags[MEM_STRING].peak_bytes >= snap.tags[MEM_STRING].live_bytes);
+    size_t live = 0;
+    for (size_t t = 0; t < MEM_TAG_COUNT; t++) live += snap.tags[t].live_bytes;
+    assert(snap.total.live_bytes == live);
+    assert(snap.total.allocs == counting.mallocs);
+    size_t peak = snap.total.peak_bytes;
+
+    mem_free(out);
+    json_free(j);
+    mem_snapshot(&snap);
+    for (size_t t = 0; t < MEM_TAG_COUNT; t++)
+        assert(snap.tags[t].live_bytes == 0 && "leaked under this tag");
+    assert(snap.total.peak_bytes == peak);
+    assert(snap.total.frees == counting.frees);
+    assert(snap.total.frees == snap.total.allocs);
+
+    mem_reset_stats();
+    mem_snapshot(&snap);
+    assert(snap.total.peak_bytes == 0 && snap.total.allocs == 0);
+    assert(!strcmp(mem_tag_name(MEM_JSON), "json"));
+
+    mem_set_allocator(NULL);
+
+    // a key that can't be stored drops the value, never leaving a NULL key
+    JsonObject* plain = json_init();
+    JsonObject* interned = json_init_interned(NULL);
+    FailingCtx failing = { 2 };     // the value and the pair, not the key
+    MemAllocator fails = { failing_malloc, failing_realloc, failing_free,
+                           &failing };
+    mem_set_allocator(&fails);
+    json_set_num(plain, "step", 1);
+    failing.budget = 1;             // the value, not the interned key
+    json_set_num(interned, "step", 1);
+    mem_set_allocator(NULL);
+    char* plain_out = json_dumps(plain);
+    char* interned_out = json_dumps(interned);
+    assert(!strcmp(plain_out, "{}") && !strcmp(interned_out, "{}"));
+    mem_free(plain_out);
+    mem_free(interned_out);
+    json_free(plain);
+    json_free(interned);
+    printf("mem accounting OK\n");
+}
+
+void test_trace(void) {
+    trace_reset();
+    JsonObject* j = json_init();
+    assert(json_parse(j, "{\"name\":  \"layer\", \"w\": [1.5, 2, 3]}") == 0);
+    char* out = json_dumps(j);
+    TraceStats stats[TRACE_STAGE_COUNT];
+    trace_read(stats);
+
+#ifdef JSON_TRACE
+    assert(stats[TRACE_PARSE].calls == 1 && stats[TRACE_PARSE].cycles > 0);
+    assert(stats[TRACE_PARSE_VEC].calls == 1);
+    assert(stats[TRACE_PARSE_VEC].items == 3);
+    assert(stats[TRACE_STRTOF].items == 3 && stats[TRACE_STRTOF].bytes == 5);
+    assert(stats[TRACE_PARSE_STRING].bytes == strlen("namelayerw"));
+    assert(stats[TRACE_WHITESPACE].bytes >= 5);
+    assert(stats[TRACE_DUMP].calls == 1);
+    assert(stats[TRACE_DUMP].bytes == strlen(out));
+    assert(stats[TRACE_VEC_TO_STR].items == 3);
+    assert(stats[TRACE_ALLOC].calls > 0);
+
+    // the export is json itself, with the spans and the totals
+    const char* path = "/tmp/json_trace_test.json";
+    assert(trace_export_chrome(path) == 0);
+    FILE* file = fopen(path, "r");
+    assert(file != NULL);
+    static char trace[1 << 16];
+    size_t len = fread(trace, 1, sizeof(trace) - 1, file);
+    trace[len] = '\0';
+    fclose(file);
+    assert(strstr(trace, "\"ph\": \"X\"") && strstr(trace, "\"otherData\""));
+    JsonObject* parsed = json_init();
+    assert(json_parse(parsed, trace) == 0);
+    json_free(parsed);
+    remove(path);
+
+    // rejected input is timed too, by every stage it reached
+    trace_reset();
+    JsonObject* bad = json_init();
+    assert(json_parse(bad, "x") != 0);
+    assert(json_parse(bad, "{\"w\": [1, x]}") != 0);
+    assert(json_parse(bad, "{\"na") != 0);
+    trace_read(stats);
+    assert(stats[TRACE_PARSE].calls == 3);
+    assert(stats[TRACE_PARSE_VEC].calls == 1);
+    assert(stats[TRACE_PARSE_VEC].items == 0);
+    assert(stats[TRACE_PARSE_STRING].calls == 2);
+    json_free(bad);
+    printf("trace OK\n");
+#else
+    // compiled out: nothing is recorded
+    for (size_t s = 0; s < TRACE_STAGE_COUNT; s++)
+        assert(stats[s].calls == 0 && stats[s].cycles == 0);
+    printf("trace (disabled) OK\n");
+#endif
+    mem_free(out);
+    json_free(j);
+}
+
+void test_string_builder(void) {
+    // short strings stay inline, long ones move to the heap
+    String* s = string_new(0);
+    string_append_n(s, "abc", 3);
+    string_prepend(s, "x");
+    assert(s->data == s->inline_buf && !strcmp(s->data, "xabc"));
+    for (int i = 0; i < 10; i++) string_append(s, "0123456789");
+    assert(s->data != s->inline_buf && s->length == 104);
+    assert(!strncmp(s->data, "xabc0123", 8));
+    size_t len;
+    char* taken = string_take(s, &len);
+    assert(len == 104 && taken[len] == '\0' && s->length == 0);
+    mem_free(taken);
+    string_append(s, "short");
+    taken = string_take(s, NULL);
+    assert(!strcmp(taken, "short"));
+    mem_free(taken);
+    string_free(s);
+
+    // a builder matches a String built the slow way, across many chunks
+    String expected;
+    string_init(&expected);
+    StringBuilder b;
+    string_builder_init(&b);
+    char piece[64];
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(piece, sizeof(piece), "<%d:%.*s>", i, i % 40,
+                         "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOP");
+        if (i % 5 == 0) {
+            assert(string_builder_prepend(&b, piece, (size_t)n));
+            string_prepend_n(&expected, piece, (size_t)n);
+        } else {
+            assert(string_builder_append(&b, piece, (size_t)n));
+            string_append_n(&expected, piece, (size_t)n);
+        }
+    }
+    assert(b.length == expected.length && b.n_chunks > 2);
+    char* flat = string_builder_flatten(&b, &len);
+    assert(len == expected.length && !strcmp(flat, expected.data));
+    mem_free(flat);
+
+    // and writes the same bytes out without flattening
+    FILE* file = tmpfile();
+    assert(file != NULL && string_builder_writev(&b, fileno(file)));
+    rewind(file);
+    char* read_back = malloc(expected.length + 1);
+    assert(fread(read_back, 1, expected.length + 1, file) == expected.length);
+    assert(!memcmp(read_back, expected.data, expected.length));
+    free(read_back);
+    fclose(file);
+
+    string_builder_free(&b);
+    string_deinit(&expected);
+    printf("string sso and builder OK\n");
+}
+
+static bool vec_same(const Vec* a, const Vec* b) {
+    return a->dim == b->dim
+        && memcmp(a->data, b->data, a->dim * sizeof(float)) == 0;
+}
+
+void test_expr(void) {
+    size_t n = 100003;
+    Vec* a = vec_init(n);
+    Vec* x = vec_init(n);
+    Vec* b = vec_init(n);
+    Vec* fused = vec_init(n);
+    Vec* unfused = vec_init(n);
+    float one[1] = { 0.25f };
+    Vec* scalar = vec_from_copy(one, 1);
+    for (size_t i = 0; i < n; i++) {
+        a->data[i] = (float)(i % 11) * 0.3f - 1.0f;
+        x->data[i] = (float)(i % 5) - 2.0f;
+        b->data[i] = (float)(i % 3) * 0.7f;
+    }
+
+    // relu(a * x + b) * 1.5, the chain from expr.h
+    ExprGraph* g = expr_graph_new();
+    Expr* ax = expr_mul(g, expr_input(g, a), expr_input(g, x));
+    Expr* y = expr_mul(g, expr_relu(g, expr_add(g, ax, expr_input(g, b))),
+                       expr_const(g, 1.5f));
+    assert(expr_dim(y) == n);
+    assert(expr_eval(y, fused));
+    for (size_t i = 0; i < n; i++) {
+        float v = a->data[i] * x->data[i] + b->data[i];
+        assert(fused->data[i] == ((v > 0) ? v : 0) * 1.5f);
+    }
+    assert(expr_eval_unfused(y, unfused) && vec_same(fused, unfused));
+
+    // shared subexpressions, every op, a 1-element vec broadcast, and more
+    // live values than a plain chain needs
+    Expr* s = expr_sub(g, ax, expr_input(g, scalar));
+    Expr* t = expr_div(g, expr_max(g, s, expr_neg(g, ax)),
+                       expr_add(g, expr_const(g, 2.0f), expr_relu(g, s)));
+    Expr* z = expr_min(g, expr_mul(g, t, s), expr_add(g, ax, t));
+    size_t threads[2] = { 1, 4 };
+    for (size_t k = 0; k < 2; k++) {
+        parallel_set_threads(threads[k]);
+        assert(expr_eval(z, fused) && expr_eval_unfused(z, unfused));
+        assert(vec_same(fused, unfused));
+    }
+    parallel_set_threads(0);
+
+    // inputs are read at eval time, and out may be one of them
+    scalar->data[0] = -3.0f;
+    assert(expr_eval_unfused(z, unfused));
+    assert(expr_eval(z, a) && vec_same(a, unfused));
+
+    // a leaf root copies or broadcasts
+    assert(expr_eval(expr_input(g, x), fused) && vec_same(fused, x));
+    assert(expr_eval(expr_const(g, 7.0f), fused));
+    assert(fused->data[0] == 7.0f && fused->data[n - 1] == 7.0f);
+
+    // mismatched dims fail when building or evaluating, NULL propagates
+    Vec* short_vec = vec_init(3);
+    assert(expr_add(g, expr_input(g, x), expr_input(g, short_vec)) == NULL);
+    assert(expr_relu(g, NULL) == NULL && !expr_eval(NULL, fused));
+    assert(!expr_eval(y, short_vec) && !expr_eval_unfused(y, short_vec));
+
+    // a chain deeper than EXPR_MAX_NODES doesn't compile, and a very
+    // deep one is refused without walking all of it
+    Expr* deep = expr_input(g, x);
+    for (int i = 1; i < EXPR_MAX_NODES; i++) deep = expr_neg(g, deep);
+    assert(expr_eval(deep, fused));
+    deep = expr_neg(g, deep);
+    assert(!expr_eval(deep, fused));
+    for (int i = 0; i < 1000000; i++) deep = expr_neg(g, deep);
+    assert(!expr_eval(deep, fused) && !expr_eval_unfused(deep, unfused));
+
+    expr_graph_free(g);
+    vec_free(a);
+    vec_free(x);
+    vec_free(b);
+    vec_free(fused);
+    vec_free(unfused);
+    vec_free(scalar);
+    vec_free(short_vec);
+    parallel_shutdown();
+    printf("expr OK\n");
+}
+
+/* the kernels against double references: rows longer than a block with
+ * ragged tails, a stride wider than the row, and an offset large enough
+ * to break a naive one-pass variance */
+void test_reduce(void) {
+    for (size_t x = 0; x < 2000; x++) {
+        float v = -87.0f + (float)x * 0.0875f;
+        assert(fabs(vmath_expf(v) - exp(v)) <= 2e-7 * exp(v));
+    }
+    assert(vmath_expf(-1000.0f) == 0.0f && vmath_expf(-INFINITY) == 0.0f);
+    assert(isnan(vmath_expf(NAN)));
+
+    size_t cols_list[4] = { 1, 17, 300, 5000 };
+    size_t rows = 7;
+    for (size_t c = 0; c < 4; c++) {
+        size_t cols = cols_list[c];
+        size_t stride = cols + 3;
+        Vec* buf = vec_init(rows * stride);
+        Vec* out_buf = vec_init(rows * stride);
+        Vec* gamma = vec_init(cols);
+        Vec* beta = vec_init(cols);
+        Vec* r1 = vec_init(rows);
+        Vec* r2 = vec_init(rows);
+        Mat x = { buf->data, rows, cols, stride };
+        Mat out = { out_buf->data, rows, cols, stride };
+        for (size_t i = 0; i < cols; i++) {
+            gamma->data[i] = 0.5f + (float)(i % 7) * 0.1f;
+            beta->data[i] = (float)(i % 5) * 0.2f - 0.4f;
+        }
+
+        for (size_t r = 0; r < rows; r++) {
+            float* row = x.data + r * stride;
+            for (size_t i = 0; i < cols; i++) {
+                float noise = (float)((i * 7919 + r * 104729) % 1000) / 500.0f;
+                row[i] = 1000.0f + noise;
+            }
+        }
+        assert(mat_row_sum(&x, r1) && mat_row_max(&x, r2));
+        for (size_t r = 0; r < rows; r++) {
+            const float* row = x.data + r * stride;
+            double sum = 0;
+            float max = row[0];
+            for (size_t i = 0; i < cols; i++) {
+                sum += row[i];
+                if (row[i] > max) max = row[i];
+            }
+            assert(fabs(r1->data[r] - sum) <= 1e-6 * fabs(sum));
+            assert(r2->data[r] == max);
+        }
+
+        assert(mat_row_mean_var(&x, r1, r2) && mat_row_mean_var(&x, NULL, r2));
+        assert(mat_layernorm(&x, gamma, beta, 1e-5f, &out));
+        for (size_t r = 0; r < rows; r++) {
+            const float* row = x.data + r * stride;
+            double mean = 0, var = 0;
+            for (size_t i = 0; i < cols; i++) mean += row[i];
+            mean /= (double)cols;
+            for (size_t i = 0; i < cols; i++)
+                var += (row[i] - mean) * (row[i] - mean);
+            var /= (double)cols;
+            assert(fabs(r1->data[r] - mean) <= 1e-6 * mean);
+            assert(fabs(r2->data[r] - var) <= 1e-4 * var + 1e-9);
+            double rstd = 1.0 / sqrt(var + 1e-5);
+            for (size_t i = 0; i < cols; i++) {
+                double expected = (row[i] - mean) * rstd * gamma->data[i]
+                                + beta->data[i];
+                assert(fabs(out.data[r * stride + i] - expected) <= 1e-3);
+            }
+        }
+
+        // softmax inputs in a range where e^x overflows without the max
+        for (size_t r = 0; r < rows; r++) {
+            float* row = x.data + r * stride;
+            for (size_t i = 0; i < cols; i++)
+                row[i] = (float)((i * 31 + r * 17) % 400) * 0.25f - 20.0f
+                       + (float)r * 30.0f;
+        }
+        assert(mat_rmsnorm(&x, gamma, 1e-6f, &out));
+        for (size_t r = 0; r < rows; r++) {
+            const float* row = x.data + r * stride;
+            double ss = 0;
+            for (size_t i = 0; i < cols; i++) ss += (double)row[i] * row[i];
+            double rstd = 1.0 / sqrt(ss / (double)cols + 1e-6);
+            for (size_t i = 0; i < cols; i++) {
+                double expected = row[i] * rstd * gamma->data[i];
+                assert(fabs(out.data[r * stride + i] - expected)
+                       <= 1e-5 * (1 + fabs(expected)));
+            }
+        }
+
+        assert(mat_softmax(&x, &out));
+        for (size_t r = 0; r < rows; r++) {
+            const float* row = x.data + r * stride;
+            double max = row[0], sum = 0, total = 0;
+            for (size_t i = 0; i < cols; i++) if (row[i] > max) max = row[i];
+            for (size_t i = 0; i < cols; i++) sum += exp(row[i] - max);
+            for (size_t i = 0; i < cols; i++) {
+                double expected = exp(row[i] - max) / sum;
+                float got = out.data[r * stride + i];
+                assert(fabs(got - expected) <= 1e-6 * expected + 1e-30);
+                total += got;
+            }
+            assert(fabs(total - 1.0) <= 1e-5);
+        }
+
+        assert(mat_log_softmax(&x, &out));
+        for (size_t r = 0; r < rows; r++) {
+            const float* row = x.data + r * stride;
+            double max = row[0], sum = 0;
+            for (size_t i = 0; i < cols; i++) if (row[i] > max) max = row[i];
+            for (size_t i = 0; i < cols; i++) sum += exp(row[i] - max);
+            for (size_t i = 0; i < cols; i++) {
+                double expected = row[i] - max - log(sum);
+                assert(fabs(out.data[r * stride + i] - expected)
+                       <= 1e-5 * (1 + fabs(row[i])));
+            }
+        }
+        // in place gives the same
+        assert(mat_log_softmax(&x, &x));
+        for (size_t r = 0; r < rows; r++)
+            for (size_t i = 0; i < cols; i++)
+                assert(x.data[r * stride + i] == out.data[r * stride + i]);
+
+        Mat short_out = { out_buf->data, rows, cols - 1, stride };
+        Vec* wrong = vec_init(rows + 1);
+        assert(!mat_softmax(&x, &short_out) && !mat_row_sum(&x, wrong));
+        assert(!mat_layernorm(&x, wrong, NULL, 1e-5f, &out));
+
+        vec_free(wrong);
+        vec_free(buf);
+        vec_free(out_buf);
+        vec_free(gamma);
+        vec_free(beta);
+        vec_free(r1);
+        vec_free(r2);
+    }
+
+    Vec* v = vec_init(6);
+    Mat m = mat_view(v, 2, 3);
+    assert(m.data == v->data && m.rows == 2 && m.stride == 3);
+    assert(mat_view(v, 4, 2).data == NULL);
+    vec_free(v);
+    parallel_shutdown();
+    printf("reductions and normalization OK\n");
+}
+
+static float test_uniform(unsigned* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(*state >> 8) / (float)(1u << 24) * 2.0f - 1.0f;
+}
+
+/* softmax(q k^T / sqrt(d)) v for one query row of one head, in double */
+static void attention_reference(const Mat* q, const Mat* k, const Mat* v,
+                                size_t d, size_t h, size_t i, size_t seen,
+                                double* out) {
+    double scores[256], max = -INFINITY, sum = 0;
+    for (size_t j = 0; j < seen; j++) {
+        double s = 0;
+        for (size_t c = 0; c < d; c++)
+            s += (double)q->data[i * q->stride + h * d + c]
+               * k->data[j * k->stride + h * d + c];
+        scores[j] = s / sqrt((double)d);
+        if (scores[j] > max) max = scores[j];
+    }
+    for (size_t j = 0; j < seen; j++) sum += exp(scores[j] - max);
+    for (size_t c = 0; c < d; c++) {
+        out[c] = 0;
+        for (size_t j = 0; j < seen; j++)
+            out[c] += exp(scores[j] - max) / sum
+                    * v->data[j * v->stride + h * d + c];
+    }
+}
+
+void test_attention(void) {
+    // seq_q, seq_k, heads, head_dim, causal: ragged tiles, head_dim not a
+    // multiple of the lanes, and causal with more or fewer keys than queries
+    size_t cases[6][5] = {
+        { 1, 1, 1, 4, 0 }, { 70, 70, 3, 20, 1 }, { 50, 130, 2, 64, 1 },
+        { 100, 40, 2, 8, 1 }, { 65, 200, 4, 32, 0 }, { 33, 97, 1, 256, 1 },
+    };
+    unsigned state = 12345;
+    for (size_t t = 0; t < 6; t++) {
+        size_t seq_q = cases[t][0], seq_k = cases[t][1], heads = cases[t][2];
+        size_t d = cases[t][3], cols = heads * d, stride = cols + 5;
+        bool causal = cases[t][4];
+        Vec* qv = vec_init(seq_q * stride);
+        Vec* kv = vec_init(seq_k * cols);
+        Vec* vv = vec_init(seq_k * cols);
+        Vec* fused = vec_init(seq_q * cols);
+        Vec* naive = vec_init(seq_q * cols);
+        for (size_t i = 0; i < qv->dim; i++) qv->data[i] = test_uniform(&state);
+        for (size_t i = 0; i < kv->dim; i++) kv->data[i] = test_uniform(&state);
+        for (size_t i = 0; i < vv->dim; i++) vv->data[i] = test_uniform(&state);
+        Mat q = { qv->data, seq_q, cols, stride };
+        Mat k = mat_view(kv, seq_k, cols);
+        Mat v = mat_view(vv, seq_k, cols);
+        Mat out = mat_view(fused, seq_q, cols);
+        Mat out_naive = mat_view(naive, seq_q, cols);
+
+        assert(attention(&q, &k, &v, heads, causal, &out));
+        assert(attention_naive(&q, &k, &v, heads, causal, &out_naive));
+        double expected[256];
+        for (size_t h = 0; h < heads; h++) {
+            for (size_t i = 0; i < seq_q; i++) {
+                long seen = causal ? (long)i + (long)seq_k - (long)seq_q + 1
+                                   : (long)seq_k;
+                seen = (seen < 0) ? 0 : seen;
+                attention_reference(&q, &k, &v, d, h, i, (size_t)seen,
+                                    expected);
+                for (size_t c = 0; c < d; c++) {
+                    size_t at = i * cols + h * d + c;
+                    assert(fabs(fused->data[at] - expected[c]) <= 1e-5);
+                    assert(fabs(naive->data[at] - expected[c]) <= 1e-5);
+                }
+            }
+        }
+
+        // in place over a packed copy of q
+        if (seq_q == seq_k) {
+            Vec* copy = vec_init(seq_q * cols);
+            Mat qc = mat_view(copy, seq_q, cols);
+            for (size_t i = 0; i < seq_q; i++)
+                memcpy(copy->data + i * cols, q.data + i * stride,
+                       cols * sizeof(float));
+            assert(attention(&qc, &k, &v, heads, causal, &qc));
+            assert(memcmp(copy->data, fused->data,
+                          copy->dim * sizeof(float)) == 0);
+            vec_free(copy);
+        }
+        Mat narrow = k;
+        narrow.cols = cols - 1;
+        assert(!attention(&q, &narrow, &v, heads, causal, &out));
+        assert(!attention_naive(&q, &k, &v, 0, causal, &out));
+
+        vec_free(qv);
+        vec_free(kv);
+        vec_free(vv);
+        vec_free(fused);
+        vec_free(naive);
+    }
+    parallel_shutdown();
+    printf("attention OK\n");
+}
+
+/* the k nearest of every query by brute force in double, nearest first */
+static void vec_index_reference(const Mat* base, const Mat* queries,
+                                VecMetric metric, size_t k, VecHit* out) {
+    size_t d = base->cols;
+    for (size_t i = 0; i < queries->rows; i++) {
+        const float* q = queries->data + i * queries->stride;
+        VecHit* hits = out + i * k;
+        size_t n = 0;
+        for (size_t j = 0; j < base->rows; j++) {
+            const float* x = base->data + j * base->stride;
+            double dot = 0, qq = 0, xx = 0, l2 = 0;
+            for (size_t c = 0; c < d; c++) {
+                dot += (double)q[c] * x[c];
+                qq += (double)q[c] * q[c];
+                xx += (double)x[c] * x[c];
+                l2 += ((double)q[c] - x[c]) * ((double)q[c] - x[c]);
+            }
+            double dist = (metric == VEC_L2) ? l2
+                        : (metric == VEC_DOT) ? -dot
+                        : 1 - dot / sqrt(qq * xx);
+            // insertion into the sorted k best
+            size_t at = (n < k) ? n++ : k;
+            while (at > 0 && hits[at - 1].dist > dist) {
+                if (at < k) hits[at] = hits[at - 1];
+                at--;
+            }
+            if (at < k) hits[at] = (VecHit){ j, (float)dist };
+        }
+    }
+}
+
+static double vec_index_recall(const VecHit* got, const VecHit* want,
+                               size_t nq, size_t k) {
+    size_t found = 0;
+    for (size_t i = 0; i < nq; i++)
+        for (size_t a = 0; a < k; a++)
+            for (size_t b = 0; b < k; b++)
+                found += got[i * k + a].id == want[i * k + b].id;
+    return (double)found / (double)(nq * k);
+}
+
+/* field by field: memcmp would compare the padding after `dist` */
+static bool vec_hits_equal(const VecHit* a, const VecHit* b, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        if (a[i].id != b[i].id || a[i].dist != b[i].dist) return false;
+    return true;
+}
+
+static JsonObject* vec_index_reparse(JsonObject* saved) {
+    char* text = json_dumps(saved);
+    JsonObject* parsed = json_init();
+    assert(json_parse(parsed, text) == 0);
+    mem_free(text);
+    json_free(saved);
+    return parsed;
+}
+
+void test_vec_index(void) {
+    // dims with and without a tail past the lanes; queries past one chunk
+    size_t dims[2] = { 20, 32 }, n = 600, nq = 70, k = 10;
+    VecMetric metrics[3] = { VEC_L2, VEC_COSINE, VEC_DOT };
+    unsigned state = 777;
+    for (size_t t = 0; t < 6; t++) {
+        size_t d = dims[t % 2], stride = d + 3;
+        VecMetric metric = metrics[t / 2];
+        Vec* bv = vec_init(n * d);
+        Vec* qv = vec_init(nq * stride);
+        for (size_t i = 0; i < bv->dim; i++) bv->data[i] = test_uniform(&state);
+        for (size_t i = 0; i < qv->dim; i++) qv->data[i] = test_uniform(&state);
+        Mat base = mat_view(bv, n, d);
+        Mat queries = { qv->data, nq, d, stride };
+        VecHit* want = malloc(nq * k * sizeof(VecHit));
+        VecHit* flat_hits = malloc(nq * k * sizeof(VecHit));
+        VecHit* hnsw_hits = malloc(nq * k * sizeof(VecHit));
+        VecHit* again = malloc(nq * k * sizeof(VecHit));
+        vec_index_reference(&base, &queries, metric, k, want);
+
+        // flat is exact, added in two parts
+        FlatIndex* flat = flat_index_init(d, metric);
+        Mat first = base, rest = base;
+        first.rows = 250;
+        rest.rows = n - 250;
+        rest.data += 250 * d;
+        assert(flat_index_add(flat, &first) && flat_index_add(flat, &rest));
+        assert(flat_index_size(flat) == n);
+        assert(flat_index_search(flat, &queries, k, flat_hits));
+        for (size_t i = 0; i < nq * k; i++) {
+            assert(flat_hits[i].id == want[i].id);
+            assert(fabsf(flat_hits[i].dist - want[i].dist) <= 1e-4f);
+        }
+
+        // hnsw finds most of them, and all of them searching everything
+        HnswParams params = { 8, 64, 1 };
+        HnswIndex* hnsw = hnsw_index_init(d, metric, &params);
+        assert(hnsw_index_add(hnsw, &base) && hnsw_index_size(hnsw) == n);
+        assert(hnsw_index_search(hnsw, &queries, k, 64, hnsw_hits));
+        assert(vec_index_recall(hnsw_hits, want, nq, k) >= 0.9);
+        assert(hnsw_index_search(hnsw, &queries, k, n, hnsw_hits));
+        assert(vec_index_recall(hnsw_hits, want, nq, k) >= 0.99);
+        for (size_t i = 0; i < nq * k; i++)
+            if (hnsw_hits[i].id == flat_hits[i].id)
+                assert(fabsf(hnsw_hits[i].dist - flat_hits[i].dist)
+                       <= 1e-5f * (1 + fabsf(flat_hits[i].dist)));
+
+        // saved, written out and read back, both search the same
+        JsonObject* saved = vec_index_reparse(flat_index_to_json(flat));
+        FlatIndex* flat2 = flat_index_from_json(saved);
+        assert(flat2 != NULL && hnsw_index_from_json(saved) == NULL);
+        assert(flat_index_search(flat2, &queries, k, again));
+        assert(vec_hits_equal(again, flat_hits, nq * k));
+        json_free(saved);
+        saved = vec_index_reparse(hnsw_index_to_json(hnsw));
+        HnswIndex* hnsw2 = hnsw_index_from_json(saved);
+        assert(hnsw2 != NULL && flat_index_from_json(saved) == NULL);
+        assert(hnsw_index_search(hnsw2, &queries, k, n, again));
+        assert(vec_hits_equal(again, hnsw_hits, nq * k));
+        json_set_num(saved, "m", 1);
+        assert(hnsw_index_from_json(saved) == NULL);
+        json_set_num(saved, "m", (double)HNSW_MAX_M + 1);
+        assert(hnsw_index_from_json(saved) == NULL);
+        json_set_num(saved, "m", 9007199254740992.0);
+        assert(hnsw_index_from_json(saved) == NULL);
+        json_set_num(saved, "m", (double)params.m);
+        HnswIndex* hnsw3 = hnsw_index_from_json(saved);
+        assert(hnsw3 != NULL);
+        hnsw_index_free(hnsw3);
+        Vec* links;
+        assert(json_get_vec(saved, "links", &links));
+        links->data[1] = (float)n;      // a link past the last vector
+        assert(hnsw_index_from_json(saved) == NULL);
+        json_free(saved);
+
+        Mat narrow = queries;
+        narrow.cols = d - 1;
+        assert(!flat_index_search(flat, &narrow, k, again));
+        assert(!hnsw_index_add(hnsw, &narrow));
+        flat_index_free(flat);
+        flat_index_free(flat2);
+        hnsw_index_free(hnsw);
+        hnsw_index_free(hnsw2);
+        free(want);
+        free(flat_hits);
+        free(hnsw_hits);
+        free(again);
+        vec_free(bv);
+        vec_free(qv);
+    }
+
+    // fewer vectors than k, and none at all
+    float few[6] = { 0, 0, 1, 1, 3, 3 };
+    Mat small = { few, 3, 2, 2 };
+    Mat query = { few + 2, 1, 2, 2 };
+    VecHit hits[5];
+    FlatIndex* flat = flat_index_init(2, VEC_L2);
+    HnswIndex* hnsw = hnsw_index_init(2, VEC_L2, NULL);
+    assert(hnsw_index_search(hnsw, &query, 5, 0, hits));
+    assert(hits[0].id == VEC_INDEX_NONE && hits[0].dist == INFINITY);
+    assert(flat_index_add(flat, &small) && hnsw_index_add(hnsw, &small));
+    for (size_t t = 0; t < 2; t++) {
+        assert(t ? hnsw_index_search(hnsw, &query, 5, 0, hits)
+                 : flat_index_search(flat, &query, 5, hits));
+        assert(hits[0].id == 1 && hits[0].dist == 0);
+        assert(hits[1].id == 0 && hits[2].id == 2 && hits[1].dist == 2);
+        assert(hits[3].id == VEC_INDEX_NONE && hits[4].dist == INFINITY);
+    }
+    flat_index_free(flat);
+    hnsw_index_free(hnsw);
+
+    // split over threads by stored range, merged to the same result
+    size_t big = 9000;
+    Vec* bv = vec_init(big * 4);
+    for (size_t i = 0; i < bv->dim; i++) bv->data[i] = test_uniform(&state);
+    Mat base = mat_view(bv, big, 4), queries = { bv->data, 2, 4, 4 };
+    VecHit want[2 * 8], one[2 * 8], four[2 * 8];
+    vec_index_reference(&base, &queries, VEC_L2, 8, want);
+    flat = flat_index_init(4, VEC_L2);
+    assert(flat_index_add(flat, &base));
+    parallel_set_threads(1);
+    assert(flat_index_search(flat, &queries, 8, one));
+    for (size_t i = 0; i < 2 * 8; i++) {
+        assert(one[i].id == want[i].id);
+        assert(fabsf(one[i].dist - want[i].dist) <= 1e-4f);
+    }
+    parallel_set_threads(4);
+    assert(flat_index_search(flat, &queries, 8, four));
+    assert(vec_hits_equal(one, four, 2 * 8) && one[0].id == 0);
+    parallel_set_threads(0);
+    flat_index_free(flat);
+    vec_free(bv);
+    parallel_shutdown();
+    printf("vec index OK\n");
+}
+
+static char* test_read_file(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    String s;
+    string_init(&s);
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+        string_append_n(&s, buf, len);
+    fclose(file);
+    char* out = string_take(&s, &len);
+    string_deinit(&s);
+    return out;
+}
+
+void test_json_clone(void) {
+    JsonInterner* keys = json_interner_init(false);
+    JsonObject* j = json_init_interned(keys);
+    assert(json_parse(j, "{\"name\": \"net\", \"w\": [1.5, -2, 3], "
+                         "\"layers\": [{\"b\": [0.25]}, \"x\", [\"y\"]], "
+                         "\"opt\": {\"lr\": \"0.1\", \"m\": {}}}") == 0);
+    json_set_num(j, "step", 7);
+    JsonObject* copy = json_clone(j);
+    assert(copy != NULL && copy->keys == NULL && copy->parent == NULL);
+    assert(json_clone(NULL) == NULL);
+    char* want = json_dumps(j);
+    char* got = json_dumps(copy);
+    assert(strcmp(want, got) == 0);
+    mem_free(got);
+
+    // nothing is shared: changing, then freeing, the original leaves it
+    Vec* w = NULL;
+    assert(json_get_vec(j, "w", &w));
+    w->data[0] = 99;
+    json_set_str(j, "name", "other");
+    json_free(j);
+    json_interner_release(keys);
+    got = json_dumps(copy);
+    assert(strcmp(want, got) == 0);
+    mem_free(got);
+
+    // nested objects know their parent, as json_mark_dirty needs
+    size_t nested = 0;
+    for (JsonPair* pair = copy->head; pair != NULL; pair = pair->next) {
+        JsonValue* value = pair->value;
+        if (value->type == J_OBJ) {
+            assert(value->value.obj->parent == copy);
+            assert(value->value.obj->head->next->value->value.obj->parent
+                   == value->value.obj);
+            nested++;
+        } else if (value->type == J_ARR) {
+            assert(value->value.arr->values[0].value.obj->parent == copy);
+            nested++;
+        }
+    }
+    assert(nested == 2);
+
+    // written whole, to a file read back the same, with no temp file left
+    const char* path = "/tmp/json_dump_test.json";
+    assert(json_dump(copy, path));
+    char* file = test_read_file(path);
+    assert(file != NULL && strcmp(file, want) == 0);
+    mem_free(file);
+    assert(fopen("/tmp/json_dump_test.json.tmp", "r") == NULL);
+    json_set_num(copy, "step", 8);
+    assert(json_dump(copy, path));
+    file = test_read_file(path);
+    assert(strstr(file, "\"step\": 8") != NULL);
+    mem_free(file);
+    remove(path);
+    assert(!json_dump(copy, "/nonexistent/dir/x.json"));
+
+    mem_free(want);
+    json_free(copy);
+    printf("json clone and dump OK\n");
+}
+
+void test_checkpoint(void) {
+    Checkpointer* c = checkpoint_init();
+    assert(c != NULL);
+    JsonObject* j = json_init();
+    Vec* w = vec_init(1000);
+    for (size_t i = 0; i < w->dim; i++) w->data[i] = (float)i;
+    json_set_vec(j, "w", w);
+    json_set_num(j, "step", 0);
+
+    // each file holds the document as it was when it was saved, even
+    // though it is changed right after. more saves are queued than
+    // CHECKPOINT_QUEUE, so the later ones wait for a slot
+    enum { N_SAVES = 2 * CHECKPOINT_QUEUE + 2 };
+    char paths[N_SAVES][64];
+    char* want[N_SAVES];
+    CheckpointJob* jobs[N_SAVES];
+    for (int i = 0; i < N_SAVES; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/checkpoint_test_%d.json",
+                 i);
+        want[i] = json_dumps(j);
+        jobs[i] = checkpoint_save(c, j, paths[i]);
+        assert(jobs[i] != NULL);
+        for (size_t e = 0; e < w->dim; e++) w->data[e] += 1;
+        json_set_num(j, "step", i + 1);
+    }
+    for (int i = 0; i < N_SAVES; i++) {
+        assert(checkpoint_wait(jobs[i]));
+        char* got = test_read_file(paths[i]);
+        assert(got != NULL && strcmp(got, want[i]) == 0);
+        mem_free(got);
+        mem_free(want[i]);
+        remove(paths[i]);
+    }
+
+    // nothing to save is refused up front
+    assert(checkpoint_save(NULL, j, paths[0]) == NULL);
+    assert(checkpoint_save(c, NULL, paths[0]) == NULL);
+    assert(checkpoint_save(c, j, NULL) == NULL);
+
+    // a write that fails is reported, by the job and in the stats
+    CheckpointJob* bad = checkpoint_save(c, j, "/nonexistent/dir/x.json");
+    assert(bad != NULL);
+    while (checkpoint_poll(bad) == CHECKPOINT_PENDING) {}
+    assert(checkpoint_poll(bad) == CHECKPOINT_FAILED);
+    assert(!checkpoint_wait(bad));
+
+    // many saves to one file: the last one is what's left
+    CheckpointJob* last = NULL;
+    for (int i = 0; i < 10; i++) {
+        json_set_num(j, "step", 100 + i);
+        if (last != NULL) assert(checkpoint_wait(last));
+        last = checkpoint_save(c, j, paths[0]);
+    }
+    CheckpointStats stats;
+    checkpoint_stats(c, &stats);
+    assert(stats.saves == N_SAVES + 11 && stats.failed == 1);
+    assert(stats.stall_ns > 0 && stats.max_stall_ns <= stats.stall_ns);
+    assert(stats.last_stall_ns <= stats.max_stall_ns);
+
+    // freeing the checkpointer writes what's still queued
+    checkpoint_free(c);
+    assert(checkpoint_poll(last) == CHECKPOINT_DONE);
+    assert(checkpoint_wait(last));
+    char* got = test_read_file(paths[0]);
+    assert(got != NULL && strstr(got, "\"step\": 109") != NULL);
+    mem_free(got);
+    remove(paths[0]);
+    json_free(j);
+    printf("checkpoint OK\n");
+}
+
+/* mean, variance, skewness and kurtosis of `v`, in double */
+static void prng_moments(const Vec* v, double m[4]) {
+    double mean = 0;
+    for (size_t i = 0; i < v->dim; i++) mean += v->data[i];
+    mean /= (double)v->dim;
+    double m2 = 0, m3 = 0, m4 = 0;
+    for (size_t i = 0; i < v->dim; i++) {
+        double d = v->data[i] - mean;
+        m2 += d * d;
+        m3 += d * d * d;
+        m4 += d * d * d * d;
+    }
+    m2 /= (double)v->dim;
+    m[0] = mean;
+    m[1] = m2;
+    m[2] = m3 / (double)v->dim / pow(m2, 1.5);
+    m[3] = m4 / (double)v->dim / (m2 * m2);
+}
+
+void test_prng(void) {
+    const double pi = 3.14159265358979324;
+    // philox4x32-10 known answers, from the random123 distribution
+    const uint32_t kat[3][10] = {
+        { 0, 0, 0, 0, 0, 0,
+          0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+        { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+          0xffffffff, 0xffffffff,
+          0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344,
+          0xa4093822, 0x299f31d0,
+          0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 },
+    };
+    for (size_t t = 0; t < 3; t++) {
+        uint32_t out[4];
+        prng_philox(kat[t], kat[t] + 4, out);
+        assert(memcmp(out, kat[t] + 6, sizeof(out)) == 0);
+    }
+
+    // the inline math the fills use
+    for (float x = 1e-30f; x < 1e30f; x *= 1.37f)
+        assert(fabs(vmath_logf(x) - log(x)) <= 2.5e-7 * fabs(log(x)) + 1e-7);
+    for (float x = 0; x < 100; x += 0.0371f)
+        assert(fabs(vmath_sqrtf(x) - sqrt(x)) <= 2.5e-7 * sqrt(x));
+    assert(vmath_sqrtf(0) == 0);
+    for (float u = 0; u < 1; u += 1.0f / 4099) {
+        float s, c;
+        vmath_sincos_turn(u, &s, &c);
+        assert(fabs(s - sin(2 * pi * u)) <= 3e-7);
+        assert(fabs(c - cos(2 * pi * u)) <= 3e-7);
+    }
+    for (float x = -0.9999f; x < 0.9999f; x += 0.000731f)
+        assert(fabs(erf(vmath_erfinvf(x)) - x) <= 5e-7);
+
+    // bit-identical whatever the thread count, and with the tail short
+    size_t n = (1 << 20) + 37;
+    Vec* one = vec_init(n);
+    Vec* many = vec_init(n);
+    Prng a = prng_init(1234), b = prng_init(1234);
+    parallel_set_threads(1);
+    assert(prng_normal(&a, one, 0, 1));
+    parallel_set_threads(4);
+    assert(prng_normal(&b, many, 0, 1));
+    assert(memcmp(one->data, many->data, n * sizeof(float)) == 0);
+    assert(a.counter == b.counter && a.counter == (n + 63) / 64 * 16);
+    // a fill of whole groups then the rest is the same as one fill
+    Prng c = prng_init(1234);
+    Vec head = { many->data, 640 }, rest = { many->data + 640, n - 640 };
+    assert(prng_normal(&c, &head, 0, 1) && prng_normal(&c, &rest, 0, 1));
+    assert(memcmp(one->data, many->data, n * sizeof(float)) == 0);
+    // later fills and other seeds give other numbers
+    assert(prng_normal(&b, many, 0, 1));
+    assert(memcmp(one->data, many->data, 64 * sizeof(float)) != 0);
+    Prng d = prng_init(1235);
+    assert(prng_normal(&d, many, 0, 1));
+    assert(memcmp(one->data, many->data, 64 * sizeof(float)) != 0);
+    parallel_set_threads(0);
+
+    // statistics: n is large, so each estimate is within a few parts in
+    // a thousand of the truth
+    double m[4];
+    Prng rng = prng_init(42);
+    assert(prng_uniform(&rng, one, -1, 3));
+    size_t bins[16] = {0};
+    for (size_t i = 0; i < n; i++) {
+        assert(one->data[i] >= -1 && one->data[i] <= 3);
+        bins[(size_t)((one->data[i] + 1) * 4) & 15]++;
+    }
+    double chi2 = 0, expect = (double)n / 16;
+    for (size_t k = 0; k < 16; k++)
+        chi2 += (bins[k] - expect) * (bins[k] - expect) / expect;
+    assert(chi2 < 45);     // 15 degrees of freedom: p < 0.0001
+    prng_moments(one, m);
+    assert(fabs(m[0] - 1) < 0.01 && fabs(m[1] / (16.0 / 12) - 1) < 0.01);
+
+    assert(prng_normal(&rng, one, 2, 3));
+    prng_moments(one, m);
+    assert(fabs(m[0] - 2) < 0.02 && fabs(m[1] / 9 - 1) < 0.01);
+    assert(fabs(m[2]) < 0.02 && fabs(m[3] - 3) < 0.03);
+    size_t within = 0;
+    for (size_t i = 0; i < n; i++) within += fabsf(one->data[i] - 2) < 3;
+    assert(fabs((double)within / (double)n - 0.682689) < 0.003);
+
+    // truncated to [lo, hi]: the moments of the truncated distribution
+    const float bounds[3][2] = { { -2, 2 }, { 0.5f, 2 }, { -1, 3.5f } };
+    for (size_t t = 0; t < 3; t++) {
+        double lo = bounds[t][0], hi = bounds[t][1];
+        assert(prng_truncated_normal(&rng, one, 1, 2, lo, hi));
+        for (size_t i = 0; i < n; i++)
+            assert(one->data[i] >= 1 + 2 * lo && one->data[i] <= 1 + 2 * hi);
+        double pdf_lo = exp(-lo * lo / 2) / sqrt(2 * pi);
+        double pdf_hi = exp(-hi * hi / 2) / sqrt(2 * pi);
+        double z = (erf(hi / sqrt(2)) - erf(lo / sqrt(2))) / 2;
+        double mean = (pdf_lo - pdf_hi) / z;
+        double var = 1 + (lo * pdf_lo - hi * pdf_hi) / z - mean * mean;
+        prng_moments(one, m);
+        assert(fabs(m[0] - (1 + 2 * mean)) < 0.01);
+        assert(fabs(m[1] / (4 * var) - 1) < 0.01);
+    }
+
+    // bad parameters do nothing
+    Prng before = rng;
+    assert(!prng_uniform(&rng, one, 1, 0));
+    assert(!prng_normal(&rng, one, 0, -1));
+    assert(!prng_normal(&rng, one, NAN, 1));
+    assert(!prng_truncated_normal(&rng, one, 0, 1, 2, 2));
+    assert(!prng_truncated_normal(&rng, one, 0, 1, -INFINITY, 1));
+    Vec empty = { NULL, 8 };
+    assert(!prng_uniform(NULL, one, 0, 1));
+    assert(!prng_normal(&rng, NULL, 0, 1));
+    assert(!prng_truncated_normal(&rng, &empty, 0, 1, -1, 1));
+    assert(rng.counter == before.counter);
+
+    vec_free(one);
+    vec_free(many);
+    parallel_shutdown();
+    printf("prng OK\n");
+}
 
 int main() {
     test_json_build();
     test_json_vec();
     test_json_parse();
+    test_json_batch();
+    test_json_schema();
+    test_json_intern();
+    test_json_deep();
+    test_json_wide();
+    test_json_upsert();
+    test_vec_ops();
+    test_mem_accounting();
+    test_trace();
+    test_string_builder();
+    test_expr();
+    test_reduce();
+    test_attention();
+    test_vec_index();
+    test_json_clone();
+    test_checkpoint();
+    test_prng();
 }
 